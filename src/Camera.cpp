@@ -1,7 +1,7 @@
 #include "headers/Camera.h"
 
 Camera::Camera(glm::vec3 position, glm::vec3 target, glm::vec3 up)
-    : position(position), target(target), worldUp(up), yaw(-25.0f), pitch(-25.0f), distanceFromTarget(5.0f), mouseHeld(false) {
+    : position(position), target(target), worldUp(up), yaw(-25.0f), pitch(-25.0f), distanceFromTarget(5.0f), mouseHeld(false), version(0) {
     front = glm::normalize(target - position);
     updateCameraVectors();
 }
@@ -58,8 +58,13 @@ void Camera::updateCameraVectors() {
 
     right = glm::normalize(glm::cross(worldUp, this->front));
     up = glm::normalize(glm::cross(this->front, right));
+    version++;
 }
 
 glm::vec3 Camera::getPosition() const {
     return position;
 }
+
+unsigned int Camera::getVersion() const {
+    return version;
+}
@@ -0,0 +1,142 @@
+#include "headers/FrameGraph.h"
+#include <algorithm>
+#include <iostream>
+
+// Weight of the newest sample in the averaged timings
+static const double TIMING_SMOOTHING = 0.1;
+
+FrameGraph::FrameGraph()
+    : executed(false) {}
+
+FrameGraph::~FrameGraph() {
+    cleanup();
+}
+
+void FrameGraph::beginFrame() {
+    passes.clear();
+    executed = false;
+}
+
+int FrameGraph::addResource(const std::string& name) {
+    auto it = std::find(resources.begin(), resources.end(), name);
+    if (it != resources.end()) {
+        return static_cast<int>(it - resources.begin());
+    }
+    resources.push_back(name);
+    graphOutputs.push_back(false);
+    return static_cast<int>(resources.size()) - 1;
+}
+
+void FrameGraph::markOutput(int resource) {
+    if (resource >= 0 && resource < static_cast<int>(graphOutputs.size())) {
+        graphOutputs[resource] = true;
+    }
+}
+
+void FrameGraph::addPass(const std::string& name, const std::vector<int>& inputs, const std::vector<int>& outputs,
+    PassFunction execute, void* context) {
+    if (executed) {
+        std::cerr << "Frame graph: pass " << name << " added after the frame was executed" << std::endl;
+        return;
+    }
+    passes.push_back({ name, inputs, outputs, execute, context, false });
+}
+
+void FrameGraph::cullPasses() {
+    // Walk back from the graph outputs: a pass is live if a later live pass reads what it writes
+    std::vector<bool> needed = graphOutputs;
+    for (auto pass = passes.rbegin(); pass != passes.rend(); ++pass) {
+        pass->live = std::any_of(pass->outputs.begin(), pass->outputs.end(), [&needed](int resource) {
+            return resource >= 0 && resource < static_cast<int>(needed.size()) && needed[resource];
+        });
+        if (pass->live) {
+            for (int resource : pass->inputs) {
+                if (resource >= 0 && resource < static_cast<int>(needed.size())) {
+                    needed[resource] = true;
+                }
+            }
+        }
+    }
+}
+
+void FrameGraph::execute() {
+    if (executed) {
+        std::cerr << "Frame graph: the frame was already executed, ignoring the second submission" << std::endl;
+        return;
+    }
+    executed = true;
+
+    cullPasses();
+
+    stats.clear();
+    for (const Pass& pass : passes) {
+        PassTimer& timer = getTimer(pass.name);
+
+        // Collect the GPU time of earlier frames that is available by now
+        for (int i = 0; i < TIMER_QUERY_COUNT; ++i) {
+            if (!timer.pending[i]) {
+                continue;
+            }
+            GLint available = 0;
+            glGetQueryObjectiv(timer.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 elapsed = 0;
+                glGetQueryObjectui64v(timer.queries[i], GL_QUERY_RESULT, &elapsed);
+                timer.gpuMs += (elapsed / 1.0e6 - timer.gpuMs) * TIMING_SMOOTHING;
+                timer.pending[i] = false;
+            }
+        }
+
+        if (pass.live) {
+            // All queries still in flight: skip the GPU measurement this frame rather than stall
+            int query = timer.next;
+            bool measure = !timer.pending[query];
+
+            auto start = std::chrono::high_resolution_clock::now();
+            if (measure) {
+                glBeginQuery(GL_TIME_ELAPSED, timer.queries[query]);
+            }
+
+            pass.execute(pass.context);
+
+            if (measure) {
+                glEndQuery(GL_TIME_ELAPSED);
+                timer.pending[query] = true;
+                timer.next = (query + 1) % TIMER_QUERY_COUNT;
+            }
+            double cpuMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            timer.cpuMs += (cpuMs - timer.cpuMs) * TIMING_SMOOTHING;
+        }
+
+        stats.push_back({ pass.name, !pass.live, timer.cpuMs, timer.gpuMs });
+    }
+}
+
+const std::vector<PassStats>& FrameGraph::getPassStats() const {
+    return stats;
+}
+
+void FrameGraph::cleanup() {
+    for (PassTimer& timer : timers) {
+        glDeleteQueries(TIMER_QUERY_COUNT, timer.queries);
+    }
+    timers.clear();
+}
+
+FrameGraph::PassTimer& FrameGraph::getTimer(const std::string& name) {
+    for (PassTimer& timer : timers) {
+        if (timer.name == name) {
+            return timer;
+        }
+    }
+
+    PassTimer timer;
+    timer.name = name;
+    glGenQueries(TIMER_QUERY_COUNT, timer.queries);
+    std::fill(timer.pending, timer.pending + TIMER_QUERY_COUNT, false);
+    timer.next = 0;
+    timer.cpuMs = 0.0;
+    timer.gpuMs = 0.0;
+    timers.push_back(timer);
+    return timers.back();
+}
@@ -0,0 +1,117 @@
+#include "headers/GLDebug.h"
+
+#if GL_DEBUG_LAYER
+
+#include <atomic>
+#include <iostream>
+
+// Callback state; the driver may call onMessage from its own thread
+static bool callbackActive = false;
+static GLenum minimumSeverity = GL_DEBUG_SEVERITY_MEDIUM;
+static std::atomic<size_t> messageCount(0);
+
+// Severities from most to least important
+static const GLenum SEVERITIES[] = {
+    GL_DEBUG_SEVERITY_HIGH, GL_DEBUG_SEVERITY_MEDIUM, GL_DEBUG_SEVERITY_LOW, GL_DEBUG_SEVERITY_NOTIFICATION
+};
+
+static const char* sourceName(GLenum source) {
+    switch (source) {
+    case GL_DEBUG_SOURCE_API: return "API";
+    case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "Window System";
+    case GL_DEBUG_SOURCE_SHADER_COMPILER: return "Shader Compiler";
+    case GL_DEBUG_SOURCE_THIRD_PARTY: return "Third Party";
+    case GL_DEBUG_SOURCE_APPLICATION: return "Application";
+    default: return "Other";
+    }
+}
+
+static const char* typeName(GLenum type) {
+    switch (type) {
+    case GL_DEBUG_TYPE_ERROR: return "Error";
+    case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "Deprecated";
+    case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "Undefined Behavior";
+    case GL_DEBUG_TYPE_PORTABILITY: return "Portability";
+    case GL_DEBUG_TYPE_PERFORMANCE: return "Performance";
+    case GL_DEBUG_TYPE_MARKER: return "Marker";
+    default: return "Other";
+    }
+}
+
+static const char* severityName(GLenum severity) {
+    switch (severity) {
+    case GL_DEBUG_SEVERITY_HIGH: return "high";
+    case GL_DEBUG_SEVERITY_MEDIUM: return "medium";
+    case GL_DEBUG_SEVERITY_LOW: return "low";
+    default: return "notification";
+    }
+}
+
+void GLDebug::init() {
+    // KHR_debug is core in 4.3; the context must have been created with the debug flag to report much
+    callbackActive = (GLEW_VERSION_4_3 || GLEW_KHR_debug) && glDebugMessageCallback != nullptr;
+    if (!callbackActive) {
+        std::cout << "KHR_debug not available, GL errors are checked with glGetError" << std::endl;
+        return;
+    }
+
+    // Asynchronous output: messages may arrive a few calls late, but no call waits for the driver
+    glEnable(GL_DEBUG_OUTPUT);
+    glDebugMessageCallback(onMessage, nullptr);
+    setMinimumSeverity(minimumSeverity);
+}
+
+bool GLDebug::isCallbackActive() {
+    return callbackActive;
+}
+
+void GLDebug::setMinimumSeverity(GLenum severity) {
+    minimumSeverity = severity;
+    if (!callbackActive) {
+        return;
+    }
+
+    // Enable everything down to the minimum, disable the rest
+    bool enabled = true;
+    for (GLenum level : SEVERITIES) {
+        glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, level, 0, nullptr, enabled ? GL_TRUE : GL_FALSE);
+        if (level == severity) {
+            enabled = false;
+        }
+    }
+}
+
+GLenum GLDebug::getMinimumSeverity() {
+    return minimumSeverity;
+}
+
+void GLDebug::setObjectLabel(GLenum identifier, GLuint name, const char* label) {
+    if (callbackActive && name != 0) {
+        glObjectLabel(identifier, name, -1, label);
+    }
+}
+
+void GLDebug::checkErrors(const char* where) {
+    if (callbackActive) {
+        return;
+    }
+
+    GLenum err;
+    while ((err = glGetError()) != GL_NO_ERROR) {
+        std::cerr << "OpenGL error in " << where << ": 0x" << std::hex << err << std::dec << std::endl;
+        messageCount++;
+    }
+}
+
+size_t GLDebug::getMessageCount() {
+    return messageCount;
+}
+
+void GLAPIENTRY GLDebug::onMessage(GLenum source, GLenum type, GLuint id, GLenum severity,
+    GLsizei /*length*/, const GLchar* message, GLvoid* /*userParam*/) {
+    messageCount++;
+    std::cerr << "OpenGL " << typeName(type) << " (" << sourceName(source) << ", " << severityName(severity)
+        << ", id " << id << "): " << message << std::endl;
+}
+
+#endif // GL_DEBUG_LAYER
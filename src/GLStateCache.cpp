@@ -0,0 +1,196 @@
+#include "headers/GLStateCache.h"
+#include <algorithm>
+
+GLStateCache& GLStateCache::get() {
+    static GLStateCache cache;
+    return cache;
+}
+
+GLStateCache::GLStateCache()
+    : program(0), vertexArray(0), framebuffer(0), viewport{ 0, 0, 0, 0 },
+    programKnown(false), vertexArrayKnown(false), framebufferKnown(false), viewportKnown(false),
+    activeUnit(0), activeUnitKnown(false),
+    issuedCalls(0), filteredCalls(0), lastIssuedCalls(0), lastFilteredCalls(0) {}
+
+void GLStateCache::beginFrame() {
+    lastIssuedCalls = issuedCalls;
+    lastFilteredCalls = filteredCalls;
+    issuedCalls = 0;
+    filteredCalls = 0;
+    invalidate();
+}
+
+void GLStateCache::invalidate() {
+    programKnown = false;
+    vertexArrayKnown = false;
+    framebufferKnown = false;
+    viewportKnown = false;
+    activeUnitKnown = false;
+    textureBindings.clear();
+    bufferBindings.clear();
+    capabilities.clear();
+}
+
+bool GLStateCache::track(bool changed) {
+    if (changed) {
+        issuedCalls++;
+    }
+    else {
+        filteredCalls++;
+    }
+    return changed;
+}
+
+void GLStateCache::useProgram(GLuint newProgram) {
+    if (track(!programKnown || program != newProgram)) {
+        glUseProgram(newProgram);
+        program = newProgram;
+        programKnown = true;
+    }
+}
+
+void GLStateCache::bindVertexArray(GLuint vao) {
+    if (track(!vertexArrayKnown || vertexArray != vao)) {
+        glBindVertexArray(vao);
+        vertexArray = vao;
+        vertexArrayKnown = true;
+    }
+}
+
+void GLStateCache::bindFramebuffer(GLuint newFramebuffer) {
+    if (track(!framebufferKnown || framebuffer != newFramebuffer)) {
+        glBindFramebuffer(GL_FRAMEBUFFER, newFramebuffer);
+        framebuffer = newFramebuffer;
+        framebufferKnown = true;
+    }
+}
+
+void GLStateCache::setViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    bool changed = !viewportKnown || viewport[0] != x || viewport[1] != y || viewport[2] != width || viewport[3] != height;
+    if (track(changed)) {
+        glViewport(x, y, width, height);
+        viewport[0] = x;
+        viewport[1] = y;
+        viewport[2] = width;
+        viewport[3] = height;
+        viewportKnown = true;
+    }
+}
+
+void GLStateCache::setViewportArray(GLsizei count, const GLfloat* viewports) {
+    track(true);
+    glViewportArrayv(0, count, viewports);
+    viewportKnown = false;
+}
+
+void GLStateCache::setEnabled(GLenum capability, bool enabled) {
+    auto it = std::find_if(capabilities.begin(), capabilities.end(), [capability](const Capability& entry) {
+        return entry.capability == capability;
+    });
+    if (!track(it == capabilities.end() || it->enabled != enabled)) {
+        return;
+    }
+
+    if (enabled) {
+        glEnable(capability);
+    }
+    else {
+        glDisable(capability);
+    }
+
+    if (it == capabilities.end()) {
+        capabilities.push_back({ capability, enabled });
+    }
+    else {
+        it->enabled = enabled;
+    }
+}
+
+void GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture) {
+    auto it = std::find_if(textureBindings.begin(), textureBindings.end(), [unit, target](const TextureBinding& entry) {
+        return entry.unit == unit && entry.target == target;
+    });
+    if (!track(it == textureBindings.end() || it->texture != texture)) {
+        return;
+    }
+
+    // The active unit is only part of the binding, it is switched lazily
+    setActiveUnit(unit);
+    glBindTexture(target, texture);
+
+    if (it == textureBindings.end()) {
+        textureBindings.push_back({ unit, target, texture });
+    }
+    else {
+        it->texture = texture;
+    }
+}
+
+void GLStateCache::bindTextureForUpdate(GLenum target, GLuint texture) {
+    bindTexture(UPDATE_TEXTURE_UNIT, target, texture);
+    setActiveUnit(UPDATE_TEXTURE_UNIT);
+}
+
+void GLStateCache::setActiveUnit(GLuint unit) {
+    if (track(!activeUnitKnown || activeUnit != unit)) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        activeUnit = unit;
+        activeUnitKnown = true;
+    }
+}
+
+void GLStateCache::bindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+    auto it = std::find_if(bufferBindings.begin(), bufferBindings.end(), [target, index](const BufferBinding& entry) {
+        return entry.target == target && entry.index == index;
+    });
+    if (!track(it == bufferBindings.end() || it->buffer != buffer)) {
+        return;
+    }
+
+    glBindBufferBase(target, index, buffer);
+
+    if (it == bufferBindings.end()) {
+        bufferBindings.push_back({ target, index, buffer });
+    }
+    else {
+        it->buffer = buffer;
+    }
+}
+
+void GLStateCache::forgetProgram(GLuint oldProgram) {
+    if (program == oldProgram) {
+        programKnown = false;
+    }
+}
+
+void GLStateCache::forgetVertexArray(GLuint vao) {
+    if (vertexArray == vao) {
+        vertexArrayKnown = false;
+    }
+}
+
+void GLStateCache::forgetFramebuffer(GLuint oldFramebuffer) {
+    if (framebuffer == oldFramebuffer) {
+        framebufferKnown = false;
+    }
+}
+
+void GLStateCache::forgetTexture(GLuint texture) {
+    textureBindings.erase(std::remove_if(textureBindings.begin(), textureBindings.end(), [texture](const TextureBinding& entry) {
+        return entry.texture == texture;
+    }), textureBindings.end());
+}
+
+void GLStateCache::forgetBuffer(GLuint buffer) {
+    bufferBindings.erase(std::remove_if(bufferBindings.begin(), bufferBindings.end(), [buffer](const BufferBinding& entry) {
+        return entry.buffer == buffer;
+    }), bufferBindings.end());
+}
+
+size_t GLStateCache::getIssuedCalls() const {
+    return lastIssuedCalls;
+}
+
+size_t GLStateCache::getFilteredCalls() const {
+    return lastFilteredCalls;
+}
@@ -1,4 +1,6 @@
 #include "headers/ImGuiApp.h"
+#include "headers/GLStateCache.h"
+#include "headers/GLDebug.h"
 #include <algorithm>
 #include <fstream>
 #include <sstream>
@@ -87,7 +89,173 @@ void ImGuiApp::Run(Renderer* renderer, Model* model) {
     if (ImGui::Checkbox("Enable Shadows", &shadowsEnabled)) {
         renderer->setShadowsEnabled(shadowsEnabled);
     }
+
+    // Shadow map resolution
+    static const int shadowMapSizes[] = { 512, 1024, 2048, 4096 };
+    static const char* shadowMapSizeNames[] = { "512", "1024", "2048", "4096" };
+    int shadowMapSize = 0;
+    while (shadowMapSize < 3 && shadowMapSizes[shadowMapSize] < renderer->getShadowMapSize()) {
+        shadowMapSize++;
+    }
+    if (ImGui::Combo("Shadow Map Size", &shadowMapSize, shadowMapSizeNames, 4)) {
+        renderer->setShadowMapSize(shadowMapSizes[shadowMapSize]);
+    }
+
+    // Shadow filter kernel, the GPU time of the passes sampling the shadow map shows its cost
+    static const char* shadowFilterNames[] = { "1 Tap", "4 Taps", "9 Taps", "Poisson (8 Taps)", "EVSM (Blurred Moments)" };
+    int shadowFilter = static_cast<int>(renderer->getShadowFilter());
+    if (ImGui::Combo("Shadow Filter", &shadowFilter, shadowFilterNames, 5)) {
+        renderer->setShadowFilter(static_cast<ShadowFilter>(shadowFilter));
+    }
+    if (renderer->getShadowFilter() == ShadowFilter::EVSM) {
+        // The blur runs once per shadow update, not per pixel, so a wide radius costs nothing while sampling
+        int blurRadius = renderer->getShadowBlurRadius();
+        if (ImGui::SliderInt("EVSM Blur Radius", &blurRadius, 0, ShadowMoments::MAX_MOMENT_BLUR_RADIUS)) {
+            renderer->setShadowBlurRadius(blurRadius);
+        }
+    }
+
+    // Cascades of the directional light's shadow
+    int cascadeCount = renderer->getShadowCascadeCount();
+    if (ImGui::SliderInt("Shadow Cascades", &cascadeCount, 1, MAX_SHADOW_CASCADES)) {
+        renderer->setShadowCascadeCount(cascadeCount);
+    }
+    float splitLambda = renderer->getCascadeSplitLambda();
+    if (ImGui::SliderFloat("Cascade Split (Uniform - Log)", &splitLambda, 0.0f, 1.0f)) {
+        renderer->setCascadeSplitLambda(splitLambda);
+    }
+    bool layeredShadows = renderer->getLayeredShadows();
+    if (ImGui::Checkbox("Layered Shadow Pass", &layeredShadows)) {
+        renderer->setLayeredShadows(layeredShadows);
+    }
+    if (!renderer->isLayeredShadowsAvailable()) {
+        ImGui::SameLine();
+        ImGui::TextDisabled("(unavailable)");
+    }
+    const ShadowMap& shadowMap = renderer->getShadowMap();
+    if (shadowMap.getActiveCascadeCount() > 1) {
+        for (int i = 0; i < shadowMap.getActiveCascadeCount(); ++i) {
+            ImGui::Text("Cascade %d: up to %.1f", i, shadowMap.getCascadeSplit(i));
+        }
+    }
+
+    // The shadow map is cached while the light and the casters don't move
+    int shadowInterval = renderer->getShadowUpdateInterval();
+    if (ImGui::SliderInt("Shadow Update Interval (Auto Rotate)", &shadowInterval, 1, 8)) {
+        renderer->setShadowUpdateInterval(shadowInterval);
+    }
+    ImGui::Text("Shadow Map Renders: %u", renderer->getShadowMap().getRenderCount());
+
+    // Tiles of the other shadowed lights, packed into the atlas by importance
+    const ShadowAtlas& shadowAtlas = renderer->getShadowAtlas();
+    ImGui::Text("Shadow Atlas Tiles: %d (%d x %d), Renders: %u", shadowAtlas.getTileCount(), shadowAtlas.getSize(),
+        shadowAtlas.getSize(), shadowAtlas.getRenderCount());
+    for (const ShadowTile& tile : shadowAtlas.getTiles()) {
+        ImGui::Text("  %s light %d: %d px at (%d, %d)", tile.lightType == LightType::SPOT ? "Spot" : "Directional",
+            tile.lightIndex, tile.size, tile.x, tile.y);
+    }
+
+    // Cube maps of the point lights, only the faces that see a caster are rendered
+    const PointShadowMap& pointShadowMap = renderer->getPointShadowMap();
+    if (!renderer->isPointShadowsAvailable()) {
+        ImGui::TextDisabled("Point Light Shadows: unavailable");
+    }
+    else {
+        ImGui::Text("Point Light Shadows: %d (%d x %d per face), Renders: %u", pointShadowMap.getShadowCount(),
+            pointShadowMap.getSize(), pointShadowMap.getSize(), pointShadowMap.getRenderCount());
+        for (int i = 0; i < pointShadowMap.getShadowCount(); ++i) {
+            int faces = 0;
+            for (int face = 0; face < 6; ++face) {
+                faces += (pointShadowMap.getFaceMask(i) >> face) & 1;
+            }
+            ImGui::Text("  Point light %d: %d of 6 faces", i, faces);
+        }
+    }
+
+    // Spot and point lights per cluster, each fragment only shades the lights of its own cluster
+    const LightClusters& lightClusters = renderer->getLightClusters();
+    ImGui::Text("Clustered Lights: %d, %zu cluster entries", lightClusters.getLightCount(), lightClusters.getIndexCount());
+    ImGui::Text("  %d of %d clusters lit, at most %d lights in one", lightClusters.getOccupiedClusterCount(), CLUSTER_COUNT,
+        lightClusters.getMaxClusterLightCount());
+
+    // Draws reached by at most MAX_DRAW_LIGHTS lights shade their own list instead of the clusters
+    const DrawLightList& modelLights = renderer->getModelLights();
+    const DrawLightList& groundLights = renderer->getGroundLights();
+    ImGui::Text("  Lights reaching the model: %s, the ground: %s",
+        modelLights.count < 0 ? "clustered" : std::to_string(modelLights.count).c_str(),
+        groundLights.count < 0 ? "clustered" : std::to_string(groundLights.count).c_str());
+
+    // Lit draws use a model program variant compiled for their features instead of branching at run time
+    bool shaderVariants = renderer->getShaderVariants();
+    if (ImGui::Checkbox("Shader Variants", &shaderVariants)) {
+        renderer->setShaderVariants(shaderVariants);
+    }
+    ImGui::SameLine();
+    ImGui::Text("%zu compiled", renderer->getShaderVariantCount());
+
+    // Only draw frames when something changed; the viewer sleeps while the scene is static
+    bool onDemand = renderer->getOnDemandRendering();
+    if (ImGui::Checkbox("Render On Demand", &onDemand)) {
+        renderer->setOnDemandRendering(onDemand);
+    }
     
+    // Copies of the model drawn with instancing
+    int instanceGridSize = renderer->getInstanceGridSize();
+    if (ImGui::SliderInt("Instance Grid", &instanceGridSize, 0, 10000)) {
+        renderer->setInstanceGridSize(instanceGridSize);
+    }
+
+    ImGui::Separator();
+
+    // Texture memory: resident vs budget
+    TextureManager& textureManager = renderer->getTextureManager();
+    float residentMB = textureManager.getResidentBytes() / (1024.0f * 1024.0f);
+    int budgetMB = static_cast<int>(textureManager.getBudgetBytes() / (1024 * 1024));
+    ImGui::Text("Texture Memory: %.1f / %d MB", residentMB, budgetMB);
+    ImGui::ProgressBar(budgetMB > 0 ? residentMB / budgetMB : 0.0f);
+    if (ImGui::SliderInt("Texture Budget (MB)", &budgetMB, 16, 2048)) {
+        textureManager.setBudgetBytes(static_cast<size_t>(budgetMB) * 1024 * 1024);
+    }
+
+    TextureCache& textureCache = textureManager.getTextureCache();
+    bool compressCache = textureCache.isCompressionEnabled();
+    if (ImGui::Checkbox("Compress Texture Cache (LZ4)", &compressCache)) {
+        textureCache.setCompressionEnabled(compressCache);
+    }
+    ImGui::Text("Texture Cache: %zu hit(s), %zu miss(es)", textureCache.getHitCount(), textureCache.getMissCount());
+    ImGui::Text("Textures Loading: %zu", textureManager.getPendingLoadCount());
+
+    // Light and frame uniform buffers are only re-uploaded when something changed
+    ImGui::Text("Uniform Buffer Uploads: %u", renderer->getSceneUniforms().getUploadCount());
+
+    // State changes sent to GL vs dropped as redundant during the last frame
+    GLStateCache& stateCache = GLStateCache::get();
+    ImGui::Text("GL State Calls: %zu issued, %zu filtered", stateCache.getIssuedCalls(), stateCache.getFilteredCalls());
+
+#if GL_DEBUG_LAYER
+    // GL diagnostics: messages below the chosen severity are dropped by the driver
+    static const GLenum severities[] = { GL_DEBUG_SEVERITY_HIGH, GL_DEBUG_SEVERITY_MEDIUM, GL_DEBUG_SEVERITY_LOW, GL_DEBUG_SEVERITY_NOTIFICATION };
+    static const char* severityNames[] = { "High", "Medium", "Low", "Notification" };
+    int severity = 0;
+    while (severity < 3 && severities[severity] != GLDebug::getMinimumSeverity()) {
+        severity++;
+    }
+    if (ImGui::Combo("GL Debug Severity", &severity, severityNames, 4)) {
+        GLDebug::setMinimumSeverity(severities[severity]);
+    }
+    ImGui::Text("GL Debug Messages: %zu (%s)", GLDebug::getMessageCount(),
+        GLDebug::isCallbackActive() ? "KHR_debug" : "glGetError");
+#endif
+
+    // Cost of each frame graph pass
+    for (const PassStats& pass : renderer->getFrameGraph().getPassStats()) {
+        if (pass.culled) {
+            ImGui::Text("%s Pass: culled", pass.name.c_str());
+        } else {
+            ImGui::Text("%s Pass: %.2f ms CPU, %.2f ms GPU", pass.name.c_str(), pass.cpuMs, pass.gpuMs);
+        }
+    }
+
     ImGui::Separator();
     
     // Model loading controls
@@ -130,21 +298,12 @@ void ImGuiApp::Run(Renderer* renderer, Model* model) {
     
     ImGui::End();
 
-   // Render your scene
-   renderer->renderScene();
-
-   // Rendering ImGui
+   // Finish the UI; it is drawn by the renderer's UI pass (see RenderDrawData)
    ImGui::Render();
-   ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-
-   // Swap buffers
-   SDL_GL_SwapWindow(renderer->getWindow().getWindow());
+}
 
-   // Check for OpenGL errors
-   GLenum err;
-   while ((err = glGetError()) != GL_NO_ERROR) {
-      std::cerr << "OpenGL error: " << err << std::endl;
-   } 
+void ImGuiApp::RenderDrawData(void* /*context*/) {
+    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
 void ImGuiApp::Cleanup() {
@@ -1,4 +1,10 @@
 #include "headers/InfiniteGround.h"
+#include "headers/ShadowAtlas.h"
+#include "headers/PointShadowMap.h"
+#include "headers/ShadowMoments.h"
+#include "headers/LightClusters.h"
+#include "headers/GLStateCache.h"
+#include "headers/GLDebug.h"
 
 
 // Vertices (position + normal) for a simple quad ground plane
@@ -17,116 +23,54 @@ unsigned int quadIndices[] = {
 };
 
 InfiniteGround::InfiniteGround()
-    : groundHeight(0.0f), modelMatrix(glm::mat4(1.0f)), GroundShaderID(0),VAO(0),VBO(0) ,EBO(0){}  // Initialize ground height and model matrix
+    : groundHeight(0.0f), modelMatrix(glm::mat4(1.0f)), groundShader(nullptr),VAO(0),VBO(0) ,EBO(0){}  // Initialize ground height and model matrix
 
 InfiniteGround::~InfiniteGround() {
+    GLStateCache::get().forgetVertexArray(VAO);
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
 }
 
-void InfiniteGround::initGround(GLuint shaderProgram) {
+void InfiniteGround::initGround(const ShaderProgram& shaderProgram) {
     setShader(shaderProgram);
     setupBuffers();
     modelMatrix = getGroundMatrix();
+
+    // Uniforms that never change
+    shaderProgram.use();
+    shaderProgram.setInt(Uniforms::ShadowMap, 1);
+    shaderProgram.setInt(Uniforms::ShadowAtlas, SHADOW_ATLAS_TEXTURE_UNIT);
+    shaderProgram.setInt(Uniforms::PointShadowMaps, POINT_SHADOW_TEXTURE_UNIT);
+    shaderProgram.setInt(Uniforms::ShadowMoments, SHADOW_MOMENTS_TEXTURE_UNIT);
+    shaderProgram.setInt(Uniforms::LocalLights, LOCAL_LIGHT_TEXTURE_UNIT);
+    shaderProgram.setInt(Uniforms::ClusterRanges, CLUSTER_RANGE_TEXTURE_UNIT);
+    shaderProgram.setInt(Uniforms::ClusterIndices, CLUSTER_INDEX_TEXTURE_UNIT);
+    shaderProgram.setInt(Uniforms::DrawLightCount, -1);
+    shaderProgram.setVec3(Uniforms::MaterialSpecularColor, glm::vec3(1.0f, 1.0f, 1.0f));  // White specular
+    shaderProgram.setFloat(Uniforms::MaterialShininess, 35.0f);  // Shiny material
 }
 
-void InfiniteGround::renderGround(GLuint shaderProgram, const glm::mat4& view, const glm::mat4& projection,
-    std::vector<Lights>& directionalLights,
-    std::vector<Lights>& pointLights,
-    std::vector<Lights>& spotLights,
-    glm::vec3 backgroundColor, ShadowMap& shadowMap, bool shadowsEnabled)
+void InfiniteGround::renderGround(const ShaderProgram& shaderProgram, glm::vec3 backgroundColor, ShadowMap& shadowMap)
 {
-    GLuint backgroundColorLocation = glGetUniformLocation(shaderProgram, "backgroundColor");
-    glUniform3fv(backgroundColorLocation, 1, &backgroundColor[0]);
-
     // Use the shader program for the ground
-    glUseProgram(shaderProgram);
+    shaderProgram.use();
     shadowMap.bindForLightingPass(1);
 
-    // Get the light space matrix from the ShadowMap class
-    glm::mat4 shadowMatrix = shadowMap.getLightSpaceMatrix();
-
-    // Calculate the Model-View-Projection (MVP) matrix
-    glm::mat4 MVP = calculateMVP(modelMatrix,view,projection);
-
-    sendMatrixToShader(shaderProgram,MVP,view);
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "lightSpaceMatrix"), 1, GL_FALSE, &shadowMap.getLightSpaceMatrix()[0][0]);
-
-    // Set shadow uniforms
-    glUniform1f(glGetUniformLocation(shaderProgram, "shadowBias"), 0.01f);
-    glUniform1i(glGetUniformLocation(shaderProgram, "shadowMap"), 1);
-    glUniform1i(glGetUniformLocation(shaderProgram, "shadowsEnabled"), shadowsEnabled ? 1 : 0);
-
-    // Set up lighting
-    renderGroundLights(directionalLights, pointLights, spotLights);
+    // Send the model matrix to the shader, the rest of the transform is in the frame block
+    shaderProgram.setMat4(Uniforms::ModelMatrix, modelMatrix);
 
     // Material color
-    glm::vec3 materialSpecularColor = glm::vec3(1.0f, 1.0f, 1.0f);  // White specular
-    float materialShininess = 35.0f;  // Shiny material
-
-    glUniform3fv(glGetUniformLocation(shaderProgram, "materialDiffuseColor"), 1, &backgroundColor[0]);
-    glUniform3fv(glGetUniformLocation(shaderProgram, "materialSpecularColor"), 1, &materialSpecularColor[0]);
-    glUniform1f(glGetUniformLocation(shaderProgram, "materialShininess"), materialShininess);
+    shaderProgram.setVec3(Uniforms::MaterialDiffuseColor, backgroundColor);
 
     // Draw the ground
     DrawGround();
 }
 
-glm::mat4 InfiniteGround::calculateMVP(const glm::mat4& modelMatrix, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix) {
-    return projectionMatrix * viewMatrix * modelMatrix;
-}
-
-void InfiniteGround::sendMatrixToShader(GLuint shaderProgram, glm::mat4 MVP, const glm::mat4& view)
-{
-    // Send the MVP matrix to the shader
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "MVP"), 1, GL_FALSE, &MVP[0][0]);
-
-    // Send the model matrix to the shader (for lighting calculations)
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "M"), 1, GL_FALSE, &modelMatrix[0][0]);
-
-    // Send the view matrix to the shader
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "V"), 1, GL_FALSE, &view[0][0]);
-
-
-}
-
-
-void InfiniteGround::renderGroundLights(std::vector<Lights>& directionalLights, std::vector<Lights>& pointLights, std::vector<Lights>& spotLights)
-{
-    // Send the number of directional and spotlights to the shader
-    glUniform1i(glGetUniformLocation(GroundShaderID, "numDirLights"), static_cast<GLint>(directionalLights.size()));
-    glUniform1i(glGetUniformLocation(GroundShaderID, "numSpotLights"), static_cast<GLint>(spotLights.size()));
-
-    // Pass all directional lights to the shader
-    for (int i = 0; i < static_cast<GLint>(directionalLights.size()); ++i) {
-        directionalLights[i].sendToShader(GroundShaderID, "dirLights[" + std::to_string(i) + "]");
-
-        directionalLights[i].enableDirectionalLights(GroundShaderID, i);
-    }
-
-    // Pass all spotlights to the shader
-    for (int i = 0; i < static_cast<GLint>(spotLights.size()); ++i) {
-        spotLights[i].sendToShader(GroundShaderID, "spotLights[" + std::to_string(i) + "]");
-
-        spotLights[i].enableSpotLights(GroundShaderID, i);
-    }
-
-    // Pass all point lights to the shader
-    for (int i = 0; i < pointLights.size(); ++i) {
-        pointLights[i].sendToShader(GroundShaderID, "pointLights[" + std::to_string(i) + "]");
-
-        //Enable point light
-    }
-}
-
 void InfiniteGround::DrawGround()
 {
-    glBindVertexArray(VAO);
+    GLStateCache::get().bindVertexArray(VAO);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-    // Unbind the shader program
-    glUseProgram(0);
 }
 
 void InfiniteGround::setupBuffers() {
@@ -135,7 +79,7 @@ void InfiniteGround::setupBuffers() {
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
 
-    glBindVertexArray(VAO);
+    GLStateCache::get().bindVertexArray(VAO);
 
     // Bind and set VBO for position and normal data
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
@@ -145,6 +89,10 @@ void InfiniteGround::setupBuffers() {
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(quadIndices), quadIndices, GL_STATIC_DRAW);
 
+    GLDebug::setObjectLabel(GL_VERTEX_ARRAY, VAO, "Ground VAO");
+    GLDebug::setObjectLabel(GL_BUFFER, VBO, "Ground Vertices");
+    GLDebug::setObjectLabel(GL_BUFFER, EBO, "Ground Indices");
+
     // Enable vertex attribute for position (location = 0 in shader)
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
@@ -154,7 +102,7 @@ void InfiniteGround::setupBuffers() {
     glEnableVertexAttribArray(1);
 
     // Unbind VAO
-    glBindVertexArray(0);
+    GLStateCache::get().bindVertexArray(0);
 }
 
 glm::mat4 InfiniteGround::calculateGroundMatrix() const{
@@ -178,6 +126,6 @@ void InfiniteGround::setHeight(float height) {
     modelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, groundHeight - groundOffset, 0.1f));
 }
 
-void InfiniteGround::setShader(GLuint shaderProgram) {
-    GroundShaderID = shaderProgram;
+void InfiniteGround::setShader(const ShaderProgram& shaderProgram) {
+    groundShader = &shaderProgram;
 }
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include "headers/InstanceBatch.h"
+#include "headers/GLDebug.h"
+#include <limits>
+
+InstanceBatch::InstanceBatch(Model& model)
+    : model(model), transform(1.0f), version(0), instanceBuffer(0), bufferCapacity(0), dirty(false),
+      boundsMin(0.0f), boundsMax(0.0f), boundsVersion(std::numeric_limits<unsigned int>::max()) {}
+
+InstanceBatch::~InstanceBatch() {
+    cleanup();
+}
+
+void InstanceBatch::setInstances(const std::vector<glm::mat4>& transforms, const std::vector<glm::vec4>& tints) {
+    instances.resize(transforms.size());
+    for (size_t i = 0; i < transforms.size(); ++i) {
+        instances[i].transform = transforms[i];
+        instances[i].tint = i < tints.size() ? tints[i] : glm::vec4(1.0f);
+    }
+    dirty = true;
+    version++;
+}
+
+void InstanceBatch::clear() {
+    instances.clear();
+    dirty = true;
+    version++;
+}
+
+void InstanceBatch::setTransform(const glm::mat4& batchTransform) {
+    if (batchTransform != transform) {
+        transform = batchTransform;
+        version++;
+    }
+}
+
+const glm::mat4& InstanceBatch::getTransform() const {
+    return transform;
+}
+
+size_t InstanceBatch::getInstanceCount() const {
+    return instances.size();
+}
+
+Model& InstanceBatch::getModel() const {
+    return model;
+}
+
+bool InstanceBatch::getNearestInstanceSphere(const glm::vec3& point, glm::vec3& center, float& radius) const {
+    glm::vec3 localCenter;
+    float localRadius;
+    model.getLocalBoundingSphere(localCenter, localRadius);
+
+    float nearestDistance = std::numeric_limits<float>::max();
+    for (const InstanceData& instance : instances) {
+        glm::mat4 world = instance.transform * transform;
+        glm::vec3 instanceCenter = glm::vec3(world * glm::vec4(localCenter, 1.0f));
+        float scale = glm::max(glm::max(glm::length(glm::vec3(world[0])), glm::length(glm::vec3(world[1]))), glm::length(glm::vec3(world[2])));
+        float distance = glm::length(instanceCenter - point) - localRadius * scale;
+        if (distance < nearestDistance) {
+            nearestDistance = distance;
+            center = instanceCenter;
+            radius = localRadius * scale;
+        }
+    }
+    return !instances.empty();
+}
+
+bool InstanceBatch::getWorldBounds(glm::vec3& worldMin, glm::vec3& worldMax) const {
+    if (instances.empty()) {
+        return false;
+    }
+
+    if (boundsVersion != version) {
+        boundsVersion = version;
+        boundsMin = glm::vec3(std::numeric_limits<float>::max());
+        boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+        for (const InstanceData& instance : instances) {
+            glm::vec3 instanceMin, instanceMax;
+            model.getWorldBounds(instance.transform * transform, instanceMin, instanceMax);
+            boundsMin = glm::min(boundsMin, instanceMin);
+            boundsMax = glm::max(boundsMax, instanceMax);
+        }
+    }
+    worldMin = boundsMin;
+    worldMax = boundsMax;
+    return true;
+}
+
+unsigned int InstanceBatch::getVersion() const {
+    return version;
+}
+
+void InstanceBatch::draw() const {
+    upload();
+    model.drawInstanced(instanceBuffer, static_cast<GLsizei>(instances.size()));
+}
+
+void InstanceBatch::drawDepthOnly() const {
+    upload();
+    model.drawDepthOnlyInstanced(instanceBuffer, static_cast<GLsizei>(instances.size()));
+}
+
+void InstanceBatch::upload() const {
+    if (!dirty || instances.empty()) {
+        return;
+    }
+    dirty = false;
+
+    if (instanceBuffer == 0) {
+        glGenBuffers(1, &instanceBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        GLDebug::setObjectLabel(GL_BUFFER, instanceBuffer, "Instance Batch");
+    }
+    else {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    }
+
+    // Grow the buffer when needed, otherwise overwrite it in place
+    if (instances.size() > bufferCapacity) {
+        bufferCapacity = instances.size();
+        glBufferData(GL_ARRAY_BUFFER, bufferCapacity * sizeof(InstanceData), instances.data(), GL_DYNAMIC_DRAW);
+    }
+    else {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(InstanceData), instances.data());
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void InstanceBatch::cleanup() {
+    if (instanceBuffer) {
+        model.forgetInstanceBuffer(instanceBuffer);
+        glDeleteBuffers(1, &instanceBuffer);
+        instanceBuffer = 0;
+        bufferCapacity = 0;
+        dirty = true;
+    }
+}
@@ -0,0 +1,315 @@
+#include "headers/LightClusters.h"
+#include "headers/GLStateCache.h"
+#include "headers/GLDebug.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Tile of a normalized device coordinate along an axis of n tiles
+static int clusterTile(float ndc, int n) {
+    return glm::clamp(static_cast<int>(std::floor((ndc * 0.5f + 0.5f) * n)), 0, n - 1);
+}
+
+// Creates a buffer and a buffer texture reading it in the given format
+static void createBufferTexture(GLuint& buffer, GLuint& texture, GLenum format, const char* label) {
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    GLDebug::setObjectLabel(GL_BUFFER, buffer, label);
+
+    glGenTextures(1, &texture);
+    GLStateCache::get().bindTextureForUpdate(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    GLDebug::setObjectLabel(GL_TEXTURE, texture, label);
+}
+
+LightClusters::LightClusters()
+    : lightBuffer(0), lightTexture(0), rangeBuffer(0), rangeTexture(0), indexBuffer(0), indexTexture(0), ubo(0),
+    lightCapacity(0), rangeCapacity(0), indexCapacity(0), maxIndexCount(0), blockData(), uploaded(false),
+    maxClusterLightCount(0), occupiedClusterCount(0) {}
+
+LightClusters::~LightClusters() {
+    cleanup();
+}
+
+void LightClusters::init() {
+    createBufferTexture(lightBuffer, lightTexture, GL_RGBA32F, "Local Lights");
+    createBufferTexture(rangeBuffer, rangeTexture, GL_RG32UI, "Cluster Ranges");
+    createBufferTexture(indexBuffer, indexTexture, GL_R16UI, "Cluster Light Indices");
+    lightCapacity = rangeCapacity = indexCapacity = 16;
+
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    maxIndexCount = std::min<size_t>(static_cast<size_t>(maxTexels), static_cast<size_t>(CLUSTER_COUNT) * MAX_LIGHTS_PER_CLUSTER);
+
+    blockData = ClusterBlockData();
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ClusterBlockData), &blockData, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    GLDebug::setObjectLabel(GL_BUFFER, ubo, "ClusterBlock");
+    GLStateCache::get().bindBufferBase(GL_UNIFORM_BUFFER, CLUSTER_BLOCK_BINDING, ubo);
+    uploaded = false;
+}
+
+void LightClusters::update(const std::vector<Lights>& spotLights, const std::vector<Lights>& pointLights,
+    const glm::mat4& view, const glm::mat4& projection, int viewportWidth, int viewportHeight) {
+    if (ubo == 0 || viewportWidth <= 0 || viewportHeight <= 0) {
+        return;
+    }
+
+    // Spot lights first, then point lights; the first MAX_LIGHTS of each type have a shadow slot
+    lights.clear();
+    glm::vec3 ambient(0.0f);
+    auto pack = [this, &ambient](const Lights& light, LocalLightType type, int index) {
+        if (lights.size() >= static_cast<size_t>(MAX_LOCAL_LIGHTS)) {
+            return;
+        }
+        ambient += light.getAmbientIntensity();
+
+        // Lights that reach nothing are left out of the clusters and the draws' lists
+        float range = light.getRange();
+        if (range <= 0.0f) {
+            return;
+        }
+        LocalLightData data;
+        data.positionRange = glm::vec4(light.getPosition(), range);
+        data.directionCutOff = glm::vec4(light.getDirection(), light.getCutOff());
+        data.intensityOuterCutOff = glm::vec4(light.getIntensity(), light.getOuterCutOff());
+        data.ambientConstant = glm::vec4(light.getAmbientIntensity(), light.getConstant());
+        data.specularLinear = glm::vec4(light.getSpecularIntensity(), light.getLinear());
+        data.quadraticTypeShadow = glm::vec4(light.getQuadratic(), static_cast<float>(type),
+            index < MAX_LIGHTS ? static_cast<float>(index) : -1.0f, 0.0f);
+        lights.push_back(data);
+    };
+    for (size_t i = 0; i < spotLights.size(); ++i) {
+        pack(spotLights[i], LocalLightType::SPOT, static_cast<int>(i));
+    }
+    for (size_t i = 0; i < pointLights.size(); ++i) {
+        pack(pointLights[i], LocalLightType::POINT, static_cast<int>(i));
+    }
+
+    assignClusters(view, projection);
+
+    // The slice of a view depth is log(depth) * z + w, from the near and far planes of the projection
+    float nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+    float farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+    float logDepthRange = std::log(farPlane / nearPlane);
+    ClusterBlockData data;
+    data.clusterScale = glm::vec4(static_cast<float>(CLUSTER_GRID_X) / viewportWidth,
+        static_cast<float>(CLUSTER_GRID_Y) / viewportHeight, CLUSTER_GRID_Z / logDepthRange,
+        -CLUSTER_GRID_Z * std::log(nearPlane) / logDepthRange);
+    data.clusterGrid = glm::ivec4(CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z, static_cast<int>(lights.size()));
+    data.localAmbient = glm::vec4(ambient, 0.0f);
+
+    if (!uploaded || lights.size() != uploadedLights.size() ||
+        std::memcmp(lights.data(), uploadedLights.data(), lights.size() * sizeof(LocalLightData)) != 0) {
+        if (spotLights.size() + pointLights.size() > static_cast<size_t>(MAX_LOCAL_LIGHTS)) {
+            std::cerr << "Only the first " << MAX_LOCAL_LIGHTS << " spot and point lights are used" << std::endl;
+        }
+        uploadBuffer(lightBuffer, lightCapacity, lights.data(), lights.size() * sizeof(LocalLightData));
+        uploadedLights = lights;
+    }
+    if (!uploaded || clusterRanges != uploadedRanges) {
+        uploadBuffer(rangeBuffer, rangeCapacity, clusterRanges.data(), clusterRanges.size() * sizeof(glm::uvec2));
+        uploadedRanges = clusterRanges;
+    }
+    if (!uploaded || clusterIndices != uploadedIndices) {
+        uploadBuffer(indexBuffer, indexCapacity, clusterIndices.data(), clusterIndices.size() * sizeof(GLushort));
+        uploadedIndices = clusterIndices;
+    }
+    if (!uploaded || std::memcmp(&data, &blockData, sizeof(ClusterBlockData)) != 0) {
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ClusterBlockData), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        blockData = data;
+    }
+    uploaded = true;
+}
+
+void LightClusters::assignClusters(const glm::mat4& view, const glm::mat4& projection) {
+    // View-space spheres of influence, depth positive in front of the camera
+    int count = static_cast<int>(lights.size());
+    sphereX.resize(count);
+    sphereY.resize(count);
+    sphereDepth.resize(count);
+    sphereRadius.resize(count);
+    for (int i = 0; i < count; ++i) {
+        glm::vec3 center = glm::vec3(view * glm::vec4(glm::vec3(lights[i].positionRange), 1.0f));
+        sphereX[i] = center.x;
+        sphereY[i] = center.y;
+        sphereDepth[i] = -center.z;
+        sphereRadius[i] = lights[i].positionRange.w;
+    }
+
+    float nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+    float farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+    float scaleX = projection[0][0];
+    float scaleY = projection[1][1];
+
+    // Each slice takes the lights whose sphere reaches into its depth range, then the tiles covered by
+    // the sphere's bounding box clipped to the slice (its projection is widest at the near or far depth)
+    spans.clear();
+    clusterCounts.assign(CLUSTER_COUNT, 0);
+    float sliceNear = nearPlane;
+    for (int slice = 0; slice < CLUSTER_GRID_Z; ++slice) {
+        float sliceFar = nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(slice + 1) / CLUSTER_GRID_Z);
+        for (int i = 0; i < count; ++i) {
+            float depth = sphereDepth[i];
+            float radius = sphereRadius[i];
+            if (depth + radius < sliceNear || depth - radius > sliceFar) {
+                continue;
+            }
+            float nearDepth = std::max(depth - radius, sliceNear);
+            float farDepth = std::min(depth + radius, sliceFar);
+            float left = sphereX[i] - radius, right = sphereX[i] + radius;
+            float bottom = sphereY[i] - radius, top = sphereY[i] + radius;
+            float minX = std::min(left / nearDepth, left / farDepth) * scaleX;
+            float maxX = std::max(right / nearDepth, right / farDepth) * scaleX;
+            float minY = std::min(bottom / nearDepth, bottom / farDepth) * scaleY;
+            float maxY = std::max(top / nearDepth, top / farDepth) * scaleY;
+            if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f) {
+                continue;
+            }
+
+            ClusterSpan span = { i, slice, clusterTile(minX, CLUSTER_GRID_X), clusterTile(maxX, CLUSTER_GRID_X),
+                clusterTile(minY, CLUSTER_GRID_Y), clusterTile(maxY, CLUSTER_GRID_Y) };
+            spans.push_back(span);
+            for (int y = span.y0; y <= span.y1; ++y) {
+                for (int x = span.x0; x <= span.x1; ++x) {
+                    clusterCounts[(slice * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x]++;
+                }
+            }
+        }
+        sliceNear = sliceFar;
+    }
+
+    // Prefix sum of the counts gives each cluster its place in the index list
+    clusterRanges.resize(CLUSTER_COUNT);
+    size_t offset = 0;
+    maxClusterLightCount = 0;
+    occupiedClusterCount = 0;
+    for (int cluster = 0; cluster < CLUSTER_COUNT; ++cluster) {
+        size_t kept = std::min<size_t>(std::min<size_t>(clusterCounts[cluster], MAX_LIGHTS_PER_CLUSTER), maxIndexCount - offset);
+        clusterRanges[cluster] = glm::uvec2(static_cast<unsigned int>(offset), 0u);
+        clusterCounts[cluster] = static_cast<unsigned int>(kept);
+        offset += kept;
+        maxClusterLightCount = std::max(maxClusterLightCount, static_cast<int>(kept));
+        occupiedClusterCount += kept > 0 ? 1 : 0;
+    }
+
+    // Spans are in slice then light order, so every list keeps the lights in order (the shadowed ones first)
+    clusterIndices.resize(offset);
+    for (const ClusterSpan& span : spans) {
+        for (int y = span.y0; y <= span.y1; ++y) {
+            for (int x = span.x0; x <= span.x1; ++x) {
+                glm::uvec2& range = clusterRanges[(span.slice * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x];
+                if (range.y < clusterCounts[(span.slice * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x]) {
+                    clusterIndices[range.x + range.y] = static_cast<GLushort>(span.light);
+                    range.y++;
+                }
+            }
+        }
+    }
+}
+
+void LightClusters::uploadBuffer(GLuint buffer, size_t& capacity, const void* data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    if (size > capacity) {
+        // Grow with some headroom, so lights added one by one don't reallocate every frame
+        capacity = std::max(size, capacity * 2);
+        glBufferData(GL_TEXTURE_BUFFER, capacity, nullptr, GL_DYNAMIC_DRAW);
+    }
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::cullLights(const glm::vec3& worldMin, const glm::vec3& worldMax, DrawLightList& list) const {
+    list.count = 0;
+    for (size_t i = 0; i < lights.size(); ++i) {
+        const LocalLightData& light = lights[i];
+        glm::vec3 position = glm::vec3(light.positionRange);
+        float range = light.positionRange.w;
+
+        // Distance from the light to the nearest point of the box
+        glm::vec3 offset = glm::clamp(position, worldMin, worldMax) - position;
+        if (glm::dot(offset, offset) > range * range) {
+            continue;
+        }
+
+        // Spot lights: the part of the box in range must reach in front of the light, and its bounding sphere
+        // must touch the outer cone
+        float cosOuter = light.intensityOuterCutOff.w;
+        if (static_cast<int>(light.quadraticTypeShadow.y) == static_cast<int>(LocalLightType::SPOT) && cosOuter > 0.0f) {
+            glm::vec3 direction = glm::normalize(glm::vec3(light.directionCutOff));
+            glm::vec3 reachMin = glm::max(worldMin, position - range);
+            glm::vec3 reachMax = glm::min(worldMax, position + range);
+            glm::vec3 toCenter = (reachMin + reachMax) * 0.5f - position;
+            glm::vec3 halfExtent = (reachMax - reachMin) * 0.5f;
+            float axial = glm::dot(toCenter, direction);
+            if (axial + glm::dot(halfExtent, glm::abs(direction)) < 0.0f) {
+                continue;
+            }
+            float lateral = glm::sqrt(glm::max(glm::dot(toCenter, toCenter) - axial * axial, 0.0f));
+            float coneDistance = cosOuter * lateral - glm::sqrt(1.0f - cosOuter * cosOuter) * axial;
+            if (coneDistance > glm::length(halfExtent)) {
+                continue;
+            }
+        }
+
+        if (list.count == MAX_DRAW_LIGHTS) {
+            list.count = -1;
+            return;
+        }
+        list.indices[list.count++] = static_cast<GLint>(i);
+    }
+}
+
+void LightClusters::bindForLightingPass() const {
+    GLStateCache& state = GLStateCache::get();
+    state.bindTexture(LOCAL_LIGHT_TEXTURE_UNIT, GL_TEXTURE_BUFFER, lightTexture);
+    state.bindTexture(CLUSTER_RANGE_TEXTURE_UNIT, GL_TEXTURE_BUFFER, rangeTexture);
+    state.bindTexture(CLUSTER_INDEX_TEXTURE_UNIT, GL_TEXTURE_BUFFER, indexTexture);
+}
+
+int LightClusters::getLightCount() const {
+    return static_cast<int>(lights.size());
+}
+
+size_t LightClusters::getIndexCount() const {
+    return clusterIndices.size();
+}
+
+int LightClusters::getMaxClusterLightCount() const {
+    return maxClusterLightCount;
+}
+
+int LightClusters::getOccupiedClusterCount() const {
+    return occupiedClusterCount;
+}
+
+void LightClusters::cleanup() {
+    GLStateCache& state = GLStateCache::get();
+    GLuint* textures[] = { &lightTexture, &rangeTexture, &indexTexture };
+    for (GLuint* texture : textures) {
+        if (*texture) {
+            state.forgetTexture(*texture);
+            glDeleteTextures(1, texture);
+            *texture = 0;
+        }
+    }
+    GLuint* buffers[] = { &lightBuffer, &rangeBuffer, &indexBuffer, &ubo };
+    for (GLuint* buffer : buffers) {
+        if (*buffer) {
+            state.forgetBuffer(*buffer);
+            glDeleteBuffers(1, buffer);
+            *buffer = 0;
+        }
+    }
+    lightCapacity = rangeCapacity = indexCapacity = 0;
+    uploaded = false;
+}
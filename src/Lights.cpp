@@ -2,97 +2,63 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
 
+// Source of light versions, shared by all lights
+static unsigned int nextLightVersion = 1;
+
 Lights::Lights(LightType type)
-    : type(type), position(0.0f), direction(0.0f, -1.0f, 0.0f), intensity(1.0f),
+    : type(type), version(nextLightVersion++), position(0.0f), direction(0.0f, -1.0f, 0.0f), intensity(1.0f),
     ambientIntensity(0.2f), specularIntensity(1.0f),
     constantAttenuation(1.0f), linearAttenuation(0.09f), quadraticAttenuation(0.032f),
     cutOff(glm::cos(glm::radians(12.5f))), outerCutOff(glm::cos(glm::radians(17.5f))) {}
 
 void Lights::setPosition(const glm::vec3& pos) {
     position = pos;
+    touch();
 }
 
 void Lights::setDirection(const glm::vec3& dir) {
     direction = dir;
+    touch();
 }
 
 void Lights::setIntensity(const glm::vec3& intens) {
     intensity = intens;
+    touch();
 }
 
 void Lights::setAmbientIntensity(const glm::vec3& ambientIntens) {
     ambientIntensity = ambientIntens;
+    touch();
 }
 
 void Lights::setSpecularIntensity(const glm::vec3& specularIntens) {
     specularIntensity = specularIntens;
+    touch();
 }
 
 void Lights::setAttenuation(float constant, float linear, float quadratic) {
     constantAttenuation = constant;
     linearAttenuation = linear;
     quadraticAttenuation = quadratic;
+    touch();
 }
 
 void Lights::setCutOff(float c) {
     cutOff = glm::cos(glm::radians(c));
+    touch();
 }
 
 void Lights::setOuterCutOff(float outerC) {
     outerCutOff = glm::cos(glm::radians(outerC));
+    touch();
 }
 
-void Lights::sendToShader(GLuint programID, const std::string& lightName) {
-    std::string lightPrefix = lightName + ".";
-
-    // Ensure the shader program is active
-    glUseProgram(programID);
-
-    if (type == LightType::DIRECTIONAL) {
-        // Send directional light uniforms
-        glUniform3fv(glGetUniformLocation(programID, (lightPrefix + "Direction").c_str()), 1, glm::value_ptr(direction));
-        glUniform3fv(glGetUniformLocation(programID, (lightPrefix + "Intensity").c_str()), 1, glm::value_ptr(intensity));
-        glUniform3fv(glGetUniformLocation(programID, (lightPrefix + "Ambient").c_str()), 1, glm::value_ptr(ambientIntensity));
-        glUniform3fv(glGetUniformLocation(programID, (lightPrefix + "Specular").c_str()), 1, glm::value_ptr(specularIntensity));
-    }
-    else if (type == LightType::POINT) {
-        // Send point light uniforms
-        glUniform3fv(glGetUniformLocation(programID, (lightPrefix + "Position").c_str()), 1, glm::value_ptr(position));
-        glUniform3fv(glGetUniformLocation(programID, (lightPrefix + "Intensity").c_str()), 1, glm::value_ptr(intensity));
-        glUniform3fv(glGetUniformLocation(programID, (lightPrefix + "Ambient").c_str()), 1, glm::value_ptr(ambientIntensity));
-        glUniform3fv(glGetUniformLocation(programID, (lightPrefix + "Specular").c_str()), 1, glm::value_ptr(specularIntensity));
-        glUniform1f(glGetUniformLocation(programID, (lightPrefix + "Constant").c_str()), constantAttenuation);
-        glUniform1f(glGetUniformLocation(programID, (lightPrefix + "Linear").c_str()), linearAttenuation);
-        glUniform1f(glGetUniformLocation(programID, (lightPrefix + "Quadratic").c_str()), quadraticAttenuation);
-    }
-    else if (type == LightType::SPOT) {
-        // Send spot light uniforms
-        glUniform3fv(glGetUniformLocation(programID, (lightPrefix + "Position").c_str()), 1, glm::value_ptr(position));
-        glUniform3fv(glGetUniformLocation(programID, (lightPrefix + "Direction").c_str()), 1, glm::value_ptr(direction));
-        glUniform3fv(glGetUniformLocation(programID, (lightPrefix + "Intensity").c_str()), 1, glm::value_ptr(intensity));
-        glUniform3fv(glGetUniformLocation(programID, (lightPrefix + "Ambient").c_str()), 1, glm::value_ptr(ambientIntensity));
-        glUniform3fv(glGetUniformLocation(programID, (lightPrefix + "Specular").c_str()), 1, glm::value_ptr(specularIntensity));
-        glUniform1f(glGetUniformLocation(programID, (lightPrefix + "Constant").c_str()), constantAttenuation);
-        glUniform1f(glGetUniformLocation(programID, (lightPrefix + "Linear").c_str()), linearAttenuation);
-        glUniform1f(glGetUniformLocation(programID, (lightPrefix + "Quadratic").c_str()), quadraticAttenuation);
-        glUniform1f(glGetUniformLocation(programID, (lightPrefix + "CutOff").c_str()), cutOff);
-        glUniform1f(glGetUniformLocation(programID, (lightPrefix + "OuterCutOff").c_str()), outerCutOff);
-    }
-}
-
-void Lights::enableDirectionalLights(GLuint programID,int i)
-{
-    glUniform1i(glGetUniformLocation(programID, ("useDirectionalLight[" + std::to_string(i) + "]").c_str()), true);
-}
-
-void Lights::enableSpotLights(GLuint programID, int i)
-{
-    glUniform1i(glGetUniformLocation(programID, ("useSpotLight[" + std::to_string(i) + "]").c_str()), true);
+unsigned int Lights::getVersion() const {
+    return version;
 }
 
-void Lights::enablePointLights(GLuint programID, int i)
-{
-    glUniform1i(glGetUniformLocation(programID, ("usePointLight[" + std::to_string(i) + "]").c_str()), true);
+void Lights::touch() {
+    version = nextLightVersion++;
 }
 
 glm::vec3 Lights::getPosition() const {
@@ -130,6 +96,28 @@ float Lights::getQuadratic() const {
     return quadraticAttenuation;
 }
 
+// Range of the light from its attenuation
+float Lights::getRange() const {
+    // Solve constant + linear * d + quadratic * d^2 = peak intensity * 256 for d
+    float peak = glm::max(glm::max(intensity.r, intensity.g), intensity.b) * 256.0f;
+    if (peak <= constantAttenuation) {
+        return 0.0f;  // Below the cut-off everywhere (a black light)
+    }
+    float constant = constantAttenuation - peak;
+    float range = MAX_LIGHT_RANGE;
+    if (quadraticAttenuation > 0.0f) {
+        float discriminant = linearAttenuation * linearAttenuation - 4.0f * quadraticAttenuation * constant;
+        if (discriminant < 0.0f) {
+            return 0.0f;
+        }
+        range = (-linearAttenuation + glm::sqrt(discriminant)) / (2.0f * quadraticAttenuation);
+    }
+    else if (linearAttenuation > 0.0f) {
+        range = -constant / linearAttenuation;
+    }
+    return glm::clamp(range, 0.1f, MAX_LIGHT_RANGE);
+}
+
 // Getter for Spot Light Cut-Off Angle
 float Lights::getCutOff() const {
     return cutOff;
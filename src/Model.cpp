@@ -1,21 +1,42 @@
 #include "headers/Model.h"
+#include "headers/GLStateCache.h"
+#include "headers/GLDebug.h"
 #include <limits>  // For std::numeric_limits
+#include <algorithm>
+#include <cstddef>  // For offsetof
 
 // Constructor
-Model::Model(const std::string& filepath) : currentFilePath(filepath) {
+Model::Model(const std::string& filepath, TextureManager& textureManager)
+    : textureManager(&textureManager), currentFilePath(filepath) {
     // Initialize transformation attributes first
     position = glm::vec3(0.0f);
     rotationAxis = glm::vec3(0.0f, 1.0f, 0.0f);
     rotationAngle = 0.0f;
     scale = glm::vec3(1.0f);
     needsLowestPointUpdate = true;
+    version = 0;
+    materialVersion = 1;
+    builtMaterialVersion = 0;
+    builtResidencyVersion = 0;
+    boundsMin = glm::vec3(0.0f);
+    boundsMax = glm::vec3(0.0f);
 
     // Initialize OpenGL IDs to 0
     vao = 0;
+    depthVao = 0;
     vbo = 0;
     nbo = 0;
     tbo = 0;
     ebo = 0;
+    materialUBO = 0;
+    materialIndexBuffer = 0;
+    indirectBuffer = 0;
+    instancedVao = 0;
+    instancedDepthVao = 0;
+    instancedVaoBuffer = 0;
+    instancedDepthVaoBuffer = 0;
+    vertexMaterialBuffer = 0;
+    useMultiDrawIndirect = false;
 
     // Only load model if filepath is provided and not empty
     if (!filepath.empty()) {
@@ -26,6 +47,8 @@ Model::Model(const std::string& filepath) : currentFilePath(filepath) {
         // Calculate the bounding box
         glm::vec3 min, max;
         calculateBoundingBox(min, max);
+        boundsMin = min;
+        boundsMax = max;
 
         // Calculate the scale factor to fit the model within a 2.0 unit box (bigger and more visible)
         glm::vec3 size = max - min;
@@ -61,17 +84,60 @@ void Model::cleanup() {
         ebo = 0;
     }
     if (vao) {
+        GLStateCache::get().forgetVertexArray(vao);
         glDeleteVertexArrays(1, &vao);
         vao = 0;
     }
+    if (depthVao) {
+        GLStateCache::get().forgetVertexArray(depthVao);
+        glDeleteVertexArrays(1, &depthVao);
+        depthVao = 0;
+    }
+    if (materialUBO) {
+        GLStateCache::get().forgetBuffer(materialUBO);
+        glDeleteBuffers(1, &materialUBO);
+        materialUBO = 0;
+    }
+    if (materialIndexBuffer) {
+        glDeleteBuffers(1, &materialIndexBuffer);
+        materialIndexBuffer = 0;
+    }
+    if (indirectBuffer) {
+        glDeleteBuffers(1, &indirectBuffer);
+        indirectBuffer = 0;
+    }
+    for (GLuint* instanced : { &instancedVao, &instancedDepthVao }) {
+        if (*instanced) {
+            GLStateCache::get().forgetVertexArray(*instanced);
+            glDeleteVertexArrays(1, instanced);
+            *instanced = 0;
+        }
+    }
+    instancedVaoBuffer = 0;
+    instancedDepthVaoBuffer = 0;
+    if (vertexMaterialBuffer) {
+        glDeleteBuffers(1, &vertexMaterialBuffer);
+        vertexMaterialBuffer = 0;
+    }
 
-    for (GLuint texture : textures) {
-        if (texture) {
-            glDeleteTextures(1, &texture);
+    for (const std::string& path : texturePaths) {
+        if (!path.empty()) {
+            textureManager->releaseTexture(path);
         }
     }
+    texturePaths.clear();
     textures.clear();
+    textureLayers.clear();
+    textureArrays.clear();
     specularTextures.clear();
+    uploadedMaterials.clear();
+    drawRanges.clear();
+    drawGroups.clear();
+    drawGroupKeys.clear();
+    drawCounts.clear();
+    drawOffsets.clear();
+    drawCommandRanges.clear();
+    materialVersion++;
     
     // Clear all data vectors
     vertices.clear();
@@ -81,6 +147,8 @@ void Model::cleanup() {
     materials.clear();
     face_material_ids.clear();
     diffuseColors.clear();
+    materialUVDensities.clear();
+    materialSurfaceAreas.clear();
 }
 
 // Reload a new model at runtime
@@ -90,6 +158,7 @@ bool Model::reloadModel(const std::string& filepath) {
         
         // Clean up existing resources
         cleanup();
+        version++;
         
         // Update the current file path
         currentFilePath = filepath;
@@ -102,6 +171,8 @@ bool Model::reloadModel(const std::string& filepath) {
         // Recalculate bounding box and scale
         glm::vec3 min, max;
         calculateBoundingBox(min, max);
+        boundsMin = min;
+        boundsMax = max;
         
         glm::vec3 size = max - min;
         float maxDimension = glm::max(glm::max(size.x, size.y), size.z);
@@ -135,13 +206,8 @@ size_t Model::getFaceCount() const {
     return indices.size() / 3; // 3 indices per triangle
 }
 
-// Load textures using stb_image
+// Resolve the texture paths of the materials; the images are only loaded once a material is drawn
 void Model::loadTextures() {
-    std::cout << "\nStarting to load textures..." << std::endl;
-
-    // Flip the image vertically on load
-    stbi_set_flip_vertically_on_load(true);
-
     // Get base directory from current model file path for relative texture paths
     std::string base_dir = currentFilePath.substr(0, currentFilePath.find_last_of("/\\"));
     if (!base_dir.empty()) {
@@ -159,53 +225,40 @@ void Model::loadTextures() {
                 texPath = base_dir + material.diffuse_texname;
             }
             
-            std::cout << "Loading texture from path: " << texPath << std::endl;
-
-            GLuint textureID;
-            glGenTextures(1, &textureID);
-            glBindTexture(GL_TEXTURE_2D, textureID);
-
-            int width, height, nrComponents;
-            unsigned char* data = stbi_load(texPath.c_str(), &width, &height, &nrComponents, 0);
-
-            if (data) {
-                GLenum format;
-                if (nrComponents == 1)
-                    format = GL_RED;
-                else if (nrComponents == 3)
-                    format = GL_RGB;
-                else if (nrComponents == 4)
-                    format = GL_RGBA;
-                else {
-                    std::cerr << "Unknown number of components in texture: " << nrComponents << std::endl;
-                    stbi_image_free(data);
-                    continue;
-                }
+            texturePaths.push_back(texPath);
+        }
+        else {
+            texturePaths.push_back(""); // Placeholder, no texture for this material
+        }
 
-                glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-                glGenerateMipmap(GL_TEXTURE_2D);
+        // Until its texture arrives the material is drawn with its diffuse color
+        textures.push_back(0);
+        textureLayers.push_back(0);
+    }
+}
 
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// Ask the texture manager for a material's texture and pick it up once it is loaded
+void Model::requestTexture(size_t materialIndex, float priority) {
+    if (materialIndex >= texturePaths.size() || texturePaths[materialIndex].empty() || textures[materialIndex] != 0) {
+        return;
+    }
 
-                textures.push_back(textureID);
-                std::cout << "Texture loaded and assigned ID: " << textureID << std::endl;
-            }
-            else {
-                std::cerr << "Failed to load texture at path: " << texPath << std::endl;
-                glDeleteTextures(1, &textureID);
-                textures.push_back(0); // Add a placeholder texture ID
-            }
-            stbi_image_free(data);
-        }
-        else {
-            std::cout << "No diffuse texture for material: " << material.name << std::endl;
-            textures.push_back(0); // Add a placeholder texture ID
+    TextureLayer layer = textureManager->requestTexture(texturePaths[materialIndex], priority);
+    if (layer.textureID == 0) {
+        return;
+    }
+    textures[materialIndex] = layer.textureID;
+    textureLayers[materialIndex] = layer.layer;
+    materialVersion++;
+
+    // Each distinct array gets a texture unit slot for the whole draw
+    if (std::find(textureArrays.begin(), textureArrays.end(), layer.textureID) == textureArrays.end()) {
+        textureArrays.push_back(layer.textureID);
+        if (textureArrays.size() == MAX_TEXTURE_ARRAYS + 1) {
+            std::cout << "Model uses more than " << MAX_TEXTURE_ARRAYS << " texture arrays, the last ones"
+                << " share one texture unit and are rebound between material groups" << std::endl;
         }
     }
-    std::cout << "Finished loading textures.\n" << std::endl;
 }
 
 // Load the model from the OBJ file using tinyobjloader
@@ -291,13 +344,67 @@ void Model::loadModel(const std::string& filepath) {
         }
     }
 
+    calculateMaterialUVDensities();
+
     std::cout << "Model loaded successfully.\n" << std::endl;
 }
 
+// Ratio between texture space and model space per material, used to pick the mip level a material needs on screen.
+// The surface area of each material is kept as well to prioritize texture loads
+void Model::calculateMaterialUVDensities() {
+    std::vector<float> uvArea(materials.size(), 0.0f);
+    std::vector<float> surfaceArea(materials.size(), 0.0f);
+
+    // UVs are only usable if every vertex got one (the loader skips missing attributes)
+    bool hasUVs = !texcoords.empty() && texcoords.size() / 2 == vertices.size() / 3;
+
+    for (size_t face = 0; face < face_material_ids.size(); ++face) {
+        size_t v = face * 3;
+        if ((v + 2) * 3 + 2 >= vertices.size()) {
+            break;
+        }
+
+        glm::vec3 p0(vertices[3 * v], vertices[3 * v + 1], vertices[3 * v + 2]);
+        glm::vec3 p1(vertices[3 * (v + 1)], vertices[3 * (v + 1) + 1], vertices[3 * (v + 1) + 2]);
+        glm::vec3 p2(vertices[3 * (v + 2)], vertices[3 * (v + 2) + 1], vertices[3 * (v + 2) + 2]);
+        int materialID = face_material_ids[face];
+        surfaceArea[materialID] += 0.5f * glm::length(glm::cross(p1 - p0, p2 - p0));
+        if (!hasUVs) {
+            continue;
+        }
+
+        glm::vec2 t0(texcoords[2 * v], texcoords[2 * v + 1]);
+        glm::vec2 t1(texcoords[2 * (v + 1)], texcoords[2 * (v + 1) + 1]);
+        glm::vec2 t2(texcoords[2 * (v + 2)], texcoords[2 * (v + 2) + 1]);
+
+        glm::vec2 e1 = t1 - t0;
+        glm::vec2 e2 = t2 - t0;
+
+        uvArea[materialID] += 0.5f * glm::abs(e1.x * e2.y - e1.y * e2.x);
+    }
+
+    materialUVDensities.resize(materials.size());
+    for (size_t i = 0; i < materials.size(); ++i) {
+        // UV units per model unit; 1.0 when the material has no usable UVs
+        materialUVDensities[i] = (uvArea[i] > 0.0f && surfaceArea[i] > 0.0f) ? glm::sqrt(uvArea[i] / surfaceArea[i]) : 1.0f;
+    }
+    materialSurfaceAreas = surfaceArea;
+}
+
+// Material index of every vertex, from the material of its face
+void Model::buildVertexMaterialIndices(std::vector<GLint>& materialIndices) const {
+    materialIndices.clear();
+    materialIndices.reserve(vertices.size() / 3);
+    for (size_t i = 0; i < vertices.size() / 3; ++i) {
+        size_t face = i / 3;
+        materialIndices.push_back(face < face_material_ids.size() ? face_material_ids[face] : 0);
+    }
+}
+
 // Setup OpenGL buffers
 void Model::setupBuffers() {
     glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    GLStateCache::get().bindVertexArray(vao);
 
     // Generate and bind VBO for vertex positions
     glGenBuffers(1, &vbo);
@@ -329,7 +436,89 @@ void Model::setupBuffers() {
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 
-    glBindVertexArray(0); // Unbind the VAO
+    // Material index attribute: with multi-draw indirect it advances once per instance, so the
+    // baseInstance of each command (the range index) selects the range's material. Without it every
+    // vertex carries its face's material, which lets glMultiDrawElements cover all ranges just the same
+    buildDrawRanges();
+    useMultiDrawIndirect = supportsMultiDrawIndirect();
+
+    std::vector<GLint> materialIndices;
+    if (useMultiDrawIndirect) {
+        for (const DrawRange& range : drawRanges) {
+            materialIndices.push_back(range.materialID);
+        }
+    }
+    else {
+        buildVertexMaterialIndices(materialIndices);
+    }
+
+    glGenBuffers(1, &materialIndexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, materialIndexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, materialIndices.size() * sizeof(GLint), materialIndices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(MATERIAL_INDEX_ATTRIBUTE);
+    glVertexAttribIPointer(MATERIAL_INDEX_ATTRIBUTE, 1, GL_INT, 0, nullptr);
+    glVertexAttribDivisor(MATERIAL_INDEX_ATTRIBUTE, useMultiDrawIndirect ? 1 : 0);
+
+    if (useMultiDrawIndirect) {
+        glGenBuffers(1, &indirectBuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, drawRanges.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    // Depth-only passes fetch nothing but the positions
+    glGenVertexArrays(1, &depthVao);
+    GLStateCache::get().bindVertexArray(depthVao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+
+    GLStateCache::get().bindVertexArray(0); // Unbind the VAO
+
+    GLDebug::setObjectLabel(GL_VERTEX_ARRAY, vao, "Model VAO");
+    GLDebug::setObjectLabel(GL_VERTEX_ARRAY, depthVao, "Model Depth VAO");
+    GLDebug::setObjectLabel(GL_BUFFER, vbo, "Model Positions");
+    GLDebug::setObjectLabel(GL_BUFFER, nbo, "Model Normals");
+    GLDebug::setObjectLabel(GL_BUFFER, tbo, "Model Texcoords");
+    GLDebug::setObjectLabel(GL_BUFFER, ebo, "Model Indices");
+    GLDebug::setObjectLabel(GL_BUFFER, materialIndexBuffer, "Model Material Indices");
+    GLDebug::setObjectLabel(GL_BUFFER, indirectBuffer, "Model Draw Commands");
+
+    // Material buffer read by the shader through the per-draw material index
+    if (materials.size() > MAX_MATERIALS) {
+        std::cerr << "Model has " << materials.size() << " materials, only the first " << MAX_MATERIALS << " are used" << std::endl;
+    }
+    glGenBuffers(1, &materialUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, materialUBO);
+    glBufferData(GL_UNIFORM_BUFFER, MAX_MATERIALS * sizeof(MaterialBlockEntry), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    GLDebug::setObjectLabel(GL_BUFFER, materialUBO, "MaterialBlock");
+}
+
+// Upload the material table when a color, texture layer or texture residency changed
+void Model::updateMaterialBuffer(const std::vector<MaterialData>& materialsData) const {
+    std::vector<MaterialBlockEntry> entries;
+    for (size_t i = 0; i < materialsData.size() && i < MAX_MATERIALS; ++i) {
+        const MaterialData& mat = materialsData[i];
+        MaterialBlockEntry entry;
+        entry.diffuseColor = glm::vec4(mat.diffuseColor, 1.0f);
+        entry.specularColor = glm::vec4(mat.specularColor, mat.shininess);
+        entry.texture = glm::ivec4(mat.diffuseTextureSlot, mat.diffuseTextureLayer, 0, 0);
+        entries.push_back(entry);
+    }
+
+    if (entries.size() == uploadedMaterials.size() &&
+        std::equal(entries.begin(), entries.end(), uploadedMaterials.begin(), [](const MaterialBlockEntry& a, const MaterialBlockEntry& b) {
+            return a.diffuseColor == b.diffuseColor && a.specularColor == b.specularColor && a.texture == b.texture;
+        })) {
+        return;
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, materialUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, entries.size() * sizeof(MaterialBlockEntry), entries.data());
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    uploadedMaterials = entries;
 }
 
 // Transformation matrix calculation
@@ -354,90 +543,311 @@ void Model::calculateBoundingBox(glm::vec3& min, glm::vec3& max) const { //Fits
 }
 
 // Method to render the model
-void Model::draw(GLuint programID) const {
+void Model::draw() const {
     // Don't draw if no model is loaded
-    if (vertices.empty() || indices.empty() || vao == 0) {
+    if (vertices.empty() || indices.empty() || vao == 0 || drawRanges.empty()) {
         return;
     }
 
-
+    GLStateCache& state = GLStateCache::get();
 
     // Bind the VAO for the model
-    glBindVertexArray(vao);
+    state.bindVertexArray(vao);
+    bindMaterials();
 
-    // Retrieve the indices and face material IDs
-    const std::vector<unsigned int>& modelIndices = getIndices();
-    const std::vector<int>& materialIDs = getFaceMaterialIDs();
+    if (useMultiDrawIndirect) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+    }
 
-    // Retrieve the model materials
-    const std::vector<MaterialData>& materialsData = getModelMaterials();
+    for (const DrawGroup& group : drawGroups) {
+        // Arrays beyond the last slot share it, so only they need a rebind
+        if (group.textureArray != 0) {
+            state.bindTexture(FIRST_MATERIAL_TEXTURE_UNIT + MAX_TEXTURE_ARRAYS - 1, GL_TEXTURE_2D_ARRAY, group.textureArray);
+        }
+
+        if (useMultiDrawIndirect) {
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                (void*)(group.firstCommand * sizeof(DrawElementsIndirectCommand)), group.commandCount, 0);
+        }
+        else {
+            glMultiDrawElements(GL_TRIANGLES, &drawCounts[group.firstCommand], GL_UNSIGNED_INT,
+                &drawOffsets[group.firstCommand], group.commandCount);
+        }
+    }
 
-    GLuint currentTextureID = 0;  // Track the current bound texture to avoid redundant binding
-    glm::vec3 currentDiffuseColor = glm::vec3(-1.0f);  // Start with invalid color to force first update
-    glm::vec3 currentSpecularColor = glm::vec3(-1.0f); // Start with invalid specular color
-    float currentShininess = -1.0f;  // Invalid shininess to force first update
+    if (useMultiDrawIndirect) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+}
 
-    size_t indexOffset = 0;  // Offset for the indices
-    size_t faceStart = 0;    // To batch faces that share the same material
+// Make sure the shader sees the materials' current state; the material buffer and draw commands are only
+// rebuilt when a material picked up its texture or the texture manager's residency changed
+void Model::bindMaterials() const {
+    GLStateCache& state = GLStateCache::get();
+
+    unsigned int residencyVersion = textureManager->getResidencyVersion();
+    bool materialsChanged = builtMaterialVersion != materialVersion || builtResidencyVersion != residencyVersion;
+    if (materialsChanged) {
+        std::vector<MaterialData> materialsData = getModelMaterials();
+        updateMaterialBuffer(materialsData);
+        updateDrawCommands(materialsData);
+        builtMaterialVersion = materialVersion;
+        builtResidencyVersion = residencyVersion;
+    }
+    state.bindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, materialUBO);
+
+    // Bind every texture array once; materials pick their array and layer from the material buffer
+    for (size_t slot = 0; slot < textureArrays.size() && slot < MAX_TEXTURE_ARRAYS; ++slot) {
+        state.bindTexture(FIRST_MATERIAL_TEXTURE_UNIT + static_cast<GLuint>(slot), GL_TEXTURE_2D_ARRAY, textureArrays[slot]);
+    }
+}
+
+// Render every instance; the material comes from the per-vertex material index, so ranges that follow each
+// other in the element buffer go out as one instanced call when their materials sample the same texture array
+// slot (the fragment shader indexes the sampler array with it, which must not vary within a draw)
+void Model::drawInstanced(GLuint instanceBuffer, GLsizei instanceCount) const {
+    if (vertices.empty() || indices.empty() || vao == 0 || drawRanges.empty() || instanceBuffer == 0 || instanceCount <= 0) {
+        return;
+    }
 
-    // Iterate over each material group
-    for (size_t i = 0; i < materialIDs.size(); ++i) {
-        int materialID = materialIDs[i];
+    bindInstancedVertexArray(instancedVao, instancedVaoBuffer, instanceBuffer, false);
+    bindMaterials();
 
-        // Ensure the material ID is valid
-        if (materialID >= 0 && materialID < materialsData.size()) {
-            const MaterialData& mat = materialsData[materialID];
+    GLStateCache& state = GLStateCache::get();
+    for (const DrawGroup& group : drawGroups) {
+        if (group.textureArray != 0) {
+            state.bindTexture(FIRST_MATERIAL_TEXTURE_UNIT + MAX_TEXTURE_ARRAYS - 1, GL_TEXTURE_2D_ARRAY, group.textureArray);
+        }
 
-            // If the material has a texture and it's different from the current texture, bind it
-            if (mat.diffuseTextureID != 0 && mat.diffuseTextureID != currentTextureID) {
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, mat.diffuseTextureID);
-                glUniform1i(glGetUniformLocation(programID, "useTexture"), 1);  // Use the texture
-                currentTextureID = mat.diffuseTextureID;
+        size_t end = group.firstCommand + group.commandCount;
+        size_t first = group.firstCommand;
+        while (first < end) {
+            const char* start = static_cast<const char*>(drawOffsets[first]);
+            GLsizei count = drawCounts[first];
+            size_t next = first + 1;
+            int slot = getDrawTextureSlot(first);
+            while (next < end && static_cast<const char*>(drawOffsets[next]) == start + count * sizeof(unsigned int) &&
+                getDrawTextureSlot(next) == slot) {
+                count += drawCounts[next];
+                next++;
             }
-            // If there's no texture, use the diffuse color
-            else if (mat.diffuseTextureID == 0) {
-                if (currentTextureID != 0) {
-                    glBindTexture(GL_TEXTURE_2D, 0);  // Unbind texture if previously bound
-                    glUniform1i(glGetUniformLocation(programID, "useTexture"), 0);  // Use diffuse color instead of texture
-                    currentTextureID = 0;
-                }
+            glDrawElementsInstanced(GL_TRIANGLES, count, GL_UNSIGNED_INT, start, instanceCount);
+            first = next;
+        }
+    }
 
-                // Set the diffuse color in the shader if it has changed
-                if (mat.diffuseColor != currentDiffuseColor) {
-                    glUniform3fv(glGetUniformLocation(programID, "material.DiffuseColor"), 1, &mat.diffuseColor[0]);
-                    currentDiffuseColor = mat.diffuseColor;
-                }
+    // The generic values of the instance attributes are undefined after a draw sourced them from arrays
+    setDefaultInstanceAttributes();
+}
+
+// Render every instance with positions and instance transforms only, the whole mesh in one call
+void Model::drawDepthOnlyInstanced(GLuint instanceBuffer, GLsizei instanceCount) const {
+    if (indices.empty() || vbo == 0 || instanceBuffer == 0 || instanceCount <= 0) {
+        return;
+    }
+
+    bindInstancedVertexArray(instancedDepthVao, instancedDepthVaoBuffer, instanceBuffer, true);
+    glDrawElementsInstanced(GL_TRIANGLES, static_cast<GLsizei>(indices.size()), GL_UNSIGNED_INT, nullptr, instanceCount);
+    setDefaultInstanceAttributes();
+}
+
+void Model::bindInstancedVertexArray(GLuint& instancedArray, GLuint& boundBuffer, GLuint instanceBuffer, bool depthOnly) const {
+    GLStateCache& state = GLStateCache::get();
+
+    if (instancedArray == 0) {
+        glGenVertexArrays(1, &instancedArray);
+        state.bindVertexArray(instancedArray);
+
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+        if (!depthOnly) {
+            if (nbo) {
+                glBindBuffer(GL_ARRAY_BUFFER, nbo);
+                glEnableVertexAttribArray(1);
+                glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+            }
+            if (tbo) {
+                glBindBuffer(GL_ARRAY_BUFFER, tbo);
+                glEnableVertexAttribArray(2);
+                glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
             }
 
-            // Set specular color and shininess only if they have changed
-            if (mat.specularColor != currentSpecularColor) {
-                glUniform3fv(glGetUniformLocation(programID, "material.SpecularColor"), 1, &mat.specularColor[0]);
-                currentSpecularColor = mat.specularColor;
+            // Instances use the divisor, so the material index has to come from the vertices
+            GLuint perVertexMaterials = materialIndexBuffer;
+            if (useMultiDrawIndirect) {
+                if (vertexMaterialBuffer == 0) {
+                    std::vector<GLint> materialIndices;
+                    buildVertexMaterialIndices(materialIndices);
+                    glGenBuffers(1, &vertexMaterialBuffer);
+                    glBindBuffer(GL_ARRAY_BUFFER, vertexMaterialBuffer);
+                    glBufferData(GL_ARRAY_BUFFER, materialIndices.size() * sizeof(GLint), materialIndices.data(), GL_STATIC_DRAW);
+                    GLDebug::setObjectLabel(GL_BUFFER, vertexMaterialBuffer, "Model Vertex Material Indices");
+                }
+                perVertexMaterials = vertexMaterialBuffer;
             }
+            glBindBuffer(GL_ARRAY_BUFFER, perVertexMaterials);
+            glEnableVertexAttribArray(MATERIAL_INDEX_ATTRIBUTE);
+            glVertexAttribIPointer(MATERIAL_INDEX_ATTRIBUTE, 1, GL_INT, 0, nullptr);
+        }
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        GLDebug::setObjectLabel(GL_VERTEX_ARRAY, instancedArray, depthOnly ? "Model Instanced Depth VAO" : "Model Instanced VAO");
+        boundBuffer = 0;
+    }
+    else {
+        state.bindVertexArray(instancedArray);
+    }
+
+    if (boundBuffer == instanceBuffer) {
+        return;
+    }
+    boundBuffer = instanceBuffer;
+
+    // One column of the transform per location, then the tint
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (GLuint column = 0; column < 4; ++column) {
+        GLuint location = INSTANCE_TRANSFORM_ATTRIBUTE + column;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+            (void*)(offsetof(InstanceData, transform) + column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(location, 1);
+    }
+    if (!depthOnly) {
+        glEnableVertexAttribArray(INSTANCE_TINT_ATTRIBUTE);
+        glVertexAttribPointer(INSTANCE_TINT_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+            (void*)offsetof(InstanceData, tint));
+        glVertexAttribDivisor(INSTANCE_TINT_ATTRIBUTE, 1);
+    }
+}
+
+void Model::forgetInstanceBuffer(GLuint instanceBuffer) const {
+    if (instancedVaoBuffer == instanceBuffer) {
+        instancedVaoBuffer = 0;
+    }
+    if (instancedDepthVaoBuffer == instanceBuffer) {
+        instancedDepthVaoBuffer = 0;
+    }
+}
+
+// Disabled attribute arrays read the current generic value: an identity transform and a white tint.
+// Set at init and again after every instanced draw
+void Model::setDefaultInstanceAttributes() {
+    for (GLuint column = 0; column < 4; ++column) {
+        glm::vec4 value(0.0f);
+        value[column] = 1.0f;
+        glVertexAttrib4f(INSTANCE_TRANSFORM_ATTRIBUTE + column, value.x, value.y, value.z, value.w);
+    }
+    glVertexAttrib4f(INSTANCE_TINT_ATTRIBUTE, 1.0f, 1.0f, 1.0f, 1.0f);
+}
+
+// Render the whole mesh with positions only; material ranges don't matter for depth
+void Model::drawDepthOnly() const {
+    if (indices.empty() || depthVao == 0) {
+        return;
+    }
+
+    GLStateCache::get().bindVertexArray(depthVao);
+    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indices.size()), GL_UNSIGNED_INT, nullptr);
+}
+
+void Model::buildDrawRanges() {
+    drawRanges.clear();
+
+    size_t indexOffset = 0;  // Offset for the indices
+    size_t faceStart = 0;    // To batch faces that share the same material
+
+    for (size_t i = 0; i < face_material_ids.size(); ++i) {
+        int materialID = face_material_ids[i];
 
-            if (mat.shininess != currentShininess) {
-                glUniform1f(glGetUniformLocation(programID, "material.Shininess"), mat.shininess);
-                currentShininess = mat.shininess;
+        // Close the range where the next face has a different material ID
+        if (i + 1 == face_material_ids.size() || face_material_ids[i + 1] != materialID) {
+            size_t count = (i + 1 - faceStart) * 3;
+
+            // Faces with an invalid material are not drawn
+            if (materialID >= 0 && static_cast<size_t>(materialID) < materials.size() && materialID < MAX_MATERIALS) {
+                DrawRange range;
+                range.count = static_cast<GLsizei>(count);
+                range.firstIndex = static_cast<GLuint>(indexOffset);
+                range.materialID = materialID;
+                drawRanges.push_back(range);
             }
 
-            // Check if the next face has a different material ID to batch the draw calls
-            if (i + 1 == materialIDs.size() || materialIDs[i + 1] != materialID) {
-                // Draw all faces that use the same material in a single draw call
-                size_t numFaces = (i + 1 - faceStart) * 3;  // Number of vertices for this material group
+            indexOffset += count;
+            faceStart = i + 1;
+        }
+    }
+}
+
+void Model::updateDrawCommands(const std::vector<MaterialData>& materialsData) const {
+    std::vector<GLuint> keys;
+    keys.reserve(drawRanges.size());
+    for (const DrawRange& range : drawRanges) {
+        const MaterialData& mat = materialsData[range.materialID];
+        keys.push_back(mat.diffuseTextureSlot == MAX_TEXTURE_ARRAYS - 1 && textureArrays.size() > MAX_TEXTURE_ARRAYS
+            ? mat.diffuseTextureID : 0);
+    }
 
-                // Instead of passing size_t directly, cast it to GLsizei
-                glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(numFaces), GL_UNSIGNED_INT, (void*)(indexOffset * sizeof(unsigned int)));
+    if (keys == drawGroupKeys && !drawGroups.empty()) {
+        return;
+    }
+    drawGroupKeys = keys;
+
+    // Ranges that need no rebind go first, then one group per array sharing the last slot
+    std::vector<GLuint> groupArrays(1, 0);
+    for (GLuint key : keys) {
+        if (std::find(groupArrays.begin(), groupArrays.end(), key) == groupArrays.end()) {
+            groupArrays.push_back(key);
+        }
+    }
 
-                // Update the index offset and face start position
-                indexOffset += numFaces;
-                faceStart = i + 1;
+    std::vector<DrawElementsIndirectCommand> commands;
+    drawGroups.clear();
+    drawCounts.clear();
+    drawOffsets.clear();
+    drawCommandRanges.clear();
+    for (GLuint textureArray : groupArrays) {
+        DrawGroup group;
+        group.textureArray = textureArray;
+        group.firstCommand = commands.size();
+
+        for (size_t i = 0; i < drawRanges.size(); ++i) {
+            if (keys[i] != textureArray) {
+                continue;
             }
+            DrawElementsIndirectCommand command;
+            command.count = static_cast<GLuint>(drawRanges[i].count);
+            command.instanceCount = 1;
+            command.firstIndex = drawRanges[i].firstIndex;
+            command.baseVertex = 0;
+            command.baseInstance = static_cast<GLuint>(i);
+            commands.push_back(command);
+
+            drawCounts.push_back(drawRanges[i].count);
+            drawOffsets.push_back((const void*)(drawRanges[i].firstIndex * sizeof(unsigned int)));
+            drawCommandRanges.push_back(i);
+        }
+
+        group.commandCount = static_cast<GLsizei>(commands.size() - group.firstCommand);
+        if (group.commandCount > 0) {
+            drawGroups.push_back(group);
         }
     }
 
-    // Unbind the VAO
-    glBindVertexArray(0);
+    if (useMultiDrawIndirect) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+}
+
+int Model::getDrawTextureSlot(size_t command) const {
+    return uploadedMaterials[drawRanges[drawCommandRanges[command]].materialID].texture.x;
+}
+
+bool Model::supportsMultiDrawIndirect() {
+    return GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
 }
 
 bool Model::isLowestPointUpdateNeeded() const {
@@ -448,6 +858,14 @@ GLuint Model::getVAO() const {
     return vao;
 }
 
+GLuint Model::getMaterialBuffer() const {
+    return materialUBO;
+}
+
+GLuint Model::getPrimaryTextureArray() const {
+    return textureArrays.empty() ? 0 : textureArrays[0];
+}
+
 // Get the indices of the model
 const std::vector<unsigned int>& Model::getIndices() const {
     return indices;
@@ -471,15 +889,22 @@ std::vector<MaterialData> Model::getModelMaterials() const {
     for (size_t i = 0; i < materials.size(); i++) {
         MaterialData data;
 
-        // Set diffuse texture ID if available
-        if (i < textures.size() && textures[i] != 0) {
+        // Set diffuse texture ID if available (evicted textures fall back to the diffuse color)
+        if (i < textures.size() && textures[i] != 0 && textureManager->isResident(textures[i])) {
             data.diffuseTextureID = textures[i];
+            data.diffuseTextureLayer = textureLayers[i];
+
+            // Arrays past the last texture unit slot share it
+            size_t slot = std::find(textureArrays.begin(), textureArrays.end(), textures[i]) - textureArrays.begin();
+            data.diffuseTextureSlot = static_cast<int>(std::min<size_t>(slot, MAX_TEXTURE_ARRAYS - 1));
 
             // Use the material's diffuse color, but fallback to white if not properly defined
             data.diffuseColor = glm::vec3(materials[i].diffuse[0], materials[i].diffuse[1], materials[i].diffuse[2]);
         }
         else {
             data.diffuseTextureID = 0;  // No texture assigned, use diffuse color instead
+            data.diffuseTextureLayer = 0;
+            data.diffuseTextureSlot = -1;
             data.diffuseColor = glm::vec3(materials[i].diffuse[0], materials[i].diffuse[1], materials[i].diffuse[2]);
 
             // If the diffuse color in material is zero (default case), fallback to white
@@ -508,6 +933,45 @@ std::vector<MaterialData> Model::getModelMaterials() const {
     return materialsData;
 }
 
+float Model::getMaterialUVDensity(size_t materialIndex) const {
+    if (materialIndex < materialUVDensities.size()) {
+        return materialUVDensities[materialIndex];
+    }
+    return 1.0f;
+}
+
+float Model::getMaterialSurfaceArea(size_t materialIndex) const {
+    if (materialIndex < materialSurfaceAreas.size()) {
+        return materialSurfaceAreas[materialIndex];
+    }
+    return 0.0f;
+}
+
+void Model::getLocalBoundingSphere(glm::vec3& center, float& radius) const {
+    center = (boundsMin + boundsMax) * 0.5f;
+    radius = glm::length(boundsMax - boundsMin) * 0.5f;
+}
+
+void Model::getWorldBounds(const glm::mat4& transform, glm::vec3& worldMin, glm::vec3& worldMax) const {
+    // Box of the transformed corners
+    glm::vec3 center = glm::vec3(transform * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+    glm::vec3 halfSize = (boundsMax - boundsMin) * 0.5f;
+    glm::vec3 extent = glm::abs(glm::vec3(transform[0])) * halfSize.x + glm::abs(glm::vec3(transform[1])) * halfSize.y
+        + glm::abs(glm::vec3(transform[2])) * halfSize.z;
+    worldMin = center - extent;
+    worldMax = center + extent;
+}
+
+void Model::getBoundingSphere(glm::vec3& center, float& radius) const {
+    glm::mat4 modelMatrix = getModelMatrix();
+    center = glm::vec3(modelMatrix * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+    radius = glm::length(boundsMax - boundsMin) * 0.5f * glm::max(glm::max(scale.x, scale.y), scale.z);
+}
+
+size_t Model::getMaterialCount() const {
+    return materials.size();
+}
+
 glm::mat4 Model::getModelMatrix() const {
     return calculateModelMatrix();
 }
@@ -562,16 +1026,27 @@ glm::vec3 Model::getPosition() const {
     return position;
 }
 
+glm::vec3 Model::getScale() const {
+    return scale;
+}
+
 void Model::setPosition(const glm::vec3& pos) {
     position = pos;
     needsLowestPointUpdate = true;
+    version++;
 }
 
 void Model::setRotation(float angle, const glm::vec3& axis) {
     rotationAngle = angle;
     rotationAxis = axis;
+    version++;
 }
 
 void Model::setScale(const glm::vec3& scl) {
     scale = scl;
+    version++;
+}
+
+unsigned int Model::getVersion() const {
+    return version;
 }
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include "headers/PointShadowMap.h"
+#include "headers/GLStateCache.h"
+#include "headers/GLDebug.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cstring>
+
+// Direction and up vector of each cube face, in the order and orientation of GL_TEXTURE_CUBE_MAP_POSITIVE_X onwards
+static const glm::vec3 FACE_DIRECTIONS[6] = {
+    glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+    glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+};
+static const glm::vec3 FACE_UPS[6] = {
+    glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+    glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+};
+
+PointShadowMap::PointShadowMap(GLsizei size)
+    : cubeSize(size), FBO(0), depthCubeArray(0), ubo(0), blockData(), version(0), renderedVersion(0),
+    renderedCasterVersion(0), rendered(false), renderCount(0) {}
+
+PointShadowMap::~PointShadowMap() {
+    cleanup();
+}
+
+void PointShadowMap::init() {
+    invalidate();
+
+    // One cube (six layers) per light, compared in hardware like the other shadow maps
+    glGenTextures(1, &depthCubeArray);
+    GLStateCache::get().bindTextureForUpdate(GL_TEXTURE_CUBE_MAP_ARRAY, depthCubeArray);
+    glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 0, GL_DEPTH_COMPONENT24, cubeSize, cubeSize, MAX_LIGHTS * 6, 0,
+        GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    GLDebug::setObjectLabel(GL_TEXTURE, depthCubeArray, "Point Shadow Cube Array");
+
+    // Layered attachment, the geometry shader picks the layer (light * 6 + face)
+    glGenFramebuffers(1, &FBO);
+    GLStateCache::get().bindFramebuffer(FBO);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthCubeArray, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    GLDebug::setObjectLabel(GL_FRAMEBUFFER, FBO, "Point Shadow FBO");
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Error: Point shadow framebuffer is not complete!" << std::endl;
+    }
+    GLStateCache::get().bindFramebuffer(0);
+
+    if (ubo == 0) {
+        blockData = PointShadowBlockData();
+        glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(PointShadowBlockData), &blockData, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        GLDebug::setObjectLabel(GL_BUFFER, ubo, "PointShadowBlock");
+        GLStateCache::get().bindBufferBase(GL_UNIFORM_BUFFER, POINT_SHADOW_BLOCK_BINDING, ubo);
+    }
+}
+
+bool PointShadowMap::intersectsFrustum(const glm::mat4& viewProjection, const glm::vec3& boxMin, const glm::vec3& boxMax) {
+    // Planes from the rows of the matrix (left, right, bottom, top, near, far), each tested against
+    // the box corner farthest along its normal
+    glm::vec4 rowW(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+    for (int axis = 0; axis < 3; ++axis) {
+        glm::vec4 row(viewProjection[0][axis], viewProjection[1][axis], viewProjection[2][axis], viewProjection[3][axis]);
+        for (float side : { 1.0f, -1.0f }) {
+            glm::vec4 plane = rowW + side * row;
+            glm::vec3 corner(plane.x > 0.0f ? boxMax.x : boxMin.x, plane.y > 0.0f ? boxMax.y : boxMin.y,
+                plane.z > 0.0f ? boxMax.z : boxMin.z);
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void PointShadowMap::update(const std::vector<Lights>& pointLights, const glm::vec3& casterMin, const glm::vec3& casterMax) {
+    PointShadowBlockData data = {};
+    data.shadowCount = static_cast<int>(std::min<size_t>(pointLights.size(), MAX_LIGHTS));
+
+    for (int i = 0; i < data.shadowCount; ++i) {
+        const Lights& light = pointLights[i];
+        glm::vec3 position = light.getPosition();
+        float range = light.getRange();
+        if (glm::dot(light.getIntensity(), glm::vec3(1.0f)) <= 0.0f || range <= 0.0f) {
+            continue;
+        }
+
+        // Casters beyond the light's range cast nothing
+        glm::vec3 closest = glm::clamp(position, casterMin, casterMax);
+        if (glm::length(closest - position) > range) {
+            continue;
+        }
+
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, glm::max(range * 0.001f, 0.05f), range);
+        for (int face = 0; face < 6; ++face) {
+            glm::mat4 faceMatrix = projection * glm::lookAt(position, position + FACE_DIRECTIONS[face], FACE_UPS[face]);
+            data.faceMatrices[i * 6 + face] = faceMatrix;
+            if (intersectsFrustum(faceMatrix, casterMin, casterMax)) {
+                data.faceMasks[i] |= 1 << face;
+            }
+        }
+        data.lightPositions[i] = glm::vec4(position, range);
+    }
+
+    if (std::memcmp(&data, &blockData, sizeof(PointShadowBlockData)) == 0) {
+        return;
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(PointShadowBlockData), &data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    blockData = data;
+    version++;
+}
+
+void PointShadowMap::bindForShadowPass() const {
+    GLStateCache::get().bindFramebuffer(FBO);
+    GLStateCache::get().setViewport(0, 0, cubeSize, cubeSize);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void PointShadowMap::bindForLightingPass() const {
+    GLStateCache::get().bindTexture(POINT_SHADOW_TEXTURE_UNIT, GL_TEXTURE_CUBE_MAP_ARRAY, depthCubeArray);
+}
+
+int PointShadowMap::getShadowCount() const {
+    return blockData.shadowCount;
+}
+
+int PointShadowMap::getFaceMask(int light) const {
+    return blockData.faceMasks[light];
+}
+
+GLsizei PointShadowMap::getSize() const {
+    return cubeSize;
+}
+
+void PointShadowMap::resize(GLsizei size) {
+    cubeSize = size;
+    releaseTargets();
+    init();
+}
+
+bool PointShadowMap::isUpToDate(uint64_t casterVersion) const {
+    return rendered && version == renderedVersion && casterVersion == renderedCasterVersion;
+}
+
+void PointShadowMap::markRendered(uint64_t casterVersion) {
+    rendered = true;
+    renderedVersion = version;
+    renderedCasterVersion = casterVersion;
+    renderCount++;
+}
+
+void PointShadowMap::invalidate() {
+    rendered = false;
+}
+
+unsigned int PointShadowMap::getRenderCount() const {
+    return renderCount;
+}
+
+void PointShadowMap::releaseTargets() {
+    if (FBO) {
+        GLStateCache::get().forgetFramebuffer(FBO);
+        glDeleteFramebuffers(1, &FBO);
+        FBO = 0;
+    }
+    if (depthCubeArray) {
+        GLStateCache::get().forgetTexture(depthCubeArray);
+        glDeleteTextures(1, &depthCubeArray);
+        depthCubeArray = 0;
+    }
+}
+
+void PointShadowMap::cleanup() {
+    releaseTargets();
+    if (ubo) {
+        GLStateCache::get().forgetBuffer(ubo);
+        glDeleteBuffers(1, &ubo);
+        ubo = 0;
+    }
+}
@@ -0,0 +1,149 @@
+#include "headers/RenderQueue.h"
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+
+RenderQueue::RenderQueue() {}
+
+int RenderQueue::registerProgram(const ShaderProgram& program) {
+    auto it = std::find(programs.begin(), programs.end(), &program);
+    if (it != programs.end()) {
+        return static_cast<int>(it - programs.begin());
+    }
+
+    // Reuse the index of an unregistered program
+    it = std::find(programs.begin(), programs.end(), nullptr);
+    if (it != programs.end()) {
+        *it = &program;
+        return static_cast<int>(it - programs.begin());
+    }
+
+    if (programs.size() >= (1u << PROGRAM_BITS)) {
+        std::cerr << "Too many programs registered with the render queue" << std::endl;
+        return -1;
+    }
+    programs.push_back(&program);
+    return static_cast<int>(programs.size()) - 1;
+}
+
+void RenderQueue::unregisterProgram(const ShaderProgram& program) {
+    auto it = std::find(programs.begin(), programs.end(), &program);
+    if (it != programs.end()) {
+        *it = nullptr;
+    }
+}
+
+uint64_t RenderQueue::makeKey(RenderPass pass, int program, uint32_t material, uint32_t texture, float depth) {
+    const uint64_t depthMax = (1ull << DEPTH_BITS) - 1;
+    uint64_t depthBits = static_cast<uint64_t>(glm::clamp(depth, 0.0f, 1.0f) * depthMax);
+
+    uint64_t key = static_cast<uint64_t>(pass) & ((1ull << PASS_BITS) - 1);
+    key = (key << PROGRAM_BITS) | (static_cast<uint64_t>(program) & ((1ull << PROGRAM_BITS) - 1));
+    key = (key << MATERIAL_BITS) | (material & ((1ull << MATERIAL_BITS) - 1));
+    key = (key << TEXTURE_BITS) | (texture & ((1ull << TEXTURE_BITS) - 1));
+    key = (key << DEPTH_BITS) | depthBits;
+    return key;
+}
+
+void RenderQueue::begin() {
+    packets.clear();
+    transforms.clear();
+    lightLists.clear();
+}
+
+void RenderQueue::submit(uint64_t key, DrawFunction draw, void* object, const glm::mat4& modelMatrix,
+    const DrawLightList* lightList) {
+    packets.push_back({ key, draw, object, static_cast<uint32_t>(transforms.size()), addLightList(lightList) });
+    transforms.push_back(modelMatrix);
+}
+
+void RenderQueue::submit(uint64_t key, DrawFunction draw, void* object, const DrawLightList* lightList) {
+    packets.push_back({ key, draw, object, NO_TRANSFORM, addLightList(lightList) });
+}
+
+uint32_t RenderQueue::addLightList(const DrawLightList* lightList) {
+    if (lightList == nullptr) {
+        return NO_LIGHT_LIST;
+    }
+    lightLists.push_back(*lightList);
+    return static_cast<uint32_t>(lightLists.size()) - 1;
+}
+
+void RenderQueue::execute(RenderPass pass) {
+    const int programShift = MATERIAL_BITS + TEXTURE_BITS + DEPTH_BITS;
+    const int passShift = programShift + PROGRAM_BITS;
+
+    // Packets are sorted by pass first, so the pass is one contiguous run
+    auto first = std::lower_bound(packets.begin(), packets.end(), pass, [passShift](const DrawPacket& packet, RenderPass value) {
+        return (packet.key >> passShift) < static_cast<uint64_t>(value);
+    });
+
+    int currentProgram = -1;
+    const DrawLightList* currentLights = nullptr;
+    for (auto it = first; it != packets.end() && (it->key >> passShift) == static_cast<uint64_t>(pass); ++it) {
+        const DrawPacket& packet = *it;
+        int program = static_cast<int>((packet.key >> programShift) & ((1ull << PROGRAM_BITS) - 1));
+        if (program >= static_cast<int>(programs.size()) || programs[program] == nullptr) {
+            continue;
+        }
+
+        const ShaderProgram& shaderProgram = *programs[program];
+        if (program != currentProgram) {
+            shaderProgram.use();
+            currentProgram = program;
+            currentLights = nullptr;
+        }
+
+        if (packet.transformIndex != NO_TRANSFORM) {
+            shaderProgram.setMat4(Uniforms::ModelMatrix, transforms[packet.transformIndex]);
+        }
+        if (packet.lightListIndex != NO_LIGHT_LIST) {
+            // Light lists are uniforms of the program, only set when they differ from the last packet's
+            const DrawLightList& lights = lightLists[packet.lightListIndex];
+            if (currentLights == nullptr || lights.count != currentLights->count ||
+                std::memcmp(lights.indices, currentLights->indices, glm::max(lights.count, 0) * sizeof(GLint)) != 0) {
+                shaderProgram.setInt(Uniforms::DrawLightCount, lights.count);
+                if (lights.count > 0) {
+                    shaderProgram.setIntArray(Uniforms::DrawLights, lights.indices, lights.count);
+                }
+            }
+            currentLights = &lights;
+        }
+        packet.draw(packet.object, shaderProgram);
+    }
+}
+
+size_t RenderQueue::getPacketCount() const {
+    return packets.size();
+}
+
+// LSD radix sort of the packets by key, 8 bits per pass; digits every key shares are skipped
+void RenderQueue::sort() {
+    if (packets.size() < 2) {
+        return;
+    }
+
+    sortBuffer.resize(packets.size());
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t counts[256] = {};
+        for (const DrawPacket& packet : packets) {
+            counts[(packet.key >> shift) & 0xFF]++;
+        }
+
+        // All keys share this digit, the order doesn't change
+        if (counts[(packets[0].key >> shift) & 0xFF] == packets.size()) {
+            continue;
+        }
+
+        size_t offset = 0;
+        for (size_t& count : counts) {
+            size_t digitCount = count;
+            count = offset;
+            offset += digitCount;
+        }
+        for (const DrawPacket& packet : packets) {
+            sortBuffer[counts[(packet.key >> shift) & 0xFF]++] = packet;
+        }
+        packets.swap(sortBuffer);
+    }
+}
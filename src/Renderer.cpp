@@ -1,20 +1,41 @@
 #include "headers/Renderer.h"
+#include "headers/GLStateCache.h"
+#include "headers/GLDebug.h"
 #include <SDL.h>
+#include <algorithm>
 
-Renderer::Renderer(Window& window, Camera& camera, Model& model)
+// Frames drawn after an input event or a settings change, so the UI can settle (hover, active widgets)
+static const int REDRAW_FRAMES_AFTER_INPUT = 2;
+
+// Near and far planes of the camera's projection; the far plane also bounds the ground and the shadows
+static const float CAMERA_NEAR_PLANE = 0.1f;
+static const float CAMERA_FAR_PLANE = 100.0f;
+
+Renderer::Renderer(Window& window, Camera& camera, Model& model, TextureManager& textureManager)
     : window(window),
     camera(camera),
-    model(model),
     shadowMap(2048, 2048),
-    programShaderID(0),
-    infiniteGroundShaderID(0),
-    shadowMapShaderID(0),
-    MatrixID(0),
-    ViewMatrixID(0),
-    ModelMatrixID(0),
-    LightID(0),
-    AmbientLightID(0),
-    Projection(glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f)),
+    shadowAtlas(4096),
+    pointShadowMap(512),
+    model(model),
+    textureManager(textureManager),
+    shaderVariants(true),
+    modelLights(),
+    groundLights(),
+    modelProgramIndex(0),
+    groundProgramIndex(0),
+    shadowProgramIndex(0),
+    shadowLayeredProgramIndex(0),
+    shadowAtlasProgramIndex(0),
+    shadowAtlasLayeredProgramIndex(0),
+    pointShadowProgramIndex(0),
+    viewportWidth(0),
+    viewportHeight(0),
+    overlayPass(nullptr),
+    overlayContext(nullptr),
+    instanceGrid(model),
+    instanceGridSize(0),
+    Projection(glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE)),
     ambientLightIntensity(0.5f, 0.5f, 0.5f),
     vao(0),
     vbo(0),
@@ -25,7 +46,23 @@ Renderer::Renderer(Window& window, Camera& camera, Model& model)
     groundHeightSet(false),
     autoRotateModel(true),
     rotationSpeed(30.0f),
-    shadowsEnabled(true){}
+    currentRotation(0.0f),
+    lastRotationTicks(SDL_GetTicks()),
+    shadowsEnabled(true),
+    onDemandRendering(true),
+    redrawFrames(REDRAW_FRAMES_AFTER_INPUT),
+    renderedSceneVersion(0),
+    shadowCasterVersion(0),
+    shadowUpdateInterval(1),
+    framesSinceShadowUpdate(0),
+    layeredShadows(false) {
+    instanceBatches.push_back(&instanceGrid);
+
+    for (int i = 0; i < MAX_SHADOW_CASCADES; ++i) {
+        cascadePasses[i].renderer = this;
+        cascadePasses[i].cascade = i;
+    }
+}
 
 Renderer::~Renderer() {
     cleanup();
@@ -39,29 +76,91 @@ bool Renderer::init() {
         return false;
     }
 
+    // Errors are reported by the driver's debug callback where available (debug builds only)
+    GLDebug::init();
+
+    // Non-instanced draws read an identity instance transform and a white tint
+    Model::setDefaultInstanceAttributes();
+
     // Set the background (clear) color
     glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
 
     // Enable depth test and culling
-    glEnable(GL_DEPTH_TEST);
+    GLStateCache::get().setEnabled(GL_DEPTH_TEST, true);
     glDepthFunc(GL_LESS);
-    glEnable(GL_CULL_FACE);
+    GLStateCache::get().setEnabled(GL_CULL_FACE, true);
     glCullFace(GL_BACK);
     glFrontFace(GL_CCW);
 
     // Load the shader programs
-    programShaderID = LoadShaders("src/shaders/vert.glsl", "src/shaders/frag.glsl");
-    infiniteGroundShaderID = LoadShaders("src/shaders/infiniteGroundVert.glsl", "src/shaders/infiniteGroundFrag.glsl");
-    shadowMapShaderID = LoadShaders("src/shaders/shadowVert.glsl", "src/shaders/shadowFrag.glsl");
-
-    if (programShaderID == 0 || infiniteGroundShaderID == 0 || shadowMapShaderID == 0) {
+    programShader = LoadShaders("src/shaders/vert.glsl", "src/shaders/frag.glsl");
+    infiniteGroundShader = LoadShaders("src/shaders/infiniteGroundVert.glsl", "src/shaders/infiniteGroundFrag.glsl");
+    shadowMapShader = LoadShaders("src/shaders/shadowVert.glsl", "src/shaders/shadowFrag.glsl");
+    shadowAtlasShader = LoadShaders("src/shaders/shadowAtlasVert.glsl", "src/shaders/shadowFrag.glsl");
+    shadowMomentsShader = LoadShaders("src/shaders/shadowMomentsVert.glsl", "src/shaders/shadowMomentsFrag.glsl");
+
+    if (programShader.getID() == 0 || infiniteGroundShader.getID() == 0 || shadowMapShader.getID() == 0 ||
+        shadowAtlasShader.getID() == 0 || shadowMomentsShader.getID() == 0) {
         fprintf(stderr, "Failed to load shaders\n"); 
         return false;
     }
 
-    infiniteGround->initGround(infiniteGroundShaderID);
+    // Layered shadow rendering needs a geometry shader with invocations, without it the cascades are rendered one by one
+    shadowLayeredShader = LoadShaders("src/shaders/shadowLayeredVert.glsl", "src/shaders/shadowLayeredGeom.glsl",
+        "src/shaders/shadowFrag.glsl");
+    if (shadowLayeredShader.getID() == 0) {
+        std::cerr << "Layered shadow pass unavailable, rendering one pass per shadow cascade" << std::endl;
+    }
+    else if (glViewportArrayv) {
+        // The atlas tiles are viewports, picked per triangle with gl_ViewportIndex
+        shadowAtlasLayeredShader = LoadShaders("src/shaders/shadowLayeredVert.glsl", "src/shaders/shadowAtlasGeom.glsl",
+            "src/shaders/shadowFrag.glsl");
+    }
 
-    MatrixUniformLocations(programShaderID);
+    // Point lights render all six cube faces in one pass, which needs the geometry shader as well
+    pointShadowShader = LoadShaders("src/shaders/shadowLayeredVert.glsl", "src/shaders/pointShadowGeom.glsl",
+        "src/shaders/pointShadowFrag.glsl");
+    if (pointShadowShader.getID() == 0) {
+        std::cerr << "Point light shadows unavailable" << std::endl;
+    }
+
+    infiniteGround->initGround(infiniteGroundShader);
+
+    // Draws are recorded into the render queue and run sorted; program indices go into the sort keys
+    groundProgramIndex = renderQueue.registerProgram(infiniteGroundShader);
+    shadowProgramIndex = renderQueue.registerProgram(shadowMapShader);
+    shadowAtlasProgramIndex = renderQueue.registerProgram(shadowAtlasShader);
+    if (shadowLayeredShader.getID() != 0) {
+        shadowLayeredProgramIndex = renderQueue.registerProgram(shadowLayeredShader);
+        layeredShadows = true;
+    }
+    if (shadowAtlasLayeredShader.getID() != 0) {
+        shadowAtlasLayeredProgramIndex = renderQueue.registerProgram(shadowAtlasLayeredShader);
+    }
+    if (pointShadowShader.getID() != 0) {
+        pointShadowProgramIndex = renderQueue.registerProgram(pointShadowShader);
+    }
+
+    // The model program without defines picks every feature at run time; its variants fix them at compile time
+    // and are compiled when a draw first needs them
+    modelProgramIndex = setupModelProgram(programShader, this);
+    programVariants.init("src/shaders/vert.glsl", "src/shaders/frag.glsl", setupModelProgram, releaseModelProgram, this);
+
+    // Camera and light data are shared by all programs through uniform buffers
+    sceneUniforms.init();
+    lightClusters.init();
+    SceneUniforms::bindProgram(infiniteGroundShader);
+    SceneUniforms::bindProgram(shadowMapShader);
+    SceneUniforms::bindProgram(shadowAtlasShader);
+    if (shadowLayeredShader.getID() != 0) {
+        SceneUniforms::bindProgram(shadowLayeredShader);
+    }
+    if (shadowAtlasLayeredShader.getID() != 0) {
+        SceneUniforms::bindProgram(shadowAtlasLayeredShader);
+    }
+    if (pointShadowShader.getID() != 0) {
+        SceneUniforms::bindProgram(pointShadowShader);
+    }
 
     // Define lights (spotlight, directional light, point light)
     setupDirectionalLight();
@@ -69,100 +168,360 @@ bool Renderer::init() {
     setupPointLight();
 
     shadowMap.init();
-
-    // Pass light uniforms
-    glUseProgram(programShaderID);
-    glUniform3f(AmbientLightID, ambientLightIntensity.x, ambientLightIntensity.y, ambientLightIntensity.z);
+    shadowAtlas.init();
+    pointShadowMap.init();
+    shadowMoments.init(shadowMomentsShader);
 
     return true;
 }
 
 
 
-// Function to set the shadow matrix uniform in the shader
-void Renderer::setShadowMatrixUniform(GLuint shaderID, const glm::mat4& shadowMatrix) {
-    glUniformMatrix4fv(glGetUniformLocation(shaderID, "matrixShadow"), 1, GL_FALSE, &shadowMatrix[0][0]);
+// Shadow pass: the casters from the light into every cascade at once, the geometry shader picks the layers
+void Renderer::runShadowPass(void* context) {
+    Renderer* renderer = static_cast<Renderer*>(context);
+    renderer->shadowMap.bindForShadowPass();  // Bind and clear the shadow framebuffer
+    renderer->renderQueue.execute(RenderPass::SHADOW);
+
+    // The depth map stays valid until the light or a caster changes
+    renderer->shadowMap.markRendered(renderer->shadowCasterVersion);
+    renderer->framesSinceShadowUpdate = 0;
+}
+
+// Shadow cascade pass: the casters from the light into one cascade
+void Renderer::runShadowCascadePass(void* context) {
+    CascadePass* pass = static_cast<CascadePass*>(context);
+    Renderer* renderer = pass->renderer;
+    renderer->shadowMap.bindForCascadePass(pass->cascade);
+
+    // The queue keeps the program in use, so the cascade only has to be set once
+    renderer->shadowMapShader.use();
+    renderer->shadowMapShader.setInt(Uniforms::CascadeIndex, pass->cascade);
+    renderer->renderQueue.execute(RenderPass::SHADOW);
+
+    renderer->shadowMap.markCascadeRendered(pass->cascade, renderer->shadowCasterVersion);
+    renderer->framesSinceShadowUpdate = 0;
 }
 
-// Function to bind the shadow map to a texture unit
-void Renderer::bindShadowMap(GLuint shaderID, GLuint textureUnit) {
-    shadowMap.bindForLightingPass(textureUnit);
-    glUniform1i(glGetUniformLocation(shaderID, "shadowMap"), textureUnit);
+// Shadow atlas pass: the casters from every light with a tile, in one pass through the tiles' viewports
+// or one pass per tile
+void Renderer::runShadowAtlasPass(void* context) {
+    Renderer* renderer = static_cast<Renderer*>(context);
+    bool layered = renderer->layeredShadows && renderer->shadowAtlasLayeredShader.getID() != 0;
+    renderer->shadowAtlas.bindForShadowPass(layered);
+    if (layered) {
+        renderer->renderQueue.execute(RenderPass::SHADOW_ATLAS);
+    }
+    else {
+        for (int i = 0; i < renderer->shadowAtlas.getTileCount(); ++i) {
+            renderer->shadowAtlas.bindForTile(i);
+            renderer->shadowAtlasShader.use();
+            renderer->shadowAtlasShader.setInt(Uniforms::TileIndex, i);
+            renderer->renderQueue.execute(RenderPass::SHADOW_ATLAS);
+        }
+    }
+
+    renderer->shadowAtlas.markRendered(renderer->shadowCasterVersion);
 }
 
-// Render ground with shadows
-void Renderer::renderGroundWithShadows(const glm::mat4& view, const glm::mat4& projection) {
-    // Render the ground with the shadow map applied
-    infiniteGround->renderGround(infiniteGroundShaderID, view, projection, directionalLights, pointLights, spotLights,
-        glm::vec3(0.2f, 0.3f, 0.3f), shadowMap, shadowsEnabled);
+// Point shadow pass: the casters once per point light, the geometry shader copies them into the cube faces
+void Renderer::runPointShadowPass(void* context) {
+    Renderer* renderer = static_cast<Renderer*>(context);
+    renderer->pointShadowMap.bindForShadowPass();
+    for (int i = 0; i < renderer->pointShadowMap.getShadowCount(); ++i) {
+        if (renderer->pointShadowMap.getFaceMask(i) == 0) {
+            continue;
+        }
+        renderer->pointShadowShader.use();
+        renderer->pointShadowShader.setInt(Uniforms::PointLightIndex, i);
+        renderer->renderQueue.execute(RenderPass::SHADOW_POINT);
+    }
+
+    renderer->pointShadowMap.markRendered(renderer->shadowCasterVersion);
 }
 
-// Render model with shadows
-void Renderer::renderModelWithShadows(const glm::mat4& View, const glm::mat4& Projection) {
-    glUseProgram(programShaderID);
-    MatrixUniformLocations(programShaderID);
+// Shadow moments pass: converts the cascades to blurred EVSM moments after the shadow map changed
+void Renderer::runShadowMomentsPass(void* context) {
+    Renderer* renderer = static_cast<Renderer*>(context);
+    GLStateCache::get().setEnabled(GL_DEPTH_TEST, false);
+    renderer->shadowMoments.update(renderer->shadowMap);
+}
 
-    // Get the light space matrix from the ShadowMap class
-    glm::mat4 lightSpaceMatrix = shadowMap.getLightSpaceMatrix();
+// Main pass: clears the window and draws the model with the shadow map bound for sampling
+void Renderer::runMainPass(void* context) {
+    Renderer* renderer = static_cast<Renderer*>(context);
+    GLStateCache& state = GLStateCache::get();
 
-    // Compute the model matrix and MVP matrix
-    glm::mat4 Model = model.getModelMatrix();
-    glm::mat4 MVP = calculateMVP(Model, View, Projection);
+    renderer->shadowMap.bindForCameraView(renderer->viewportWidth, renderer->viewportHeight);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Pass the matrices to the object shader
-    MatrixPassToShader(MVP, View, Model);
+    // Ensure proper OpenGL state
+    state.setEnabled(GL_DEPTH_TEST, true);
+    state.setEnabled(GL_CULL_FACE, true);  // Enable face culling by default
+
+    // Bind the shadow map, its moments, the shadow atlas, the point light cube maps and the light clusters
+    renderer->shadowMap.bindForLightingPass(1);
+    renderer->shadowMoments.bindForLightingPass();
+    renderer->shadowAtlas.bindForLightingPass();
+    renderer->pointShadowMap.bindForLightingPass();
+    renderer->lightClusters.bindForLightingPass();
+    renderer->renderQueue.execute(RenderPass::MAIN);
+}
 
-    // Pass the light space matrix to the vertex shader
-    glUniformMatrix4fv(glGetUniformLocation(programShaderID, "lightSpaceMatrix"), 1, GL_FALSE, &lightSpaceMatrix[0][0]);
+// Ground pass: the ground on top of the main pass (the binds are no-ops after the main pass)
+void Renderer::runGroundPass(void* context) {
+    Renderer* renderer = static_cast<Renderer*>(context);
+    GLStateCache& state = GLStateCache::get();
+
+    renderer->shadowMap.bindForCameraView(renderer->viewportWidth, renderer->viewportHeight);
+    state.setEnabled(GL_DEPTH_TEST, true);
+    state.setEnabled(GL_CULL_FACE, true);
+    renderer->shadowMap.bindForLightingPass(1);
+    renderer->shadowMoments.bindForLightingPass();
+    renderer->shadowAtlas.bindForLightingPass();
+    renderer->pointShadowMap.bindForLightingPass();
+    renderer->lightClusters.bindForLightingPass();
+    renderer->renderQueue.execute(RenderPass::GROUND);
+}
 
-    // Set shadow bias uniform for the fragment shader (increased for better self-shadow prevention)
-    glUniform1f(glGetUniformLocation(programShaderID, "shadowBias"), 0.01f);
+// Sets the constant uniforms and blocks of the model program or one of its variants and registers it with the queue
+int Renderer::setupModelProgram(const ShaderProgram& program, void* context) {
+    Renderer* renderer = static_cast<Renderer*>(context);
 
-    // Set shadows enabled uniform
-    glUniform1i(glGetUniformLocation(programShaderID, "shadowsEnabled"), shadowsEnabled ? 1 : 0);
+    // Material textures are array textures on consecutive units, material parameters come from the material buffer
+    program.use();
+    GLint materialTextureUnits[MAX_TEXTURE_ARRAYS];
+    for (int i = 0; i < MAX_TEXTURE_ARRAYS; ++i) {
+        materialTextureUnits[i] = FIRST_MATERIAL_TEXTURE_UNIT + i;
+    }
+    program.setIntArray(Uniforms::DiffuseTextures, materialTextureUnits, MAX_TEXTURE_ARRAYS);
+    program.setInt(Uniforms::ShadowMap, 1);
+    program.setInt(Uniforms::ShadowAtlas, SHADOW_ATLAS_TEXTURE_UNIT);
+    program.setInt(Uniforms::PointShadowMaps, POINT_SHADOW_TEXTURE_UNIT);
+    program.setInt(Uniforms::ShadowMoments, SHADOW_MOMENTS_TEXTURE_UNIT);
+    program.setInt(Uniforms::LocalLights, LOCAL_LIGHT_TEXTURE_UNIT);
+    program.setInt(Uniforms::ClusterRanges, CLUSTER_RANGE_TEXTURE_UNIT);
+    program.setInt(Uniforms::ClusterIndices, CLUSTER_INDEX_TEXTURE_UNIT);
+    program.setInt(Uniforms::DrawLightCount, -1);
+    program.bindUniformBlock("MaterialBlock", MATERIAL_BLOCK_BINDING);
+    SceneUniforms::bindProgram(program);
+    return renderer->renderQueue.registerProgram(program);
+}
 
-    // Update ambient light intensity uniform each frame
-    glUniform3f(glGetUniformLocation(programShaderID, "AmbientLightIntensity"), 
-                ambientLightIntensity.x, ambientLightIntensity.y, ambientLightIntensity.z);
+// A variant of the model program is being deleted, its render queue index must not be used any more
+void Renderer::releaseModelProgram(const ShaderProgram& program, void* context) {
+    static_cast<Renderer*>(context)->renderQueue.unregisterProgram(program);
+}
 
-    // Bind the shadow map texture
-    bindShadowMap(programShaderID, 1);
+// Program of a lit model draw: the variant with its features, or the model program if variants are off, failed
+// or not compiled yet (they are compiled before the next frame records its draws)
+int Renderer::selectModelProgram(const ShaderFeatures& features) {
+    int program = shaderVariants ? programVariants.findVariant(features) : -1;
+    return program >= 0 ? program : modelProgramIndex;
+}
 
-    // Render the model
-    model.draw(programShaderID);
+// Model packet: the camera and lights are in the uniform buffers, the queue set the model matrix
+void Renderer::drawModelPacket(void* object, const ShaderProgram& /*program*/) {
+    static_cast<const Model*>(object)->draw();
 }
 
-// Render scene
-void Renderer::renderScene() {
-    // First pass: Render to the shadow map (only if shadows are enabled)
+// Shadow packet: depth only, the queue set the model matrix
+void Renderer::drawShadowPacket(void* object, const ShaderProgram& /*program*/) {
+    static_cast<const Model*>(object)->drawDepthOnly();
+}
+
+// Instanced packets: every copy in the batch, the queue set the batch transform
+void Renderer::drawInstancedPacket(void* object, const ShaderProgram& /*program*/) {
+    static_cast<const InstanceBatch*>(object)->draw();
+}
+
+void Renderer::drawInstancedShadowPacket(void* object, const ShaderProgram& /*program*/) {
+    static_cast<const InstanceBatch*>(object)->drawDepthOnly();
+}
+
+// Ground packet: the ground sets its own transform and material
+void Renderer::drawGroundPacket(void* object, const ShaderProgram& program) {
+    Renderer* renderer = static_cast<Renderer*>(object);
+    renderer->infiniteGround->renderGround(program, glm::vec3(0.2f, 0.3f, 0.3f), renderer->shadowMap);
+}
+
+// Records the draws of the frame into the render queue
+void Renderer::recordDraws(const glm::mat4& View) {
+    renderQueue.begin();
+
+    // Models sort front to back by the view distance of their center
+    glm::vec3 center;
+    float radius;
+    model.getBoundingSphere(center, radius);
+    float depth = -(View * glm::vec4(center, 1.0f)).z / CAMERA_FAR_PLANE;
+
+    glm::mat4 modelMatrix = model.getModelMatrix();
+    GLuint materialBuffer = model.getMaterialBuffer();
+    GLuint textureArray = model.getPrimaryTextureArray();
+    int shadowProgram = layeredShadows ? shadowLayeredProgramIndex : shadowProgramIndex;
+    int atlasProgram = layeredShadows && shadowAtlasLayeredShader.getID() != 0 ?
+        shadowAtlasLayeredProgramIndex : shadowAtlasProgramIndex;
+    bool atlasCasters = shadowAtlas.getTileCount() > 0;
+    bool pointCasters = pointShadowShader.getID() != 0 && pointShadowMap.getShadowCount() > 0;
+
+    // Shadow casters are always recorded, the frame graph culls the shadow pass when shadows are off.
+    // Depth-only draws use no material state, so only the program and depth matter for their order
+    renderQueue.submit(RenderQueue::makeKey(RenderPass::SHADOW, shadowProgram, 0, 0, depth),
+        drawShadowPacket, &model, modelMatrix);
+    if (atlasCasters) {
+        renderQueue.submit(RenderQueue::makeKey(RenderPass::SHADOW_ATLAS, atlasProgram, 0, 0, depth),
+            drawShadowPacket, &model, modelMatrix);
+    }
+    if (pointCasters) {
+        renderQueue.submit(RenderQueue::makeKey(RenderPass::SHADOW_POINT, pointShadowProgramIndex, 0, 0, depth),
+            drawShadowPacket, &model, modelMatrix);
+    }
+
+    // Each lit draw only shades the spot and point lights that reach its bounds
+    glm::vec3 boundsMin, boundsMax;
+    model.getWorldBounds(modelMatrix, boundsMin, boundsMax);
+    lightClusters.cullLights(boundsMin, boundsMax, modelLights);
+
+    // Lit draws use the program variant of their textures, vertex format, lights and the frame's shadow settings
+    ShaderFeatures features;
+    features.shadows = shadowsEnabled;
+    features.shadowFilter = shadowMap.getFilter();
+    features.directionalLights = static_cast<int>(directionalLights.size());
+    features.textured = textureArray != 0;
+    features.instanced = false;
+    features.localLights = ShaderFeatures::getLocalLightMode(modelLights);
+    renderQueue.submit(RenderQueue::makeKey(RenderPass::MAIN, selectModelProgram(features), materialBuffer, textureArray,
+        depth), drawModelPacket, &model, modelMatrix, &modelLights);
+
+    for (InstanceBatch* batch : instanceBatches) {
+        if (batch->getInstanceCount() == 0) {
+            continue;
+        }
+        const Model& batchModel = batch->getModel();
+        batchModel.getBoundingSphere(center, radius);
+        float batchDepth = -(View * glm::vec4(center, 1.0f)).z / CAMERA_FAR_PLANE;
+
+        renderQueue.submit(RenderQueue::makeKey(RenderPass::SHADOW, shadowProgram, 0, 0, batchDepth),
+            drawInstancedShadowPacket, batch, batch->getTransform());
+        if (atlasCasters) {
+            renderQueue.submit(RenderQueue::makeKey(RenderPass::SHADOW_ATLAS, atlasProgram, 0, 0, batchDepth),
+                drawInstancedShadowPacket, batch, batch->getTransform());
+        }
+        if (pointCasters) {
+            renderQueue.submit(RenderQueue::makeKey(RenderPass::SHADOW_POINT, pointShadowProgramIndex, 0, 0, batchDepth),
+                drawInstancedShadowPacket, batch, batch->getTransform());
+        }
+
+        DrawLightList batchLights;
+        batch->getWorldBounds(boundsMin, boundsMax);
+        lightClusters.cullLights(boundsMin, boundsMax, batchLights);
+        features.textured = batchModel.getPrimaryTextureArray() != 0;
+        features.instanced = true;
+        features.localLights = ShaderFeatures::getLocalLightMode(batchLights);
+        renderQueue.submit(RenderQueue::makeKey(RenderPass::MAIN, selectModelProgram(features), batchModel.getMaterialBuffer(),
+            batchModel.getPrimaryTextureArray(), batchDepth), drawInstancedPacket, batch, batch->getTransform(), &batchLights);
+    }
+
+    // The ground is bounded by the far plane around the camera
+    glm::vec3 cameraPosition = camera.getPosition();
+    float groundHeight = infiniteGround->getHeight();
+    lightClusters.cullLights(glm::vec3(cameraPosition.x - CAMERA_FAR_PLANE, groundHeight, cameraPosition.z - CAMERA_FAR_PLANE),
+        glm::vec3(cameraPosition.x + CAMERA_FAR_PLANE, groundHeight, cameraPosition.z + CAMERA_FAR_PLANE), groundLights);
+    renderQueue.submit(RenderQueue::makeKey(RenderPass::GROUND, groundProgramIndex, 0, 0, 1.0f), drawGroundPacket, this,
+        &groundLights);
+    renderQueue.sort();
+}
+
+// Declares the passes of the frame and what they read and write; passes nothing reads are culled
+void Renderer::buildFrameGraph() {
+    frameGraph.beginFrame();
+
+    int shadowMapResource = frameGraph.addResource("ShadowMap");
+    int shadowAtlasResource = frameGraph.addResource("ShadowAtlas");
+    int pointShadowResource = frameGraph.addResource("PointShadowMaps");
+    int shadowMomentsResource = frameGraph.addResource("ShadowMoments");
+    int backbufferResource = frameGraph.addResource("Backbuffer");
+    frameGraph.markOutput(backbufferResource);
+
+    // The shaders only sample the shadow map while shadows are enabled
+    std::vector<int> sceneInputs;
     if (shadowsEnabled) {
-        renderToTheDepthTexture();
+        sceneInputs.push_back(shadowMapResource);
+        sceneInputs.push_back(shadowAtlasResource);
+        sceneInputs.push_back(pointShadowResource);
+        if (shadowMap.getFilter() == ShadowFilter::EVSM) {
+            sceneInputs.push_back(shadowMomentsResource);
+        }
     }
 
-    // Clear the screen
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // The shadow map keeps its contents between frames: only re-render it when the light or a caster changed.
+    // While auto rotating, the rotation alone may refresh it every few frames instead of every frame
+    bool shadowUpToDate = shadowMap.isUpToDate(shadowCasterVersion);
+    if (!shadowUpToDate && autoRotateModel && shadowMap.isLightUpToDate()) {
+        shadowUpToDate = ++framesSinceShadowUpdate < shadowUpdateInterval;
+    }
+    if (!shadowUpToDate && layeredShadows) {
+        frameGraph.addPass("Shadow", {}, { shadowMapResource }, runShadowPass, this);
+    }
+    else if (!shadowUpToDate) {
+        // One pass per cascade, so each one is timed on its own and unchanged cascades are skipped
+        static const char* cascadePassNames[MAX_SHADOW_CASCADES] = {
+            "Shadow Cascade 0", "Shadow Cascade 1", "Shadow Cascade 2", "Shadow Cascade 3"
+        };
+        for (int i = 0; i < shadowMap.getActiveCascadeCount(); ++i) {
+            if (!shadowMap.isCascadeUpToDate(i, shadowCasterVersion)) {
+                frameGraph.addPass(cascadePassNames[i], {}, { shadowMapResource }, runShadowCascadePass, &cascadePasses[i]);
+            }
+        }
+    }
+    // The moments follow the shadow map: rebuilt once after each shadow pass, and only while EVSM samples them
+    if (shadowMap.getFilter() == ShadowFilter::EVSM && (!shadowUpToDate || !shadowMoments.isUpToDate(shadowMap))) {
+        frameGraph.addPass("Shadow Moments", { shadowMapResource }, { shadowMomentsResource }, runShadowMomentsPass, this);
+    }
+    // The atlas is cached the same way, as a whole: its tiles move together whenever the packing changes
+    if (shadowAtlas.getTileCount() > 0 && !shadowAtlas.isUpToDate(shadowCasterVersion)) {
+        frameGraph.addPass("Shadow Atlas", {}, { shadowAtlasResource }, runShadowAtlasPass, this);
+    }
+    if (pointShadowShader.getID() != 0 && pointShadowMap.getShadowCount() > 0 &&
+        !pointShadowMap.isUpToDate(shadowCasterVersion)) {
+        frameGraph.addPass("Point Shadows", {}, { pointShadowResource }, runPointShadowPass, this);
+    }
+    frameGraph.addPass("Main", sceneInputs, { backbufferResource }, runMainPass, this);
+
+    sceneInputs.push_back(backbufferResource);
+    frameGraph.addPass("Ground", sceneInputs, { backbufferResource }, runGroundPass, this);
+
+    if (overlayPass) {
+        frameGraph.addPass("UI", { backbufferResource }, { backbufferResource }, overlayPass, overlayContext);
+    }
+}
+
+// Render scene
+void Renderer::renderScene() {
+    GLStateCache& state = GLStateCache::get();
+    state.beginFrame();
 
-    // Set viewport
     int width, height;
     SDL_GetWindowSize(window.getWindow(), &width, &height);
-    glViewport(0, 0, width, height);
-    
-    // Ensure proper OpenGL state
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);  // Enable face culling by default
+    viewportWidth = width;
+    viewportHeight = height;
 
     glm::mat4 View = camera.getViewMatrix();
-    glm::mat4 Projection = glm::perspective(glm::radians(45.0f), (float)width / height, 0.1f, 100.0f);
+    glm::mat4 Projection = glm::perspective(glm::radians(45.0f), (float)width / height, CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE);
+
+    // Everything that changes from here on (texture streaming) asks for another frame through the version
+    renderedSceneVersion = sceneVersion();
+    if (redrawFrames > 0) {
+        redrawFrames--;
+    }
 
     // Apply automatic rotation to showcase dynamic shadows
     if (autoRotateModel) {
-        static Uint32 lastTime = SDL_GetTicks();
         Uint32 currentTime = SDL_GetTicks();
-        float deltaTime = (currentTime - lastTime) / 1000.0f;
-        lastTime = currentTime;
+        float deltaTime = (currentTime - lastRotationTicks) / 1000.0f;
+        lastRotationTicks = currentTime;
 
         // Update model rotation around Y-axis
-        static float currentRotation = 0.0f;
         currentRotation += rotationSpeed * deltaTime;
         if (currentRotation >= 360.0f) {
             currentRotation -= 360.0f;
@@ -177,141 +536,121 @@ void Renderer::renderScene() {
         groundHeightSet = true;
     }
 
-    // Render the lights for the object
-    renderLightsForObject();  // Ensure the lights are set up for the object 
+    // Copies of the model in the instance grid follow its transform
+    instanceGrid.setTransform(model.getModelMatrix());
 
-    renderModelWithShadows(View, Projection);
-    // Render the ground and model with shadows
-    renderGroundWithShadows(View, Projection);
-    
-   
-    // Update model's lowest point for the next frame
-    model.updateLowestPoint();
+    // Stream in the texture mips the model needs at its current on-screen size
+    updateTextureStreaming(View, height);
 
-    // Check for OpenGL errors
-    GLenum err;
-    while ((err = glGetError()) != GL_NO_ERROR) {
-        std::cerr << "OpenGL error: " << err << std::endl;
-    }
-}
+    // Upload the lights and the frame data if they changed since the last frame
+    renderLightsForObject();
+    sceneUniforms.updateFrame(camera, Projection, shadowMap, 0.01f, shadowsEnabled);
 
-// Render to the depth texture (shadow map)
-void Renderer::renderToTheDepthTexture() {
-    shadowMap.bindForShadowPass();  // Bind shadow framebuffer
-    glUseProgram(shadowMapShaderID);  // Use shadow shader
+    // Bin the spot and point lights into the clusters of this view
+    lightClusters.update(spotLights, pointLights, View, Projection, width, height);
 
-    // Calculate light space matrix using the first directional light
-    if (!directionalLights.empty()) {
-        glm::vec3 lightPos = -directionalLights[0].getDirection() * 10.0f;  // Position light far away in opposite direction
-        glm::vec3 targetPos = glm::vec3(0.0f, 0.0f, 0.0f);  // Point towards scene center
-        shadowMap.calculateLightSpaceMatrix(lightPos, targetPos, directionalLights[0].getLightType());
-    }
-
-    // Get the calculated light space matrix
-    glm::mat4 lightSpaceMatrix = shadowMap.getLightSpaceMatrix();
-    
-    // Extract light projection and view from the light space matrix
-    // For orthographic projection for directional light (smaller bounds for tighter shadows)
-    glm::mat4 lightProjection = glm::ortho(-5.0f, 5.0f, -5.0f, 5.0f, 1.0f, 50.0f);
-    glm::vec3 lightPos = -directionalLights[0].getDirection() * 10.0f;
-    glm::vec3 targetPos = glm::vec3(0.0f, 0.0f, 0.0f);
-    glm::mat4 lightView = glm::lookAt(lightPos, targetPos, glm::vec3(0.0f, 1.0f, 0.0f));
-
-    // ---- Render Model to Shadow Map ----
-    glm::mat4 modelMatrix = model.getModelMatrix();
-    glm::mat4 lightMVP = lightProjection * lightView * modelMatrix;
+    // Compile the program variants the last frame's draws asked for, recording only looks them up
+    programVariants.compileRequested();
 
-    // Pass light-space transformation to the shadow shader for the model
-    glUniformMatrix4fv(glGetUniformLocation(shadowMapShaderID, "lightMVP"), 1, GL_FALSE, &lightMVP[0][0]);
-    
-    // Pass the shadow matrix for texture sampling
-    glm::mat4 shadowMatrix = lightSpaceMatrix * modelMatrix;
-    glUniformMatrix4fv(glGetUniformLocation(shadowMapShaderID, "matrixShadow"), 1, GL_FALSE, &shadowMatrix[0][0]);
+    // Record the draws, sorted by pass, program and material, then run the passes that contribute to the frame
+    recordDraws(View);
+    shadowCasterVersion = casterVersion();
+    buildFrameGraph();
+    frameGraph.execute();
 
-    // Render the model into the shadow map
-    model.draw(shadowMapShaderID);
+    // Update model's lowest point for the next frame
+    model.updateLowestPoint();
 
-    shadowMap.bindForCameraView();  // Rebind framebuffer for regular camera rendering
+    // Only polls glGetError when the debug callback is unavailable, compiled out of release builds
+    GLDebug::checkErrors("Renderer::renderScene");
 }
 
-
-
-
-void Renderer::renderLightsForObject() {
-
-    // Ensure the shader program is active
-    glUseProgram(programShaderID);
-    // Send the number of directional and spotlights to the shader
-    glUniform1i(glGetUniformLocation(programShaderID, "numDirLights"), static_cast<GLint>(directionalLights.size()));
-    glUniform1i(glGetUniformLocation(programShaderID, "numSpotLights"), static_cast<GLint>(spotLights.size()));
-
-    // Render all directional lights
-    for (int i = 0; i < static_cast<GLint>(directionalLights.size()); ++i) {
-
-        lightPos = -directionalLights[i].getDirection() * 10.0f;  // Simulate a far-away light source
-        targetPos = glm::vec3(0.0f, 0.0f, 0.0f);  // Light is pointing towards the center of the scene (or the object)
-
-        // Update shadow map for the first directional light (primary shadow caster)
-        if (i == 0) {
-            shadowMap.calculateLightSpaceMatrix(lightPos, targetPos, directionalLights[i].getLightType());
+// Request the textures of every model drawn, then let the texture manager stream them
+void Renderer::updateTextureStreaming(const glm::mat4& View, int viewportHeight) {
+    glm::vec3 center;
+    float radius;
+    model.getBoundingSphere(center, radius);
+    float modelScale = glm::max(glm::max(model.getScale().x, model.getScale().y), model.getScale().z);
+    requestModelTextures(model, center, radius, modelScale, View, viewportHeight);
+
+    // Instanced copies need the detail of the copy nearest to the camera
+    for (const InstanceBatch* batch : instanceBatches) {
+        glm::vec3 localCenter;
+        float localRadius;
+        batch->getModel().getLocalBoundingSphere(localCenter, localRadius);
+        if (localRadius > 0.0f && batch->getNearestInstanceSphere(camera.getPosition(), center, radius)) {
+            requestModelTextures(batch->getModel(), center, radius, radius / localRadius, View, viewportHeight);
         }
-
-        directionalLights[i].sendToShader(programShaderID, "dirLights[" + std::to_string(i) + "]");
-        directionalLights[i].enableDirectionalLights(programShaderID, i);
-   
     }
 
-    // Render all spot lights
-    for (int i = 0; i < static_cast<GLint>(spotLights.size()); ++i) {
-        lightPos = spotLights[i].getPosition();  // Use actual spotlight position
-        targetPos = lightPos + spotLights[i].getDirection();  // Light is pointing in its direction
+    textureManager.update();
+}
 
-        // Update shadow map for spot lights if no directional light is present
-        if (directionalLights.empty() && i == 0) {
-            shadowMap.calculateLightSpaceMatrix(lightPos, targetPos, spotLights[i].getLightType());
+// Request the textures of the materials on screen, prioritized by their projected area, and the mip level
+// each one needs from the model's projected size and the material's UV density
+void Renderer::requestModelTextures(Model& model, const glm::vec3& center, float radius, float modelScale,
+    const glm::mat4& View, int viewportHeight) {
+    // Only request finer mips if some part of the model is in front of the camera
+    glm::vec3 centerViewSpace = glm::vec3(View * glm::vec4(center, 1.0f));
+    if (radius > 0.0f && centerViewSpace.z - radius < 0.0f) {
+        // Screen pixels covered by one world unit at the model's nearest visible point
+        float distance = glm::max(-centerViewSpace.z - radius, CAMERA_NEAR_PLANE);
+        float pixelsPerUnit = viewportHeight / (2.0f * glm::tan(glm::radians(45.0f) * 0.5f) * distance);
+
+        for (size_t i = 0; i < model.getMaterialCount(); ++i) {
+            // Materials without triangles are never drawn, so their textures are never loaded
+            float screenArea = model.getMaterialSurfaceArea(i) * modelScale * modelScale * pixelsPerUnit * pixelsPerUnit;
+            if (screenArea <= 0.0f) {
+                continue;
+            }
+            model.requestTexture(i, screenArea);
+
+            GLuint textureID = model.getTextureID(i);
+            if (textureID == 0) {
+                continue;
+            }
+
+            // Texels that land on one pixel at the top mip; every halving is one level down
+            float texelsPerUnit = textureManager.getTextureSize(textureID) * model.getMaterialUVDensity(i) / modelScale;
+            float texelsPerPixel = texelsPerUnit / pixelsPerUnit;
+            int level = static_cast<int>(glm::floor(glm::log2(glm::max(texelsPerPixel, 1.0f))));
+            textureManager.requestMipLevel(textureID, level);
         }
-
-        spotLights[i].sendToShader(programShaderID, "spotLights[" + std::to_string(i) + "]");
-        spotLights[i].enableSpotLights(programShaderID, i);
-       
     }
+}
 
-    for (int i = 0; i < pointLights.size(); ++i) {
-        lightPos = pointLights[i].getPosition();  // Use actual point light position
-        targetPos = glm::vec3(0.0f, 0.0f, 0.0f);  // Point light points toward scene center
+// Fits the shadows of every shadow casting light and uploads the lights if any of them changed
+void Renderer::renderLightsForObject() {
+    // Shadows are fitted within the part of the view they can fall in: up to the farthest caster
+    // plus twice its size for shadows stretching along the ground
+    glm::vec3 casterMin, casterMax;
+    getCasterBounds(casterMin, casterMax);
+    glm::vec3 cameraPosition = camera.getPosition();
+    glm::vec3 farthestCorner = glm::max(glm::abs(casterMin - cameraPosition), glm::abs(casterMax - cameraPosition));
+    float shadowDistance = glm::min(glm::length(farthestCorner) + glm::length(casterMax - casterMin) * 2.0f, CAMERA_FAR_PLANE);
+    float aspect = viewportHeight > 0 ? (float)viewportWidth / viewportHeight : 1.0f;
 
-        // Update shadow map for point lights if no directional or spot lights are present
-        if (directionalLights.empty() && spotLights.empty() && i == 0) {
-            shadowMap.calculateLightSpaceMatrix(lightPos, targetPos, pointLights[i].getLightType());
-        }
+    if (!directionalLights.empty()) {
+        // Simulate a far-away light source pointing towards the center of the scene (or the object)
+        lightPos = -directionalLights[0].getDirection() * 10.0f;
+        targetPos = glm::vec3(0.0f, 0.0f, 0.0f);
 
-        pointLights[i].sendToShader(programShaderID, "pointLights[" + std::to_string(i) + "]");
-        pointLights[i].enablePointLights(programShaderID, i);
-        
+        // The first directional light gets the cascades
+        shadowMap.fitDirectionalLight(directionalLights[0].getDirection(), casterMin, casterMax, camera.getViewMatrix(),
+            glm::radians(45.0f), aspect, CAMERA_NEAR_PLANE, shadowDistance);
+    }
+    else {
+        shadowMap.disableCascades();
     }
-}
-
-glm::mat4 Renderer::calculateMVP(const glm::mat4& modelMatrix, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix) {
-    return projectionMatrix * viewMatrix * modelMatrix;
-}
 
+    // The other directional lights and the spot lights share the atlas, the most important ones get the largest tiles
+    shadowAtlas.update(directionalLights, spotLights, camera, glm::radians(45.0f), aspect, casterMin, casterMax,
+        CAMERA_NEAR_PLANE, shadowDistance);
 
-void Renderer:: MatrixUniformLocations(GLuint programShaderID)
-{
-    // Get uniform locations for object shader
-    MatrixID = glGetUniformLocation(programShaderID, "MVP");
-    ViewMatrixID = glGetUniformLocation(programShaderID, "V");
-    ModelMatrixID = glGetUniformLocation(programShaderID, "M");
-    LightID = glGetUniformLocation(programShaderID, "LightPosition_worldspace");
-    AmbientLightID = glGetUniformLocation(programShaderID, "AmbientLightIntensity");
-}
+    // Point lights see every direction, each gets a cube map with the faces that see no caster culled
+    pointShadowMap.update(pointLights, casterMin, casterMax);
 
-void Renderer::MatrixPassToShader(const glm::mat4& MVP, const glm::mat4& View, const glm::mat4& Model)
-{
-    // Pass the matrices to the shader for object rendering
-    glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &Model[0][0]);
-    glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &View[0][0]);
+    sceneUniforms.updateLights(directionalLights, ambientLightIntensity);
 }
 
 //---------------------Add and Get For Lights--------------------------------
@@ -375,20 +714,22 @@ void Renderer::setupPointLight() {
 //---------------------Default light setup--------------------------------
 
 void Renderer::cleanup() {
-    if (programShaderID) {
-        glDeleteProgram(programShaderID);
-        programShaderID = 0;
-    }
-
-    if (infiniteGroundShaderID) {
-        glDeleteProgram(infiniteGroundShaderID);
-        infiniteGroundShaderID = 0;
-    }
-
-    if (shadowMapShaderID) {
-        glDeleteProgram(shadowMapShaderID);
-        shadowMapShaderID = 0;
-    }
+    sceneUniforms.cleanup();
+    lightClusters.cleanup();
+    programVariants.cleanup();
+    frameGraph.cleanup();
+    instanceGrid.cleanup();
+    programShader.destroy();
+    infiniteGroundShader.destroy();
+    shadowMapShader.destroy();
+    shadowLayeredShader.destroy();
+    shadowAtlasShader.destroy();
+    shadowAtlasLayeredShader.destroy();
+    pointShadowShader.destroy();
+    shadowMomentsShader.destroy();
+    shadowAtlas.cleanup();
+    pointShadowMap.cleanup();
+    shadowMoments.cleanup();
 }
 
 void Renderer::setModel(const Model& model) {
@@ -397,7 +738,8 @@ void Renderer::setModel(const Model& model) {
 
 void Renderer::setAmbientLightIntensity(const glm::vec3& intensity) {
     ambientLightIntensity = intensity;
-    // Ambient light uniform will be updated in renderModelWithShadows() during rendering
+    // The light block is re-uploaded on the next frame since the ambient intensity changed
+    requestRedraw();
 }
 
 glm::vec3 Renderer::getAmbientLightIntensity() const {
@@ -405,7 +747,12 @@ glm::vec3 Renderer::getAmbientLightIntensity() const {
 }
 
 void Renderer::setAutoRotation(bool enabled) {
+    // Resume from the current angle instead of catching up on the time spent paused
+    if (enabled && !autoRotateModel) {
+        lastRotationTicks = SDL_GetTicks();
+    }
     autoRotateModel = enabled;
+    requestRedraw();
 }
 
 bool Renderer::getAutoRotation() const {
@@ -418,16 +765,250 @@ void Renderer::setRotationSpeed(float speed) {
 
 void Renderer::setShadowsEnabled(bool enabled) {
     shadowsEnabled = enabled;
+    requestRedraw();
+}
+
+void Renderer::setOnDemandRendering(bool enabled) {
+    onDemandRendering = enabled;
+    requestRedraw();
+}
+
+bool Renderer::getOnDemandRendering() const {
+    return onDemandRendering;
+}
+
+void Renderer::requestRedraw() {
+    redrawFrames = REDRAW_FRAMES_AFTER_INPUT;
+}
+
+// Redraw while something animates or streams in, or when the scene changed since the last frame
+bool Renderer::needsRedraw() const {
+    return !onDemandRendering
+        || autoRotateModel
+        || redrawFrames > 0
+        || textureManager.getPendingLoadCount() > 0
+        || sceneVersion() != renderedSceneVersion;
+}
+
+// Combines the versions of everything that casts shadows
+uint64_t Renderer::casterVersion() const {
+    uint64_t version = model.getVersion();
+    for (const InstanceBatch* batch : instanceBatches) {
+        version = version * 31 + batch->getVersion();
+        version = version * 31 + batch->getModel().getVersion();
+    }
+    return version;
+}
+
+// Combines the versions of everything drawn; differs from the last frame's value if anything on screen changed
+uint64_t Renderer::sceneVersion() const {
+    uint64_t version = camera.getVersion();
+    version = version * 31 + model.getVersion();
+    version = version * 31 + textureManager.getResidencyVersion();
+    for (const std::vector<Lights>* lights : { &pointLights, &directionalLights, &spotLights }) {
+        version = version * 31 + lights->size();
+        for (const Lights& light : *lights) {
+            version = version * 31 + light.getVersion();
+        }
+    }
+    for (const InstanceBatch* batch : instanceBatches) {
+        version = version * 31 + batch->getVersion();
+    }
+    return version;
 }
 
 bool Renderer::getShadowsEnabled() const {
     return shadowsEnabled;
 }
 
+void Renderer::setShadowUpdateInterval(int frames) {
+    shadowUpdateInterval = glm::max(frames, 1);
+}
+
+int Renderer::getShadowUpdateInterval() const {
+    return shadowUpdateInterval;
+}
+
+const ShadowMap& Renderer::getShadowMap() const {
+    return shadowMap;
+}
+
+const ShadowAtlas& Renderer::getShadowAtlas() const {
+    return shadowAtlas;
+}
+
+const PointShadowMap& Renderer::getPointShadowMap() const {
+    return pointShadowMap;
+}
+
+const LightClusters& Renderer::getLightClusters() const {
+    return lightClusters;
+}
+
+const DrawLightList& Renderer::getModelLights() const {
+    return modelLights;
+}
+
+const DrawLightList& Renderer::getGroundLights() const {
+    return groundLights;
+}
+
+bool Renderer::isPointShadowsAvailable() const {
+    return pointShadowShader.getID() != 0;
+}
+
+void Renderer::setShadowMapSize(int size) {
+    if (size != shadowMap.getSize()) {
+        shadowMap.resize(size, size);
+        requestRedraw();
+    }
+}
+
+int Renderer::getShadowMapSize() const {
+    return shadowMap.getSize();
+}
+
+void Renderer::setShadowCascadeCount(int count) {
+    shadowMap.setCascadeCount(count);
+    requestRedraw();
+}
+
+int Renderer::getShadowCascadeCount() const {
+    return shadowMap.getCascadeCount();
+}
+
+void Renderer::setCascadeSplitLambda(float lambda) {
+    shadowMap.setSplitLambda(lambda);
+    requestRedraw();
+}
+
+float Renderer::getCascadeSplitLambda() const {
+    return shadowMap.getSplitLambda();
+}
+
+void Renderer::setShadowFilter(ShadowFilter filter) {
+    shadowMap.setFilter(filter);
+    requestRedraw();
+}
+
+ShadowFilter Renderer::getShadowFilter() const {
+    return shadowMap.getFilter();
+}
+
+void Renderer::setShadowBlurRadius(int radius) {
+    shadowMoments.setBlurRadius(radius);
+    requestRedraw();
+}
+
+int Renderer::getShadowBlurRadius() const {
+    return shadowMoments.getBlurRadius();
+}
+
+void Renderer::setLayeredShadows(bool enabled) {
+    layeredShadows = enabled && isLayeredShadowsAvailable();
+    requestRedraw();
+}
+
+bool Renderer::getLayeredShadows() const {
+    return layeredShadows;
+}
+
+void Renderer::setShaderVariants(bool enabled) {
+    shaderVariants = enabled;
+    requestRedraw();
+}
+
+bool Renderer::getShaderVariants() const {
+    return shaderVariants;
+}
+
+size_t Renderer::getShaderVariantCount() const {
+    return programVariants.getVariantCount();
+}
+
+bool Renderer::isLayeredShadowsAvailable() const {
+    return shadowLayeredShader.getID() != 0;
+}
+
+void Renderer::getCasterBounds(glm::vec3& casterMin, glm::vec3& casterMax) const {
+    model.getWorldBounds(model.getModelMatrix(), casterMin, casterMax);
+    for (const InstanceBatch* batch : instanceBatches) {
+        glm::vec3 batchMin, batchMax;
+        if (batch->getWorldBounds(batchMin, batchMax)) {
+            casterMin = glm::min(casterMin, batchMin);
+            casterMax = glm::max(casterMax, batchMax);
+        }
+    }
+}
+
 Window& Renderer::getWindow() {
     return window;
 }
 
+TextureManager& Renderer::getTextureManager() {
+    return textureManager;
+}
+
+SceneUniforms& Renderer::getSceneUniforms() {
+    return sceneUniforms;
+}
+
+const FrameGraph& Renderer::getFrameGraph() const {
+    return frameGraph;
+}
+
+void Renderer::addInstanceBatch(InstanceBatch* batch) {
+    if (std::find(instanceBatches.begin(), instanceBatches.end(), batch) == instanceBatches.end()) {
+        instanceBatches.push_back(batch);
+        requestRedraw();
+    }
+}
+
+void Renderer::removeInstanceBatch(InstanceBatch* batch) {
+    instanceBatches.erase(std::remove(instanceBatches.begin(), instanceBatches.end(), batch), instanceBatches.end());
+    requestRedraw();
+}
+
+// Lays out copies of the model on a square grid around it, each with its own tint
+void Renderer::setInstanceGridSize(int count) {
+    instanceGridSize = glm::max(count, 0);
+
+    glm::vec3 center;
+    float radius;
+    model.getBoundingSphere(center, radius);
+    float spacing = glm::max(radius * 2.5f, 0.1f);
+
+    // One cell more than the copies: the model itself keeps the center cell
+    int side = static_cast<int>(glm::ceil(glm::sqrt(static_cast<float>(instanceGridSize + 1))));
+    std::vector<glm::mat4> transforms;
+    std::vector<glm::vec4> tints;
+    transforms.reserve(instanceGridSize);
+    tints.reserve(instanceGridSize);
+    for (int cell = 0; cell < side * side && static_cast<int>(transforms.size()) < instanceGridSize; ++cell) {
+        int x = cell % side - side / 2;
+        int z = cell / side - side / 2;
+        if (x == 0 && z == 0) {
+            continue;
+        }
+        transforms.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(x * spacing, 0.0f, z * spacing)));
+
+        // Pale tints that tell neighbouring copies apart
+        float hue = glm::fract(cell * 0.618034f) * 6.2831853f;
+        tints.push_back(glm::vec4(0.75f + 0.25f * glm::cos(hue), 0.75f + 0.25f * glm::cos(hue - 2.0944f),
+            0.75f + 0.25f * glm::cos(hue + 2.0944f), 1.0f));
+    }
+    instanceGrid.setInstances(transforms, tints);
+}
+
+int Renderer::getInstanceGridSize() const {
+    return instanceGridSize;
+}
+
+void Renderer::setOverlay(PassFunction draw, void* context) {
+    overlayPass = draw;
+    overlayContext = context;
+}
+
 Camera& Renderer::getCamera() {
     return camera;
 }
\ No newline at end of file
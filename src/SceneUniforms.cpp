@@ -0,0 +1,133 @@
+#include "headers/SceneUniforms.h"
+#include "headers/GLStateCache.h"
+#include "headers/GLDebug.h"
+#include <algorithm>
+#include <cstring>
+
+SceneUniforms::SceneUniforms()
+    : frameUBO(0), lightUBO(0), frameData(), cameraVersion(0), frameUploaded(false),
+    uploadedAmbient(0.0f), lightsUploaded(false), uploadCount(0) {}
+
+SceneUniforms::~SceneUniforms() {
+    cleanup();
+}
+
+void SceneUniforms::init() {
+    glGenBuffers(1, &frameUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlockData), nullptr, GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &lightUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, lightUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlockData), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    GLDebug::setObjectLabel(GL_BUFFER, frameUBO, "FrameBlock");
+    GLDebug::setObjectLabel(GL_BUFFER, lightUBO, "LightBlock");
+
+    // The binding points never change, so the buffers stay attached for the whole run
+    GLStateCache::get().bindBufferBase(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, frameUBO);
+    GLStateCache::get().bindBufferBase(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, lightUBO);
+}
+
+void SceneUniforms::bindProgram(const ShaderProgram& program) {
+    program.bindUniformBlock("FrameBlock", FRAME_BLOCK_BINDING);
+    program.bindUniformBlock("LightBlock", LIGHT_BLOCK_BINDING);
+    program.bindUniformBlock("ShadowAtlasBlock", SHADOW_ATLAS_BLOCK_BINDING);
+    program.bindUniformBlock("PointShadowBlock", POINT_SHADOW_BLOCK_BINDING);
+    program.bindUniformBlock("ClusterBlock", CLUSTER_BLOCK_BINDING);
+}
+
+void SceneUniforms::updateFrame(const Camera& camera, const glm::mat4& projection, const ShadowMap& shadowMap,
+    float shadowBias, bool shadowsEnabled) {
+    FrameBlockData data = frameData;
+
+    // The view matrix is only rebuilt when the camera marked itself changed
+    if (!frameUploaded || camera.getVersion() != cameraVersion) {
+        data.view = camera.getViewMatrix();
+        data.cameraPosition = camera.getPosition();
+    }
+    data.projection = projection;
+    data.cascadeCount = shadowMap.getActiveCascadeCount();
+    data.shadowFilter = static_cast<int>(shadowMap.getFilter());
+    for (int i = 0; i < MAX_SHADOW_CASCADES; ++i) {
+        data.lightSpaceMatrices[i] = i < data.cascadeCount ? shadowMap.getCascadeMatrix(i) : glm::mat4(1.0f);
+        data.cascadeSplits[i] = i < data.cascadeCount ? shadowMap.getCascadeSplit(i) : 0.0f;
+    }
+    data.shadowBias = shadowBias;
+    data.shadowsEnabled = shadowsEnabled ? 1 : 0;
+
+    if (frameUploaded && std::memcmp(&data, &frameData, sizeof(FrameBlockData)) == 0) {
+        return;
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameBlockData), &data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    frameData = data;
+    cameraVersion = camera.getVersion();
+    frameUploaded = true;
+    uploadCount++;
+}
+
+void SceneUniforms::updateLights(const std::vector<Lights>& directionalLights, const glm::vec3& ambientLightIntensity) {
+    std::vector<unsigned int> versions;
+    collectVersions(directionalLights, versions);
+
+    if (lightsUploaded && versions == lightVersions && ambientLightIntensity == uploadedAmbient) {
+        return;
+    }
+
+    if (directionalLights.size() > MAX_LIGHTS) {
+        std::cerr << "Only the first " << MAX_LIGHTS << " directional lights are used" << std::endl;
+    }
+
+    LightBlockData data = {};
+    data.numDirLights = static_cast<int>(std::min<size_t>(directionalLights.size(), MAX_LIGHTS));
+    data.ambientLightIntensity = ambientLightIntensity;
+
+    for (int i = 0; i < data.numDirLights; ++i) {
+        const Lights& light = directionalLights[i];
+        DirectionalLightData& entry = data.dirLights[i];
+        entry.direction = light.getDirection();
+        entry.intensity = light.getIntensity();
+        entry.ambient = light.getAmbientIntensity();
+        entry.specular = light.getSpecularIntensity();
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, lightUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightBlockData), &data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    lightVersions = versions;
+    uploadedAmbient = ambientLightIntensity;
+    lightsUploaded = true;
+    uploadCount++;
+}
+
+unsigned int SceneUniforms::getUploadCount() const {
+    return uploadCount;
+}
+
+void SceneUniforms::cleanup() {
+    if (frameUBO) {
+        GLStateCache::get().forgetBuffer(frameUBO);
+        glDeleteBuffers(1, &frameUBO);
+        frameUBO = 0;
+    }
+    if (lightUBO) {
+        GLStateCache::get().forgetBuffer(lightUBO);
+        glDeleteBuffers(1, &lightUBO);
+        lightUBO = 0;
+    }
+    frameUploaded = false;
+    lightsUploaded = false;
+}
+
+void SceneUniforms::collectVersions(const std::vector<Lights>& lights, std::vector<unsigned int>& versions) {
+    versions.push_back(static_cast<unsigned int>(lights.size()));
+    for (const Lights& light : lights) {
+        versions.push_back(light.getVersion());
+    }
+}
@@ -0,0 +1,117 @@
+#include "headers/ShaderVariants.h"
+#include "headers/SceneUniforms.h"
+#include <iostream>
+#include <algorithm>
+
+ShaderFeatures::ShaderFeatures()
+    : textured(true), instanced(true), shadows(true), shadowFilter(ShadowFilter::NINE_TAPS), directionalLights(0),
+    localLights(LocalLightMode::CLUSTERED) {}
+
+LocalLightMode ShaderFeatures::getLocalLightMode(const DrawLightList& lights) {
+    if (lights.count < 0) {
+        return LocalLightMode::CLUSTERED;
+    }
+    return lights.count == 0 ? LocalLightMode::NONE : LocalLightMode::LIST;
+}
+
+// Bits, low to high: textured, instanced, shadows, shadow filter (3), directional lights (3), local lights (2)
+uint32_t ShaderFeatures::getKey() const {
+    uint32_t filter = shadows ? static_cast<uint32_t>(shadowFilter) : 0u;
+    uint32_t lightCount = static_cast<uint32_t>(glm::clamp(directionalLights, 0, MAX_LIGHTS));
+    return (textured ? 1u : 0u) | (instanced ? 2u : 0u) | (shadows ? 4u : 0u) | (filter << 3) | (lightCount << 6) |
+        (static_cast<uint32_t>(localLights) << 9);
+}
+
+ShaderDefines ShaderFeatures::getDefines() const {
+    ShaderDefines defines;
+    defines.add("TEXTURED", textured ? 1 : 0);
+    defines.add("INSTANCED", instanced ? 1 : 0);
+    defines.add("SHADOWS_ENABLED", shadows ? 1 : 0);
+    defines.add("SHADOW_FILTER", shadows ? static_cast<int>(shadowFilter) : 0);
+    defines.add("DIR_LIGHT_COUNT", glm::clamp(directionalLights, 0, MAX_LIGHTS));
+    defines.add("LOCAL_LIGHTS", static_cast<int>(localLights));
+    return defines;
+}
+
+ShaderVariants::ShaderVariants()
+    : setup(nullptr), release(nullptr), setupContext(nullptr), lastKey(0xFFFFFFFFu), lastHandle(-1) {}
+
+ShaderVariants::~ShaderVariants() {
+    cleanup();
+}
+
+void ShaderVariants::init(const char* vertexPath, const char* fragmentPath, VariantSetupFunction setup,
+    VariantReleaseFunction release, void* context) {
+    cleanup();
+    this->vertexPath = vertexPath;
+    this->fragmentPath = fragmentPath;
+    this->setup = setup;
+    this->release = release;
+    setupContext = context;
+}
+
+int ShaderVariants::findVariant(const ShaderFeatures& features) {
+    uint32_t key = features.getKey();
+    if (key == lastKey) {
+        return lastHandle;
+    }
+
+    auto it = variants.find(key);
+    if (it == variants.end()) {
+        bool queued = std::any_of(requested.begin(), requested.end(), [key](const ShaderFeatures& request) {
+            return request.getKey() == key;
+        });
+        if (!queued) {
+            requested.push_back(features);
+        }
+    }
+
+    lastKey = key;
+    lastHandle = it != variants.end() ? it->second.handle : -1;
+    return lastHandle;
+}
+
+void ShaderVariants::compileRequested() {
+    for (const ShaderFeatures& features : requested) {
+        uint32_t key = features.getKey();
+        if (variants.count(key) != 0) {
+            continue;
+        }
+
+        Variant variant;
+        variant.program.reset(new ShaderProgram(LoadShaders(vertexPath.c_str(), fragmentPath.c_str(), features.getDefines())));
+        variant.handle = -1;
+        if (variant.program->getID() == 0) {
+            std::cerr << "Failed to compile shader variant " << key << " of " << fragmentPath << std::endl;
+        }
+        else if (setup) {
+            variant.handle = setup(*variant.program, setupContext);
+        }
+        variants.emplace(key, std::move(variant));
+    }
+
+    // The last lookup may have been one of the queued variants
+    if (!requested.empty()) {
+        requested.clear();
+        lastKey = 0xFFFFFFFFu;
+        lastHandle = -1;
+    }
+}
+
+size_t ShaderVariants::getVariantCount() const {
+    return variants.size();
+}
+
+void ShaderVariants::cleanup() {
+    if (release) {
+        for (auto& entry : variants) {
+            if (entry.second.handle >= 0) {
+                release(*entry.second.program, setupContext);
+            }
+        }
+    }
+    variants.clear();
+    requested.clear();
+    lastKey = 0xFFFFFFFFu;
+    lastHandle = -1;
+}
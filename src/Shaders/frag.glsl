@@ -1,66 +1,279 @@
 #version 410 core
 
-// Define the maximum number of directional and spotlights
+// Directional lights and shadowed lights of each type (must match MAX_LIGHTS in SceneUniforms.h)
 #define MAX_LIGHTS 4
 
+// Material buffer limits (must match Model.h)
+#define MAX_MATERIALS 256
+#define MAX_TEXTURE_ARRAYS 4
+
 in vec3 Position_worldspace;
 in vec3 Normal_cameraspace;
 in vec3 EyeDirection_cameraspace;
 in vec2 UV;
-in vec4 FragPosLightSpace;  // Position in light space for shadow mapping
+flat in int MaterialIndex;  // Material of the current draw
+flat in vec4 Tint;          // Per-instance tint, white when not instanced
 
 struct Material {
-    vec3 AmbientColor;
     vec3 DiffuseColor;
     vec3 SpecularColor;
     float Shininess;
-    sampler2D diffuseTexture;
-    sampler2D specularTexture;
+};
+
+// One entry of the material buffer
+struct MaterialEntry {
+    vec4 DiffuseColor;   // rgb, w unused
+    vec4 SpecularColor;  // rgb + shininess in w
+    ivec4 Texture;       // x = texture array slot (-1 = no texture), y = layer
+};
+
+layout(std140) uniform MaterialBlock {
+    MaterialEntry materials[MAX_MATERIALS];
 };
 
 struct DirectionalLight {
     vec3 Direction;
     vec3 Intensity;  // Light intensity (used for diffuse and specular calculations)
     vec3 Ambient;    // Ambient light color
+    vec3 Specular;
 };
 
-struct SpotLight {
+// Spot or point light of the clusters; point lights ignore the cone
+struct LocalLight {
     vec3 Position;
-    vec3 Direction;
-    vec3 Intensity;
-    vec3 Ambient;
     float CutOff;
+    vec3 Direction;
     float OuterCutOff;
+    vec3 Intensity;
     float Constant;
+    vec3 Ambient;
     float Linear;
+    vec3 Specular;
     float Quadratic;
+    int Type;         // LOCAL_LIGHT_*
+    int ShadowIndex;  // Spot light's atlas slot or point light's cube map, -1 if unshadowed
 };
 
-uniform Material material;
-uniform DirectionalLight dirLights[MAX_LIGHTS]; // Array for multiple directional lights
-uniform SpotLight spotLights[MAX_LIGHTS];       // Array for multiple spotlights
-uniform int numDirLights;                       // Number of active directional lights
-uniform int numSpotLights;                      // Number of active spotlights
+// Lights shared by the model and ground programs (must match LightBlockData in SceneUniforms.h)
+layout(std140) uniform LightBlock {
+    DirectionalLight dirLights[MAX_LIGHTS];  // Array for multiple directional lights
+    vec3 AmbientLightIntensity;              // Global ambient light
+    int numDirLights;                        // Number of active directional lights
+};
 
-uniform vec3 AmbientLightIntensity;
+// Shadow cascade limit (must match MAX_SHADOW_CASCADES in ShadowMap.h)
+#define MAX_SHADOW_CASCADES 4
+
+// Per-frame data shared by every program (must match FrameBlockData in SceneUniforms.h)
+layout(std140) uniform FrameBlock {
+    mat4 V;                                          // View matrix (camera view)
+    mat4 P;                                          // Projection matrix
+    mat4 lightSpaceMatrices[MAX_SHADOW_CASCADES];    // Light's view-projection matrix of each shadow cascade
+    vec4 cascadeSplits;                              // View depth where each cascade ends
+    vec3 cameraPosition;                             // Camera position in world space
+    float shadowBias;                                // Bias to avoid shadow acne
+    int shadowsEnabled;                              // Flag to enable/disable shadows
+    int cascadeCount;                                // Cascades in use
+    int shadowFilter;                                // Shadow map filter kernel (SHADOW_FILTER_*)
+};
 
-uniform bool useSpotLight[MAX_LIGHTS];           // Toggle for each spotlight
-uniform bool useDirectionalLight[MAX_LIGHTS];    // Toggle for each directional light
-uniform bool useTexture;                         // Check if we should use the texture
+// Shadow atlas tile limit (must match MAX_SHADOW_TILES in ShadowAtlas.h)
+#define MAX_SHADOW_TILES 8
 
-uniform sampler2D shadowMap;   // Shadow map texture
-uniform float shadowBias;      // Bias to avoid shadow acne
-uniform bool shadowsEnabled;   // Flag to enable/disable shadows
+// Tiles of the shadow atlas (must match ShadowAtlasBlockData in ShadowAtlas.h)
+layout(std140) uniform ShadowAtlasBlock {
+    mat4 tileMatrices[MAX_SHADOW_TILES];  // Light-space matrix of each tile
+    vec4 tileRects[MAX_SHADOW_TILES];     // Offset (xy) and size (zw) of each tile in atlas texture coordinates
+    ivec4 lightTiles[MAX_LIGHTS];         // Tile of directional light i (x) and spot light i (y), -1 if unshadowed
+    int tileCount;                        // Tiles in use
+};
+
+// Cube shadows of the point lights (must match PointShadowBlockData in PointShadowMap.h)
+layout(std140) uniform PointShadowBlock {
+    mat4 faceMatrices[MAX_LIGHTS * 6];  // View-projection of each cube face, six per light
+    vec4 lightPositions[MAX_LIGHTS];    // World position (xyz) and shadow range (w, 0 if unshadowed)
+    ivec4 faceMasks;                    // Faces of light i that see a caster, bit per face
+    int shadowCount;                    // Point lights with a cube map
+};
+
+// Spot and point lights, binned into clusters on the CPU (must match LightClusters.h)
+#define LOCAL_LIGHT_TEXELS 6
+#define LOCAL_LIGHT_POINT 0
+#define LOCAL_LIGHT_SPOT 1
+
+// Froxel grid of the frame (must match ClusterBlockData in LightClusters.h)
+layout(std140) uniform ClusterBlock {
+    vec4 clusterScale;  // Clusters per pixel (xy), slices per log view depth (z) and slice offset (w)
+    ivec4 clusterGrid;  // Clusters along x, y and z (xyz) and local lights (w)
+    vec4 localAmbient;  // Sum of the local lights' ambient colors (rgb)
+};
+
+uniform sampler2DArray diffuseTextures[MAX_TEXTURE_ARRAYS];  // Material texture arrays
+uniform sampler2DArrayShadow shadowMap;   // Shadow map, one layer per cascade
+uniform sampler2DShadow shadowAtlas;  // Shadow atlas, one tile per shadowed light besides the cascaded one
+uniform samplerCubeArrayShadow pointShadowMaps;  // Point light shadows, one cube per light
+uniform sampler2DArray shadowMoments;  // Blurred EVSM moments of the shadow map, one layer per cascade
+uniform samplerBuffer localLights;      // LOCAL_LIGHT_TEXELS texels per spot or point light
+uniform usamplerBuffer clusterRanges;   // First index (x) and light count (y) of each cluster
+uniform usamplerBuffer clusterIndices;  // Lights of every cluster, one list after another
+
+// Lights that reach the draw, or -1 when more do and the fragment's cluster lists them (must match LightClusters.h)
+#define MAX_DRAW_LIGHTS 16
+uniform int drawLightCount;
+uniform int drawLights[MAX_DRAW_LIGHTS];
 
 out vec4 color;
 
+// Shadow filter kernels (must match ShadowFilter in ShadowMap.h)
+#define SHADOW_FILTER_SINGLE_TAP 0
+#define SHADOW_FILTER_FOUR_TAPS 1
+#define SHADOW_FILTER_NINE_TAPS 2
+#define SHADOW_FILTER_POISSON 3
+#define SHADOW_FILTER_EVSM 4
+
+// Where the spot and point lights of a draw come from (0 to 2 must match LocalLightMode in ShaderVariants.h)
+#define LOCAL_LIGHTS_NONE 0       // No spot or point light reaches the draw
+#define LOCAL_LIGHTS_LIST 1       // The draw's own list
+#define LOCAL_LIGHTS_CLUSTERED 2  // The fragment's cluster
+#define LOCAL_LIGHTS_ANY 3        // Chosen at run time by drawLightCount
+
+// Features a program variant fixes at compile time (see ShaderFeatures in ShaderVariants.h); a program
+// loaded without them reads each one at run time from its uniform
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+#ifndef SHADOWS_ENABLED
+#define SHADOWS_ENABLED shadowsEnabled
+#endif
+#ifndef SHADOW_FILTER
+#define SHADOW_FILTER shadowFilter
+#endif
+#ifndef DIR_LIGHT_COUNT
+#define DIR_LIGHT_COUNT numDirLights
+#endif
+#ifndef LOCAL_LIGHTS
+#define LOCAL_LIGHTS LOCAL_LIGHTS_ANY
+#endif
+#if LOCAL_LIGHTS == LOCAL_LIGHTS_ANY
+#define DRAW_LIGHT_LIST (drawLightCount >= 0)
+#else
+#define DRAW_LIGHT_LIST (LOCAL_LIGHTS == LOCAL_LIGHTS_LIST)
+#endif
+
+// Exponential warps of the moments (must match shadowMomentsFrag.glsl) and the part of the Chebyshev bound
+// cut off against light bleeding
+#define EVSM_POSITIVE_EXPONENT 40.0
+#define EVSM_NEGATIVE_EXPONENT 5.0
+#define EVSM_LIGHT_BLEEDING 0.2
+
+// Taps of the Poisson filter, within the unit disk
+const vec2 poissonDisk[8] = vec2[](
+    vec2(-0.94201624, -0.39906216), vec2(0.94558609, -0.76890725), vec2(-0.09418410, -0.92938870), vec2(0.34495938, 0.29387760),
+    vec2(-0.91588581, 0.45771432), vec2(-0.81544232, -0.87912464), vec2(-0.38277543, 0.27676845), vec2(0.97484398, 0.75648379)
+);
+
+// Taps of the selected filter kernel
+int shadowTapCount() {
+    if (SHADOW_FILTER == SHADOW_FILTER_SINGLE_TAP) {
+        return 1;
+    }
+    // The moments only exist for the cascades, the atlas and the cube maps use four taps with EVSM
+    if (SHADOW_FILTER == SHADOW_FILTER_FOUR_TAPS || SHADOW_FILTER == SHADOW_FILTER_EVSM) {
+        return 4;
+    }
+    return SHADOW_FILTER == SHADOW_FILTER_NINE_TAPS ? 9 : 8;
+}
+
+// Rotation of the Poisson disk, per pixel so the pattern turns into fine noise instead of banding
+mat2 shadowTapRotation() {
+    float angle = 6.2831853 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+    return mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+}
+
+// Offset of a tap in texels
+vec2 shadowTapOffset(int tap, mat2 rotation) {
+    if (SHADOW_FILTER == SHADOW_FILTER_SINGLE_TAP) {
+        return vec2(0.0);
+    }
+    if (SHADOW_FILTER == SHADOW_FILTER_FOUR_TAPS || SHADOW_FILTER == SHADOW_FILTER_EVSM) {
+        return (vec2(tap % 2, tap / 2) - 0.5) * 2.0;
+    }
+    if (SHADOW_FILTER == SHADOW_FILTER_NINE_TAPS) {
+        return vec2(tap % 3 - 1, tap / 3 - 1);
+    }
+    return rotation * poissonDisk[tap] * 1.5;
+}
+
+// Fraction of the light reaching the fragment. Each texture() call on the shadow sampler is a hardware
+// depth comparison of the four nearest texels, filtered bilinearly, so one tap already gives 2x2 PCF
+float sampleShadowMap(vec2 uv, int cascade, float referenceDepth) {
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    mat2 rotation = shadowTapRotation();
+    int taps = shadowTapCount();
+    float lit = 0.0;
+    for (int i = 0; i < taps; ++i) {
+        lit += texture(shadowMap, vec4(uv + shadowTapOffset(i, rotation) * texelSize, cascade, referenceDepth));
+    }
+    return lit / float(taps);
+}
+
+// Chebyshev upper bound of the lit fraction from the mean and mean square of a warped depth, with the
+// tail below EVSM_LIGHT_BLEEDING cut off so overlapping casters don't leak light
+float chebyshevUpperBound(vec2 moments, float warpedDepth, float minVariance) {
+    if (warpedDepth <= moments.x) {
+        return 1.0;
+    }
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float delta = warpedDepth - moments.x;
+    float pMax = variance / (variance + delta * delta);
+    return clamp((pMax - EVSM_LIGHT_BLEEDING) / (1.0 - EVSM_LIGHT_BLEEDING), 0.0, 1.0);
+}
+
+// Lit fraction from the blurred moments (EVSM filter): one trilinear fetch, the tighter of the bounds of the
+// positive and the negative warp
+float sampleShadowMoments(vec2 uv, int cascade, float depth) {
+    vec4 moments = texture(shadowMoments, vec3(uv, cascade));
+    float warped = 2.0 * depth - 1.0;
+    float positive = exp(EVSM_POSITIVE_EXPONENT * warped);
+    float negative = -exp(-EVSM_NEGATIVE_EXPONENT * warped);
+
+    // The variance floor scales with the derivative of each warp, so both bounds stay equally sharp
+    float positiveVariance = 0.0001 * EVSM_POSITIVE_EXPONENT * positive;
+    float negativeVariance = 0.0001 * EVSM_NEGATIVE_EXPONENT * negative;
+    return min(chebyshevUpperBound(moments.xy, positive, positiveVariance * positiveVariance),
+        chebyshevUpperBound(moments.zw, negative, negativeVariance * negativeVariance));
+}
+
+// The same kernel in one tile of the atlas; the taps are clamped to the tile so they never read its neighbours
+float sampleShadowAtlas(vec2 uv, int tile, float referenceDepth) {
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowAtlas, 0));
+    vec2 tileMin = tileRects[tile].xy + texelSize * 0.5;
+    vec2 tileMax = tileRects[tile].xy + tileRects[tile].zw - texelSize * 0.5;
+    vec2 atlasUV = tileRects[tile].xy + uv * tileRects[tile].zw;
+    mat2 rotation = shadowTapRotation();
+    int taps = shadowTapCount();
+    float lit = 0.0;
+    for (int i = 0; i < taps; ++i) {
+        vec2 tapUV = clamp(atlasUV + shadowTapOffset(i, rotation) * texelSize, tileMin, tileMax);
+        lit += texture(shadowAtlas, vec3(tapUV, referenceDepth));
+    }
+    return lit / float(taps);
+}
+
 // Function to calculate shadow factor with PCF (Percentage Closer Filtering)
-float calculateShadow(vec4 fragPosLightSpace) {
+float calculateShadow(vec3 fragPos, float viewDepth) {
     // If shadows are disabled, return no shadow
-    if (!shadowsEnabled) {
+    if (SHADOWS_ENABLED == 0 || cascadeCount == 0) {
         return 0.0;
     }
 
+    // Pick the first cascade reaching past the fragment, the last one covers the rest
+    int cascade = 0;
+    while (cascade < cascadeCount - 1 && viewDepth > cascadeSplits[cascade]) {
+        cascade++;
+    }
+    vec4 fragPosLightSpace = lightSpaceMatrices[cascade] * vec4(fragPos, 1.0);
+
     // Perform perspective division (from clip space to NDC)
     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
 
@@ -83,18 +296,10 @@ float calculateShadow(vec4 fragPosLightSpace) {
     // Calculate bias to prevent shadow acne - higher bias for surfaces facing away from light
     float bias = max(shadowBias * (1.0 - dot(normal, lightDir)), shadowBias * 0.1);
     
-    // PCF (Percentage Closer Filtering) for soft shadows
-    float shadow = 0.0;
-    vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
-    
-    // Sample a 3x3 grid around the current texel
-    for(int x = -1; x <= 1; ++x) {
-        for(int y = -1; y <= 1; ++y) {
-            float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r;
-            shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
-        }    
-    }
-    shadow /= 9.0; // Average the 9 samples
+    // PCF (Percentage Closer Filtering) for soft shadows with the selected kernel, or one fetch of the prefiltered moments
+    float lit = SHADOW_FILTER == SHADOW_FILTER_EVSM ? sampleShadowMoments(projCoords.xy, cascade, currentDepth - bias)
+        : sampleShadowMap(projCoords.xy, cascade, currentDepth - bias);
+    float shadow = 1.0 - lit;
     
     // Additional bias for surfaces nearly parallel to light (prevent self-shadowing)
     float surfaceAngle = dot(normal, lightDir);
@@ -105,8 +310,100 @@ float calculateShadow(vec4 fragPosLightSpace) {
     return shadow;
 }
 
+// Shadow of a light with a tile in the atlas. The reference point is moved towards the light by offset
+// (world units) instead of biasing the depth, which the perspective of spot light tiles makes non-linear
+float calculateAtlasShadow(int tile, vec3 fragPos, vec3 toLight, float offset) {
+    if (SHADOWS_ENABLED == 0 || tile < 0) {
+        return 0.0;
+    }
+
+    vec4 fragPosLightSpace = tileMatrices[tile] * vec4(fragPos + toLight * offset, 1.0);
+    if (fragPosLightSpace.w <= 0.0) {
+        return 0.0;
+    }
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+
+    // Outside the tile's frustum nothing casts a shadow
+    if (projCoords.z > 1.0 || projCoords.x < 0.0 || projCoords.y < 0.0 || projCoords.x > 1.0 || projCoords.y > 1.0) {
+        return 0.0;
+    }
+    return 1.0 - sampleShadowAtlas(projCoords.xy, tile, projCoords.z);
+}
+
+// Shadow of a point light from its cube map. The cube stores the distance to the light over its range,
+// the taps of the filter kernel are spread across the face around the direction to the fragment
+float calculatePointShadow(int light, vec3 fragPos) {
+    if (SHADOWS_ENABLED == 0 || light >= shadowCount || lightPositions[light].w <= 0.0) {
+        return 0.0;
+    }
+
+    vec3 toFragment = fragPos - lightPositions[light].xyz;
+    float distance = length(toFragment);
+    float referenceDepth = distance * (1.0 - shadowBias) / lightPositions[light].w;
+    if (referenceDepth > 1.0) {
+        return 0.0;
+    }
+
+    // Two axes across the face, scaled to one texel at the fragment's distance
+    vec3 direction = toFragment / distance;
+    vec3 tangent = normalize(cross(direction, abs(direction.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)));
+    vec3 bitangent = cross(direction, tangent);
+    float texelSize = 2.0 / float(textureSize(pointShadowMaps, 0).x);
+    mat2 rotation = shadowTapRotation();
+    int taps = shadowTapCount();
+    float lit = 0.0;
+    for (int i = 0; i < taps; ++i) {
+        vec2 offset = shadowTapOffset(i, rotation) * texelSize;
+        vec3 tapDirection = direction + tangent * offset.x + bitangent * offset.y;
+        lit += texture(pointShadowMaps, vec4(tapDirection, light), referenceDepth);
+    }
+    return 1.0 - lit / float(taps);
+}
+
+// Reads a spot or point light from the buffer texture (see LocalLightData)
+LocalLight fetchLocalLight(int index) {
+    int texel = index * LOCAL_LIGHT_TEXELS;
+    vec4 positionRange = texelFetch(localLights, texel);
+    vec4 directionCutOff = texelFetch(localLights, texel + 1);
+    vec4 intensityOuterCutOff = texelFetch(localLights, texel + 2);
+    vec4 ambientConstant = texelFetch(localLights, texel + 3);
+    vec4 specularLinear = texelFetch(localLights, texel + 4);
+    vec4 quadraticTypeShadow = texelFetch(localLights, texel + 5);
+
+    LocalLight light;
+    light.Position = positionRange.xyz;
+    light.CutOff = directionCutOff.w;
+    light.Direction = directionCutOff.xyz;
+    light.OuterCutOff = intensityOuterCutOff.w;
+    light.Intensity = intensityOuterCutOff.rgb;
+    light.Constant = ambientConstant.w;
+    light.Ambient = ambientConstant.rgb;
+    light.Linear = specularLinear.w;
+    light.Specular = specularLinear.rgb;
+    light.Quadratic = quadraticTypeShadow.x;
+    light.Type = int(quadraticTypeShadow.y);
+    light.ShadowIndex = int(quadraticTypeShadow.z);
+    return light;
+}
+
+// Lights of the fragment: the draw's own list, or first index (x) and count (y) in clusterIndices of its cluster
+uvec2 fragmentLights(float viewDepth) {
+    if (DRAW_LIGHT_LIST) {
+        return uvec2(0u, uint(drawLightCount));
+    }
+    ivec3 cell = ivec3(ivec2(gl_FragCoord.xy * clusterScale.xy),
+        int(floor(log(max(viewDepth, 1e-4)) * clusterScale.z + clusterScale.w)));
+    cell = clamp(cell, ivec3(0), clusterGrid.xyz - 1);
+    return texelFetch(clusterRanges, (cell.z * clusterGrid.y + cell.y) * clusterGrid.x + cell.x).xy;
+}
+
+// Index of the i-th light of fragmentLights() in localLights
+int fragmentLight(uvec2 lights, uint i) {
+    return DRAW_LIGHT_LIST ? drawLights[i] : int(texelFetch(clusterIndices, int(lights.x + i)).x);
+}
+
 // Function to calculate directional light contribution
-vec3 calcDirLight(DirectionalLight light, vec3 normal, vec3 viewDir, vec3 MaterialDiffuseColor, float shadow) {
+vec3 calcDirLight(DirectionalLight light, Material material, vec3 normal, vec3 viewDir, vec3 MaterialDiffuseColor, float shadow) {
     vec3 lightDir = normalize(-light.Direction);
 
     // Diffuse shading
@@ -129,7 +426,7 @@ vec3 calcDirLight(DirectionalLight light, vec3 normal, vec3 viewDir, vec3 Materi
 }
 
 // Function to calculate spotlight contribution
-vec3 calcSpotLight(SpotLight light, vec3 normal, vec3 viewDir, vec3 fragPos, vec3 MaterialDiffuseColor, float shadow) {
+vec3 calcSpotLight(LocalLight light, Material material, vec3 normal, vec3 viewDir, vec3 fragPos, vec3 MaterialDiffuseColor, float shadow) {
     vec3 toLight = normalize(light.Position - fragPos);
     float theta = dot(toLight, normalize(-light.Direction));
 
@@ -137,9 +434,6 @@ vec3 calcSpotLight(SpotLight light, vec3 normal, vec3 viewDir, vec3 fragPos, vec
     float epsilon = light.CutOff - light.OuterCutOff;
     float intensity = clamp((theta - light.OuterCutOff) / epsilon, 0.0, 1.0);
 
-    // Ambient shading
-    vec3 ambient = light.Ambient * MaterialDiffuseColor;
-
     // Attenuation based on distance
     float distance = length(light.Position - fragPos);
     float attenuation = 1.0 / (light.Constant + light.Linear * distance + light.Quadratic * (distance * distance));
@@ -157,8 +451,32 @@ vec3 calcSpotLight(SpotLight light, vec3 normal, vec3 viewDir, vec3 fragPos, vec
     diffuse *= (1.0 - shadow);
     specular *= (1.0 - shadow);
 
-    // Combine diffuse and specular
-    return ambient + diffuse + specular;
+    // Combine diffuse and specular, the ambient of every local light is added once in main()
+    return diffuse + specular;
+}
+
+// Function to calculate point light contribution
+vec3 calcPointLight(LocalLight light, Material material, vec3 normal, vec3 viewDir, vec3 fragPos, vec3 MaterialDiffuseColor, float shadow) {
+    vec3 toLight = normalize(light.Position - fragPos);
+
+    // Attenuation based on distance
+    float distance = length(light.Position - fragPos);
+    float attenuation = 1.0 / (light.Constant + light.Linear * distance + light.Quadratic * (distance * distance));
+
+    // Diffuse lighting
+    float cosTheta = max(dot(normal, toLight), 0.0);
+    vec3 diffuse = light.Intensity * MaterialDiffuseColor * cosTheta * attenuation;
+
+    // Specular reflection (Phong reflection model)
+    vec3 reflectDir = reflect(-toLight, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.Shininess);
+    vec3 specular = light.Intensity * spec * material.SpecularColor * attenuation;
+
+    // Apply shadow to diffuse and specular
+    diffuse *= (1.0 - shadow);
+    specular *= (1.0 - shadow);
+
+    return diffuse + specular;
 }
 
 void main() {
@@ -173,33 +491,53 @@ void main() {
     // Initialize the final color
     vec3 finalColor = vec3(0.0);
 
+    // Fetch the current material from the material buffer
+    MaterialEntry entry = materials[MaterialIndex];
+    Material material;
+    material.DiffuseColor = entry.DiffuseColor.rgb;
+    material.SpecularColor = entry.SpecularColor.rgb;
+    material.Shininess = entry.SpecularColor.w;
+
     // Use the diffuse texture if available, otherwise fallback to the diffuse color
-    if (useTexture) {
-        MaterialDiffuseColor = texture(material.diffuseTexture, UV).rgb;
+    MaterialDiffuseColor = material.DiffuseColor;
+#if TEXTURED
+    if (entry.Texture.x >= 0) {
+        MaterialDiffuseColor = texture(diffuseTextures[entry.Texture.x], vec3(UV, entry.Texture.y)).rgb;
         MaterialDiffuseColor = pow(MaterialDiffuseColor, vec3(2.2));  // Gamma correction for sRGB textures
-    } else {
-        MaterialDiffuseColor = material.DiffuseColor;  // Fallback to diffuse color
     }
+#endif
+    MaterialDiffuseColor *= Tint.rgb;
 
-    // Calculate shadow factor using the light space position
-    float shadow = calculateShadow(FragPosLightSpace);
+    // Calculate shadow factor from the cascade covering the fragment (first directional light)
+    float cascadeShadow = calculateShadow(Position_worldspace, EyeDirection_cameraspace.z);
 
-    // Apply directional lights if enabled
-    for (int i = 0; i < numDirLights; ++i) {
-        if (useDirectionalLight[i]) {
-            finalColor += calcDirLight(dirLights[i], normal, viewDir, MaterialDiffuseColor, shadow);
-        }
+    // Apply directional lights, the others are shadowed by their atlas tile
+    for (int i = 0; i < DIR_LIGHT_COUNT; ++i) {
+        float shadow = i == 0 ? cascadeShadow :
+            calculateAtlasShadow(lightTiles[i].x, Position_worldspace, normalize(-dirLights[i].Direction), shadowBias * 10.0);
+        finalColor += calcDirLight(dirLights[i], material, normal, viewDir, MaterialDiffuseColor, shadow);
     }
 
-    // Apply spotlights if enabled
-    for (int i = 0; i < numSpotLights; ++i) {
-        if (useSpotLight[i]) {
-            finalColor += calcSpotLight(spotLights[i], normal, viewDir, Position_worldspace, MaterialDiffuseColor, shadow);
+    // Apply the spot and point lights that reach the draw or the fragment's cluster, shadowed by their atlas tile or cube map
+#if LOCAL_LIGHTS != LOCAL_LIGHTS_NONE
+    uvec2 lights = fragmentLights(EyeDirection_cameraspace.z);
+    for (uint i = 0u; i < lights.y; ++i) {
+        LocalLight light = fetchLocalLight(fragmentLight(lights, i));
+        if (light.Type == LOCAL_LIGHT_SPOT) {
+            vec3 toLight = light.Position - Position_worldspace;
+            float shadow = light.ShadowIndex < 0 ? 0.0 : calculateAtlasShadow(lightTiles[light.ShadowIndex].y,
+                Position_worldspace, normalize(toLight), shadowBias * length(toLight));
+            finalColor += calcSpotLight(light, material, normal, viewDir, Position_worldspace, MaterialDiffuseColor, shadow);
+        }
+        else {
+            float shadow = light.ShadowIndex < 0 ? 0.0 : calculatePointShadow(light.ShadowIndex, Position_worldspace);
+            finalColor += calcPointLight(light, material, normal, viewDir, Position_worldspace, MaterialDiffuseColor, shadow);
         }
     }
+#endif
 
-    // Ambient lighting from the global ambient intensity
-    vec3 MaterialAmbientColor = AmbientLightIntensity * MaterialDiffuseColor;
+    // Ambient lighting from the global ambient intensity and the local lights
+    vec3 MaterialAmbientColor = (AmbientLightIntensity + localAmbient.rgb) * MaterialDiffuseColor;
 
     // Combine with ambient light
     finalColor += MaterialAmbientColor;
@@ -5,12 +5,24 @@ layout(location = 1) in vec3 vertexNormal_modelspace;
 
 out vec3 FragPos_worldspace;   // World space position for lighting
 out vec3 Normal_cameraspace;   // Normal in camera space for lighting
-out vec4 FragPosLightSpace;    // Position in light space for shadow mapping
 
-uniform mat4 MVP;              // Model-View-Projection matrix (camera)
+// Shadow cascade limit (must match MAX_SHADOW_CASCADES in ShadowMap.h)
+#define MAX_SHADOW_CASCADES 4
+
+// Per-frame data shared by every program (must match FrameBlockData in SceneUniforms.h)
+layout(std140) uniform FrameBlock {
+    mat4 V;                                          // View matrix (camera view)
+    mat4 P;                                          // Projection matrix
+    mat4 lightSpaceMatrices[MAX_SHADOW_CASCADES];    // Light's view-projection matrix of each shadow cascade
+    vec4 cascadeSplits;                              // View depth where each cascade ends
+    vec3 cameraPosition;                             // Camera position in world space
+    float shadowBias;                                // Bias to avoid shadow acne
+    int shadowsEnabled;                              // Flag to enable/disable shadows
+    int cascadeCount;                                // Cascades in use
+    int shadowFilter;                                // Shadow map filter kernel (SHADOW_FILTER_*)
+};
+
 uniform mat4 M;                // Model matrix (world transformation)
-uniform mat4 V;                // View matrix (camera view)
-uniform mat4 lightSpaceMatrix; // Light's view-projection matrix (for shadow mapping)
 
 void main() {
     // Calculate world space position
@@ -19,9 +31,6 @@ void main() {
     // Transform the normal to camera space
     Normal_cameraspace = mat3(transpose(inverse(M))) * vertexNormal_modelspace;
 
-    // Calculate the position in light space for shadow mapping
-    FragPosLightSpace = lightSpaceMatrix * M * vec4(vertexPosition_modelspace, 1.0);
-
     // Final position in camera space
-    gl_Position = MVP * vec4(vertexPosition_modelspace, 1.0);
+    gl_Position = P * V * vec4(FragPos_worldspace, 1.0);
 }
@@ -0,0 +1,23 @@
+#version 410 core
+
+// Maximum number of lights
+#define MAX_LIGHTS 4
+
+// Cube shadows of the point lights (must match PointShadowBlockData in PointShadowMap.h)
+layout(std140) uniform PointShadowBlock {
+    mat4 faceMatrices[MAX_LIGHTS * 6];  // View-projection of each cube face, six per light
+    vec4 lightPositions[MAX_LIGHTS];    // World position (xyz) and shadow range (w, 0 if unshadowed)
+    ivec4 faceMasks;                    // Faces of light i that see a caster, bit per face
+    int shadowCount;                    // Point lights with a cube map
+};
+
+uniform int pointLightIndex;  // Light this pass renders
+
+in vec3 Position_worldspace;
+
+void main()
+{
+    // Distance to the light over its range, so the lighting pass compares linear distances
+    vec4 light = lightPositions[pointLightIndex];
+    gl_FragDepth = length(Position_worldspace - light.xyz) / light.w;
+}
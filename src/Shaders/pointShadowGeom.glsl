@@ -0,0 +1,53 @@
+#version 410 core
+
+// Maximum number of lights
+#define MAX_LIGHTS 4
+
+// Cube shadows of the point lights (must match PointShadowBlockData in PointShadowMap.h)
+layout(std140) uniform PointShadowBlock {
+    mat4 faceMatrices[MAX_LIGHTS * 6];  // View-projection of each cube face, six per light
+    vec4 lightPositions[MAX_LIGHTS];    // World position (xyz) and shadow range (w, 0 if unshadowed)
+    ivec4 faceMasks;                    // Faces of light i that see a caster, bit per face
+    int shadowCount;                    // Point lights with a cube map
+};
+
+uniform int pointLightIndex;  // Light this pass renders
+
+// One invocation per cube face, each writing the triangle into its layer of the cube map array
+layout(triangles, invocations = 6) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+out vec3 Position_worldspace;
+
+void main()
+{
+    // Faces that see no caster are skipped
+    if ((faceMasks[pointLightIndex] & (1 << gl_InvocationID)) == 0) {
+        return;
+    }
+
+    int face = pointLightIndex * 6 + gl_InvocationID;
+    vec4 clipPositions[3];
+    for (int i = 0; i < 3; ++i) {
+        clipPositions[i] = faceMatrices[face] * gl_in[i].gl_Position;
+    }
+
+    // Skip triangles entirely outside one of the face's frustum planes
+    for (int axis = 0; axis < 3; ++axis) {
+        bvec3 below = bvec3(clipPositions[0][axis] < -clipPositions[0].w, clipPositions[1][axis] < -clipPositions[1].w,
+            clipPositions[2][axis] < -clipPositions[2].w);
+        bvec3 above = bvec3(clipPositions[0][axis] > clipPositions[0].w, clipPositions[1][axis] > clipPositions[1].w,
+            clipPositions[2][axis] > clipPositions[2].w);
+        if (all(below) || all(above)) {
+            return;
+        }
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        gl_Layer = face;
+        Position_worldspace = gl_in[i].gl_Position.xyz;
+        gl_Position = clipPositions[i];
+        EmitVertex();
+    }
+    EndPrimitive();
+}
@@ -0,0 +1,49 @@
+#version 410 core
+
+// Shadow atlas tile limit (must match MAX_SHADOW_TILES in ShadowAtlas.h)
+#define MAX_SHADOW_TILES 8
+
+// Maximum number of lights
+#define MAX_LIGHTS 4
+
+// Tiles of the shadow atlas (must match ShadowAtlasBlockData in ShadowAtlas.h)
+layout(std140) uniform ShadowAtlasBlock {
+    mat4 tileMatrices[MAX_SHADOW_TILES];  // Light-space matrix of each tile
+    vec4 tileRects[MAX_SHADOW_TILES];     // Offset (xy) and size (zw) of each tile in atlas texture coordinates
+    ivec4 lightTiles[MAX_LIGHTS];         // Tile of directional light i (x) and spot light i (y), -1 if unshadowed
+    int tileCount;                        // Tiles in use
+};
+
+// One invocation per tile, each writing the triangle into its own viewport of the atlas
+layout(triangles, invocations = MAX_SHADOW_TILES) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+void main()
+{
+    if (gl_InvocationID >= tileCount) {
+        return;
+    }
+
+    vec4 clipPositions[3];
+    for (int i = 0; i < 3; ++i) {
+        clipPositions[i] = tileMatrices[gl_InvocationID] * gl_in[i].gl_Position;
+    }
+
+    // Skip triangles entirely outside one of the tile's frustum planes (perspective for spot lights)
+    for (int axis = 0; axis < 3; ++axis) {
+        bvec3 below = bvec3(clipPositions[0][axis] < -clipPositions[0].w, clipPositions[1][axis] < -clipPositions[1].w,
+            clipPositions[2][axis] < -clipPositions[2].w);
+        bvec3 above = bvec3(clipPositions[0][axis] > clipPositions[0].w, clipPositions[1][axis] > clipPositions[1].w,
+            clipPositions[2][axis] > clipPositions[2].w);
+        if (all(below) || all(above)) {
+            return;
+        }
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        gl_ViewportIndex = gl_InvocationID;
+        gl_Position = clipPositions[i];
+        EmitVertex();
+    }
+    EndPrimitive();
+}
@@ -0,0 +1,26 @@
+#version 410 core
+
+layout (location = 0) in vec3 position;
+layout (location = 4) in mat4 instanceTransform;  // Per-instance transform, identity when not instanced
+
+// Shadow atlas tile limit (must match MAX_SHADOW_TILES in ShadowAtlas.h)
+#define MAX_SHADOW_TILES 8
+
+// Maximum number of lights
+#define MAX_LIGHTS 4
+
+// Tiles of the shadow atlas (must match ShadowAtlasBlockData in ShadowAtlas.h)
+layout(std140) uniform ShadowAtlasBlock {
+    mat4 tileMatrices[MAX_SHADOW_TILES];  // Light-space matrix of each tile
+    vec4 tileRects[MAX_SHADOW_TILES];     // Offset (xy) and size (zw) of each tile in atlas texture coordinates
+    ivec4 lightTiles[MAX_LIGHTS];         // Tile of directional light i (x) and spot light i (y), -1 if unshadowed
+    int tileCount;                        // Tiles in use
+};
+
+uniform mat4 M;          // Model matrix (world transformation)
+uniform int tileIndex;   // Tile this pass renders, the viewport is set to it
+
+void main()
+{
+    gl_Position = tileMatrices[tileIndex] * instanceTransform * M * vec4(position, 1.0);
+}
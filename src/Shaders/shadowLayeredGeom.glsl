@@ -0,0 +1,48 @@
+#version 410 core
+
+// Shadow cascade limit (must match MAX_SHADOW_CASCADES in ShadowMap.h)
+#define MAX_SHADOW_CASCADES 4
+
+// Per-frame data shared by every program (must match FrameBlockData in SceneUniforms.h)
+layout(std140) uniform FrameBlock {
+    mat4 V;                                          // View matrix (camera view)
+    mat4 P;                                          // Projection matrix
+    mat4 lightSpaceMatrices[MAX_SHADOW_CASCADES];    // Light's view-projection matrix of each shadow cascade
+    vec4 cascadeSplits;                              // View depth where each cascade ends
+    vec3 cameraPosition;                             // Camera position in world space
+    float shadowBias;                                // Bias to avoid shadow acne
+    int shadowsEnabled;                              // Flag to enable/disable shadows
+    int cascadeCount;                                // Cascades in use
+    int shadowFilter;                                // Shadow map filter kernel (SHADOW_FILTER_*)
+};
+
+// One invocation per cascade, each writing the triangle into its own layer of the shadow map
+layout(triangles, invocations = MAX_SHADOW_CASCADES) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+void main()
+{
+    if (gl_InvocationID >= cascadeCount) {
+        return;
+    }
+
+    vec4 clipPositions[3];
+    for (int i = 0; i < 3; ++i) {
+        clipPositions[i] = lightSpaceMatrices[gl_InvocationID] * gl_in[i].gl_Position;
+    }
+
+    // Skip triangles entirely outside the cascade's side planes
+    for (int axis = 0; axis < 2; ++axis) {
+        if (all(lessThan(vec3(clipPositions[0][axis], clipPositions[1][axis], clipPositions[2][axis]), vec3(-1.0))) ||
+            all(greaterThan(vec3(clipPositions[0][axis], clipPositions[1][axis], clipPositions[2][axis]), vec3(1.0)))) {
+            return;
+        }
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        gl_Layer = gl_InvocationID;
+        gl_Position = clipPositions[i];
+        EmitVertex();
+    }
+    EndPrimitive();
+}
@@ -0,0 +1,12 @@
+#version 410 core
+
+layout (location = 0) in vec3 position;
+layout (location = 4) in mat4 instanceTransform;  // Per-instance transform, identity when not instanced
+
+uniform mat4 M;  // Model matrix (world transformation)
+
+void main()
+{
+    // World space position, the geometry shader projects it into each cascade
+    gl_Position = instanceTransform * M * vec4(position, 1.0);
+}
@@ -0,0 +1,55 @@
+#version 410 core
+
+// Exponential warps of the depth (must match the lighting shaders); with 32-bit floats the positive
+// exponent can't go much higher before the squared moment overflows
+#define EVSM_POSITIVE_EXPONENT 40.0
+#define EVSM_NEGATIVE_EXPONENT 5.0
+
+// Passes of the separable blur
+#define MOMENTS_PASS_HORIZONTAL 0
+#define MOMENTS_PASS_VERTICAL 1
+
+uniform sampler2DArray shadowDepth;  // Shadow map, read without depth comparison
+uniform sampler2D momentsSource;     // Output of the horizontal pass
+uniform int cascadeLayer;            // Cascade being converted
+uniform int blurRadius;              // Half width of the kernel in moment texels
+uniform int momentsPass;             // MOMENTS_PASS_*
+
+out vec4 moments;
+
+// Both warps of a depth and their squares
+vec4 warpDepth(float depth) {
+    float warped = 2.0 * depth - 1.0;
+    float positive = exp(EVSM_POSITIVE_EXPONENT * warped);
+    float negative = -exp(-EVSM_NEGATIVE_EXPONENT * warped);
+    return vec4(positive, positive * positive, negative, negative * negative);
+}
+
+// Moments of one texel: the average of the 2x2 shadow map texels it covers, gathered in one fetch
+vec4 texelMoments(ivec2 texel) {
+    vec2 uv = (vec2(texel) * 2.0 + 1.0) / vec2(textureSize(shadowDepth, 0).xy);
+    vec4 depths = textureGather(shadowDepth, vec3(uv, cascadeLayer));
+    return (warpDepth(depths.x) + warpDepth(depths.y) + warpDepth(depths.z) + warpDepth(depths.w)) * 0.25;
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 lastTexel = textureSize(shadowDepth, 0).xy / 2 - 1;  // The moments have half the resolution
+    float sigma = max(float(blurRadius) * 0.5, 0.5);
+
+    // Gaussian weights, normalized at the end
+    vec4 sum = vec4(0.0);
+    float weightSum = 0.0;
+    for (int i = -blurRadius; i <= blurRadius; ++i) {
+        float weight = exp(-float(i * i) / (2.0 * sigma * sigma));
+        if (momentsPass == MOMENTS_PASS_HORIZONTAL) {
+            sum += texelMoments(ivec2(clamp(texel.x + i, 0, lastTexel.x), texel.y)) * weight;
+        }
+        else {
+            sum += texelFetch(momentsSource, ivec2(texel.x, clamp(texel.y + i, 0, lastTexel.y)), 0) * weight;
+        }
+        weightSum += weight;
+    }
+    moments = sum / weightSum;
+}
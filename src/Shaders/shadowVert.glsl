@@ -1,15 +1,28 @@
 #version 410 core
 
 layout (location = 0) in vec3 position;
+layout (location = 4) in mat4 instanceTransform;  // Per-instance transform, identity when not instanced
 
-uniform mat4 lightMVP;
-uniform mat4 matrixShadow;
+// Shadow cascade limit (must match MAX_SHADOW_CASCADES in ShadowMap.h)
+#define MAX_SHADOW_CASCADES 4
 
+// Per-frame data shared by every program (must match FrameBlockData in SceneUniforms.h)
+layout(std140) uniform FrameBlock {
+    mat4 V;                                          // View matrix (camera view)
+    mat4 P;                                          // Projection matrix
+    mat4 lightSpaceMatrices[MAX_SHADOW_CASCADES];    // Light's view-projection matrix of each shadow cascade
+    vec4 cascadeSplits;                              // View depth where each cascade ends
+    vec3 cameraPosition;                             // Camera position in world space
+    float shadowBias;                                // Bias to avoid shadow acne
+    int shadowsEnabled;                              // Flag to enable/disable shadows
+    int cascadeCount;                                // Cascades in use
+    int shadowFilter;                                // Shadow map filter kernel (SHADOW_FILTER_*)
+};
 
-out vec4 lightView_Position;
+uniform mat4 M;             // Model matrix (world transformation)
+uniform int cascadeIndex;   // Cascade this pass renders
 
 void main()
 {
-    gl_Position = lightMVP * vec4(position, 1.0);
-    lightView_Position = matrixShadow * vec4(position, 1.0);
-}
\ No newline at end of file
+    gl_Position = lightSpaceMatrices[cascadeIndex] * instanceTransform * M * vec4(position, 1.0);
+}
@@ -3,37 +3,67 @@
 layout(location = 0) in vec3 vertexPosition_modelspace;
 layout(location = 1) in vec3 vertexNormal_modelspace;
 layout(location = 2) in vec2 vertexUV;
+layout(location = 3) in int drawMaterialIndex;  // Material of the draw range (see MATERIAL_INDEX_ATTRIBUTE in Model.h)
+layout(location = 4) in mat4 instanceTransform; // Per-instance transform, identity when not instanced (INSTANCE_TRANSFORM_ATTRIBUTE)
+layout(location = 8) in vec4 instanceTint;      // Per-instance tint, white when not instanced (INSTANCE_TINT_ATTRIBUTE)
 
 out vec3 Position_worldspace;      // World space position for lighting
 out vec3 Normal_cameraspace;       // Normal in camera space for lighting
 out vec3 EyeDirection_cameraspace; // Direction to the camera in camera space
 out vec2 UV;                       // Texture coordinates
-out vec4 FragPosLightSpace;        // Position in light space for shadow mapping
+flat out int MaterialIndex;        // Material of the current draw
+flat out vec4 Tint;                // Per-instance tint
+
+// Shadow cascade limit (must match MAX_SHADOW_CASCADES in ShadowMap.h)
+#define MAX_SHADOW_CASCADES 4
+
+// Per-frame data shared by every program (must match FrameBlockData in SceneUniforms.h)
+layout(std140) uniform FrameBlock {
+    mat4 V;                                          // View matrix (camera view)
+    mat4 P;                                          // Projection matrix
+    mat4 lightSpaceMatrices[MAX_SHADOW_CASCADES];    // Light's view-projection matrix of each shadow cascade
+    vec4 cascadeSplits;                              // View depth where each cascade ends
+    vec3 cameraPosition;                             // Camera position in world space
+    float shadowBias;                                // Bias to avoid shadow acne
+    int shadowsEnabled;                              // Flag to enable/disable shadows
+    int cascadeCount;                                // Cascades in use
+    int shadowFilter;                                // Shadow map filter kernel (SHADOW_FILTER_*)
+};
 
-uniform mat4 MVP;                  // Model-View-Projection matrix (camera space)
-uniform mat4 V;                    // View matrix (camera view)
 uniform mat4 M;                    // Model matrix (world transformation)
-uniform mat4 lightSpaceMatrix;     // Light's view-projection matrix (for shadow mapping)
+
+// Whether the draw reads the per-instance attributes (see ShaderFeatures in ShaderVariants.h);
+// without them the draw's model matrix is the whole transform and the tint is white
+#ifndef INSTANCED
+#define INSTANCED 1
+#endif
 
 void main() {
-    // Transform the vertex position into clip space
-    gl_Position = MVP * vec4(vertexPosition_modelspace, 1.0);
+    // The draw's model matrix is applied first, then the instance's placement
+#if INSTANCED
+    mat4 model = instanceTransform * M;
+    Tint = instanceTint;
+#else
+    mat4 model = M;
+    Tint = vec4(1.0);
+#endif
 
     // Transform the vertex position into world space
-    Position_worldspace = vec3(M * vec4(vertexPosition_modelspace, 1.0));
+    Position_worldspace = vec3(model * vec4(vertexPosition_modelspace, 1.0));
 
     // Transform the vertex position into camera space
     vec3 vertexPosition_cameraspace = vec3(V * vec4(Position_worldspace, 1.0));
 
+    // Transform the vertex position into clip space
+    gl_Position = P * vec4(vertexPosition_cameraspace, 1.0);
+
     // Calculate the direction from the vertex to the camera in camera space
     EyeDirection_cameraspace = -vertexPosition_cameraspace;
 
     // Transform the normal vector into camera space
-    Normal_cameraspace = normalize(mat3(V * M) * vertexNormal_modelspace);
-
-    // Calculate the position in light space for shadow mapping
-    FragPosLightSpace = lightSpaceMatrix * M * vec4(vertexPosition_modelspace, 1.0);
+    Normal_cameraspace = normalize(mat3(V * model) * vertexNormal_modelspace);
 
-    // Pass UV to the fragment shader
+    // Pass UV and material to the fragment shader
     UV = vertexUV;
+    MaterialIndex = drawMaterialIndex;
 }
@@ -0,0 +1,299 @@
+#include "headers/ShadowAtlas.h"
+#include "headers/ShadowMap.h"
+#include "headers/GLStateCache.h"
+#include "headers/GLDebug.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cstring>
+
+ShadowAtlas::ShadowAtlas(GLsizei size)
+    : atlasSize(size), FBO(0), depthMap(0), ubo(0), blockData(), version(0), renderedVersion(0),
+    renderedCasterVersion(0), rendered(false), renderCount(0) {}
+
+ShadowAtlas::~ShadowAtlas() {
+    cleanup();
+}
+
+void ShadowAtlas::init() {
+    invalidate();
+
+    // Depth texture sampled with hardware comparison, like the shadow map
+    glGenTextures(1, &depthMap);
+    GLStateCache::get().bindTextureForUpdate(GL_TEXTURE_2D, depthMap);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, atlasSize, atlasSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    GLDebug::setObjectLabel(GL_TEXTURE, depthMap, "Shadow Atlas Depth");
+
+    glGenFramebuffers(1, &FBO);
+    GLStateCache::get().bindFramebuffer(FBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    GLDebug::setObjectLabel(GL_FRAMEBUFFER, FBO, "Shadow Atlas FBO");
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Error: Shadow atlas framebuffer is not complete!" << std::endl;
+    }
+    GLStateCache::get().bindFramebuffer(0);
+
+    // The block starts without tiles, every light unshadowed
+    if (ubo == 0) {
+        blockData = ShadowAtlasBlockData();
+        for (int i = 0; i < MAX_LIGHTS; ++i) {
+            blockData.lightTiles[i] = glm::ivec4(-1);
+        }
+
+        glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowAtlasBlockData), &blockData, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        GLDebug::setObjectLabel(GL_BUFFER, ubo, "ShadowAtlasBlock");
+        GLStateCache::get().bindBufferBase(GL_UNIFORM_BUFFER, SHADOW_ATLAS_BLOCK_BINDING, ubo);
+    }
+}
+
+float ShadowAtlas::spotLightImportance(const Lights& light, const Camera& camera, float fovy, float& range) {
+    glm::vec3 intensity = light.getIntensity();
+    float brightness = glm::dot(intensity, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+    if (brightness <= 0.0f) {
+        return 0.0f;
+    }
+
+    range = light.getRange();
+    if (range <= 0.0f) {
+        return 0.0f;
+    }
+
+    // Sphere around the lit cone
+    float cosAngle = glm::clamp(light.getOuterCutOff(), 0.01f, 1.0f);
+    glm::vec3 direction = glm::normalize(light.getDirection());
+    glm::vec3 center;
+    float radius;
+    if (cosAngle > 0.7071f) {
+        radius = range / (2.0f * cosAngle * cosAngle);
+        center = light.getPosition() + direction * radius;
+    }
+    else {
+        radius = range * glm::sqrt(1.0f - cosAngle * cosAngle);
+        center = light.getPosition() + direction * (range * cosAngle);
+    }
+
+    // Fraction of the screen height the sphere covers, 0 if it is behind the camera
+    glm::vec3 viewCenter = glm::vec3(camera.getViewMatrix() * glm::vec4(center, 1.0f));
+    float depth = -viewCenter.z;
+    if (depth < -radius) {
+        return 0.0f;
+    }
+    float coverage = depth > radius ? glm::min(radius / (depth * glm::tan(fovy * 0.5f)), 1.0f) : 1.0f;
+    return brightness * coverage;
+}
+
+void ShadowAtlas::update(const std::vector<Lights>& directionalLights, const std::vector<Lights>& spotLights,
+    const Camera& camera, float fovy, float aspect, const glm::vec3& casterMin, const glm::vec3& casterMax, float nearPlane,
+    float shadowDistance) {
+    // Candidate tiles with their importance; the first directional light has the cascades
+    tiles.clear();
+    std::vector<float> spotRanges(spotLights.size(), 0.0f);
+    int directionalCount = static_cast<int>(std::min<size_t>(directionalLights.size(), MAX_LIGHTS));
+    int spotCount = static_cast<int>(std::min<size_t>(spotLights.size(), MAX_LIGHTS));
+    for (int i = 1; i < directionalCount; ++i) {
+        float brightness = glm::dot(directionalLights[i].getIntensity(), glm::vec3(0.2126f, 0.7152f, 0.0722f));
+        if (brightness > 0.0f) {
+            tiles.push_back({ LightType::DIRECTIONAL, i, brightness, 0, 0, 0 });
+        }
+    }
+    for (int i = 0; i < spotCount; ++i) {
+        float importance = spotLightImportance(spotLights[i], camera, fovy, spotRanges[i]);
+        if (importance > 0.0f) {
+            tiles.push_back({ LightType::SPOT, i, importance, 0, 0, 0 });
+        }
+    }
+
+    // Most important first: it gets half the atlas, the others shrink with the square root of their importance
+    std::stable_sort(tiles.begin(), tiles.end(), [](const ShadowTile& a, const ShadowTile& b) {
+        return a.importance > b.importance;
+    });
+    if (tiles.size() > static_cast<size_t>(MAX_SHADOW_TILES)) {
+        tiles.resize(MAX_SHADOW_TILES);
+    }
+
+    freeRegions.clear();
+    freeRegions.push_back({ 0, 0, atlasSize });
+    GLsizei largestTile = atlasSize / 2;
+    GLsizei smallestTile = glm::max(atlasSize / 16, 1);
+    size_t packed = 0;
+    for (ShadowTile& tile : tiles) {
+        float share = glm::sqrt(tile.importance / tiles.front().importance);
+        GLsizei size = largestTile;
+        while (size > smallestTile && share * largestTile < size * 0.75f) {
+            size /= 2;
+        }
+
+        // Smaller tiles until one fits; lights left without room stay unshadowed
+        while (size >= smallestTile && !allocate(size, tile.x, tile.y)) {
+            size /= 2;
+        }
+        if (size < smallestTile) {
+            continue;
+        }
+        tile.size = size;
+        tiles[packed++] = tile;
+    }
+    tiles.resize(packed);
+
+    // Light-space matrices and rectangles of the packed tiles
+    ShadowAtlasBlockData data = {};
+    for (int i = 0; i < MAX_LIGHTS; ++i) {
+        data.lightTiles[i] = glm::ivec4(-1);
+    }
+    data.tileCount = static_cast<int>(tiles.size());
+
+    glm::mat4 cameraView = camera.getViewMatrix();
+    for (int i = 0; i < data.tileCount; ++i) {
+        const ShadowTile& tile = tiles[i];
+        if (tile.lightType == LightType::DIRECTIONAL) {
+            glm::mat4 shadowSlice = glm::perspective(fovy, aspect, nearPlane, shadowDistance) * cameraView;
+            data.tileMatrices[i] = ShadowMap::fitDirectionalProjection(directionalLights[tile.lightIndex].getDirection(),
+                casterMin, casterMax, shadowSlice, tile.size);
+            data.lightTiles[tile.lightIndex].x = i;
+        }
+        else {
+            // The spot light's cone, slightly widened so the filter taps at its edge stay inside
+            const Lights& light = spotLights[tile.lightIndex];
+            glm::vec3 direction = glm::normalize(light.getDirection());
+            glm::vec3 up = glm::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            float fov = glm::min(2.0f * glm::acos(glm::clamp(light.getOuterCutOff(), 0.0f, 1.0f)) * 1.1f, glm::radians(170.0f));
+            float range = spotRanges[tile.lightIndex];
+            glm::mat4 lightProjection = glm::perspective(fov, 1.0f, glm::max(range * 0.001f, 0.05f), range);
+            glm::mat4 lightView = glm::lookAt(light.getPosition(), light.getPosition() + direction, up);
+            data.tileMatrices[i] = lightProjection * lightView;
+            data.lightTiles[tile.lightIndex].y = i;
+        }
+        data.tileRects[i] = glm::vec4(tile.x, tile.y, tile.size, tile.size) / static_cast<float>(atlasSize);
+    }
+
+    if (std::memcmp(&data, &blockData, sizeof(ShadowAtlasBlockData)) == 0) {
+        return;
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ShadowAtlasBlockData), &data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    blockData = data;
+    version++;
+}
+
+bool ShadowAtlas::allocate(GLsizei size, GLint& x, GLint& y) {
+    // Smallest free square that can hold the tile, split into quarters until it has the tile's size
+    int best = -1;
+    for (size_t i = 0; i < freeRegions.size(); ++i) {
+        if (freeRegions[i].size >= size && (best < 0 || freeRegions[i].size < freeRegions[best].size)) {
+            best = static_cast<int>(i);
+        }
+    }
+    if (best < 0) {
+        return false;
+    }
+
+    FreeRegion region = freeRegions[best];
+    freeRegions.erase(freeRegions.begin() + best);
+    while (region.size > size) {
+        region.size /= 2;
+        freeRegions.push_back({ region.x + region.size, region.y, region.size });
+        freeRegions.push_back({ region.x, region.y + region.size, region.size });
+        freeRegions.push_back({ region.x + region.size, region.y + region.size, region.size });
+    }
+    x = region.x;
+    y = region.y;
+    return true;
+}
+
+void ShadowAtlas::bindForShadowPass(bool layered) const {
+    GLStateCache& state = GLStateCache::get();
+    state.bindFramebuffer(FBO);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    if (!layered || tiles.empty()) {
+        return;
+    }
+
+    GLfloat viewports[MAX_SHADOW_TILES * 4];
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        viewports[i * 4 + 0] = static_cast<GLfloat>(tiles[i].x);
+        viewports[i * 4 + 1] = static_cast<GLfloat>(tiles[i].y);
+        viewports[i * 4 + 2] = static_cast<GLfloat>(tiles[i].size);
+        viewports[i * 4 + 3] = static_cast<GLfloat>(tiles[i].size);
+    }
+    state.setViewportArray(static_cast<GLsizei>(tiles.size()), viewports);
+}
+
+void ShadowAtlas::bindForTile(int tile) const {
+    GLStateCache::get().setViewport(tiles[tile].x, tiles[tile].y, tiles[tile].size, tiles[tile].size);
+}
+
+void ShadowAtlas::bindForLightingPass() const {
+    GLStateCache::get().bindTexture(SHADOW_ATLAS_TEXTURE_UNIT, GL_TEXTURE_2D, depthMap);
+}
+
+const std::vector<ShadowTile>& ShadowAtlas::getTiles() const {
+    return tiles;
+}
+
+int ShadowAtlas::getTileCount() const {
+    return static_cast<int>(tiles.size());
+}
+
+GLsizei ShadowAtlas::getSize() const {
+    return atlasSize;
+}
+
+void ShadowAtlas::resize(GLsizei size) {
+    atlasSize = size;
+    releaseTargets();
+    init();
+}
+
+bool ShadowAtlas::isUpToDate(uint64_t casterVersion) const {
+    return rendered && version == renderedVersion && casterVersion == renderedCasterVersion;
+}
+
+void ShadowAtlas::markRendered(uint64_t casterVersion) {
+    rendered = true;
+    renderedVersion = version;
+    renderedCasterVersion = casterVersion;
+    renderCount++;
+}
+
+void ShadowAtlas::invalidate() {
+    rendered = false;
+}
+
+unsigned int ShadowAtlas::getRenderCount() const {
+    return renderCount;
+}
+
+void ShadowAtlas::releaseTargets() {
+    if (FBO) {
+        GLStateCache::get().forgetFramebuffer(FBO);
+        glDeleteFramebuffers(1, &FBO);
+        FBO = 0;
+    }
+    if (depthMap) {
+        GLStateCache::get().forgetTexture(depthMap);
+        glDeleteTextures(1, &depthMap);
+        depthMap = 0;
+    }
+}
+
+void ShadowAtlas::cleanup() {
+    releaseTargets();
+    if (ubo) {
+        GLStateCache::get().forgetBuffer(ubo);
+        glDeleteBuffers(1, &ubo);
+        ubo = 0;
+    }
+}
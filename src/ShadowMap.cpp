@@ -1,42 +1,56 @@
 #include "headers/ShadowMap.h"
+#include "headers/GLStateCache.h"
+#include "headers/GLDebug.h"
+#include <limits>
 
 // Constructor
 ShadowMap::ShadowMap(GLsizei width, GLsizei height)
-    : shadowWidth(width), shadowHeight(height), FBO(0), depthMap(0), lightSpaceMatrix(glm::mat4(1.0f)) {}
+    : shadowWidth(width), shadowHeight(height), FBO(0), depthMap(0), cascadeCount(MAX_SHADOW_CASCADES),
+    activeCascadeCount(1), splitLambda(0.75f), filter(ShadowFilter::FOUR_TAPS), renderCount(0) {
+    for (int i = 0; i < MAX_SHADOW_CASCADES; ++i) {
+        layerFBOs[i] = 0;
+        cascadeMatrices[i] = glm::mat4(1.0f);
+        cascadeSplits[i] = std::numeric_limits<float>::max();
+        cascadeVersions[i] = 0;
+        renderedCascadeVersions[i] = 0;
+        renderedCasterVersions[i] = 0;
+        rendered[i] = false;
+    }
+}
 
 // Destructor
 ShadowMap::~ShadowMap() {
-    if (FBO) {
-        glDeleteFramebuffers(1, &FBO);
-    }
-    if (depthMap) {
-        glDeleteTextures(1, &depthMap);
-    }
+    releaseTargets();
 }
 
-// Initialize the shadow map (FBO and depth texture)
+// Initialize the shadow map (FBOs and depth texture array)
 void ShadowMap::init() {
-    // Generate framebuffer
-    glGenFramebuffers(1, &FBO);
+    invalidate();
 
-    // Generate depth texture for shadow map
+    // Generate depth texture array, one layer per cascade
     glGenTextures(1, &depthMap);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, shadowWidth, shadowHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    GLStateCache::get().bindTextureForUpdate(GL_TEXTURE_2D_ARRAY, depthMap);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, shadowWidth, shadowHeight, cascadeCount, 0,
+        GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
 
-    // Set texture parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    // Hardware depth comparison: shadow samplers compare the four nearest texels and filter the results bilinearly
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 
     // Set border color (usually white for shadow maps)
     GLfloat borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+    GLDebug::setObjectLabel(GL_TEXTURE, depthMap, "Shadow Map Depth");
 
-    // Attach depth texture to the framebuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
+    // Layered framebuffer: the geometry shader picks the cascade of each primitive with gl_Layer
+    glGenFramebuffers(1, &FBO);
+    GLStateCache::get().bindFramebuffer(FBO);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthMap, 0);
+    GLDebug::setObjectLabel(GL_FRAMEBUFFER, FBO, "Shadow Map FBO");
 
     // We don't need a color buffer for shadow mapping
     glDrawBuffer(GL_NONE);
@@ -47,64 +61,198 @@ void ShadowMap::init() {
         std::cerr << "Error: Shadow map framebuffer is not complete!" << std::endl;
     }
 
+    // One framebuffer per cascade, for rendering the cascades one at a time
+    glGenFramebuffers(cascadeCount, layerFBOs);
+    for (int i = 0; i < cascadeCount; ++i) {
+        GLStateCache::get().bindFramebuffer(layerFBOs[i]);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthMap, 0, i);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        GLDebug::setObjectLabel(GL_FRAMEBUFFER, layerFBOs[i], "Shadow Cascade FBO");
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Error: Shadow cascade framebuffer " << i << " is not complete!" << std::endl;
+        }
+    }
+
     // Unbind the framebuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLStateCache::get().bindFramebuffer(0);
 }
 
-// Bind for shadow pass (rendering the scene from the light's perspective)
+// Deletes the framebuffers and the depth texture
+void ShadowMap::releaseTargets() {
+    if (FBO) {
+        GLStateCache::get().forgetFramebuffer(FBO);
+        glDeleteFramebuffers(1, &FBO);
+        FBO = 0;
+    }
+    for (int i = 0; i < MAX_SHADOW_CASCADES; ++i) {
+        if (layerFBOs[i]) {
+            GLStateCache::get().forgetFramebuffer(layerFBOs[i]);
+            glDeleteFramebuffers(1, &layerFBOs[i]);
+            layerFBOs[i] = 0;
+        }
+    }
+    if (depthMap) {
+        GLStateCache::get().forgetTexture(depthMap);
+        glDeleteTextures(1, &depthMap);
+        depthMap = 0;
+    }
+}
+
+// Bind for shadow pass (rendering the scene from the light's perspective into every cascade)
 void ShadowMap::bindForShadowPass() const {
-    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-    glViewport(0, 0, shadowWidth, shadowHeight);  // Set viewport to shadow map size
-    glClear(GL_DEPTH_BUFFER_BIT);  // Clear the depth buffer
+    GLStateCache::get().bindFramebuffer(FBO);
+    GLStateCache::get().setViewport(0, 0, shadowWidth, shadowHeight);  // Set viewport to shadow map size
+    glClear(GL_DEPTH_BUFFER_BIT);  // Clear the depth buffer of every layer
 }
 
-void ShadowMap::bindForCameraView() const {
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glViewport(0, 0, 1024, 768);  // Set viewport to screen size
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);  // Clear the depth buffer
+void ShadowMap::bindForCascadePass(int cascade) const {
+    GLStateCache::get().bindFramebuffer(layerFBOs[cascade]);
+    GLStateCache::get().setViewport(0, 0, shadowWidth, shadowHeight);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void ShadowMap::bindForCameraView(GLsizei width, GLsizei height) const {
+    GLStateCache::get().bindFramebuffer(0);
+    GLStateCache::get().setViewport(0, 0, width, height);  // Set viewport to the window size
 }
 
 // Bind the shadow map for the lighting pass (use shadow map in shaders)
 void ShadowMap::bindForLightingPass(GLuint textureUnit) const {
-    glActiveTexture(GL_TEXTURE0 + textureUnit);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
+    GLStateCache::get().bindTexture(textureUnit, GL_TEXTURE_2D_ARRAY, depthMap);
+}
+
+// Without a directional light there is nothing to cascade, the shaders skip the shadow map
+void ShadowMap::disableCascades() {
+    activeCascadeCount = 0;
 }
 
-// Calculate the light-space matrix (transform world coordinates to light space)
-void ShadowMap::calculateLightSpaceMatrix(const glm::vec3& lightPos, const glm::vec3& targetPos, LightType lightType) {
-    glm::mat4 lightProjection, lightView;
+// Split the view into cascades and fit each one to what can cast a visible shadow in it
+void ShadowMap::fitDirectionalLight(const glm::vec3& lightDirection, const glm::vec3& casterMin, const glm::vec3& casterMax,
+    const glm::mat4& cameraView, float fovy, float aspect, float nearPlane, float farPlane) {
+    // Practical split scheme: logarithmic splits keep the texel density even with distance,
+    // blended with uniform splits so the nearest cascade doesn't get too thin
+    activeCascadeCount = cascadeCount;
+    float sliceNear = nearPlane;
+    for (int i = 0; i < cascadeCount; ++i) {
+        float fraction = static_cast<float>(i + 1) / cascadeCount;
+        float logSplit = nearPlane * glm::pow(farPlane / nearPlane, fraction);
+        float uniformSplit = nearPlane + (farPlane - nearPlane) * fraction;
+        float sliceFar = glm::mix(uniformSplit, logSplit, splitLambda);
 
-    if (lightType == LightType::DIRECTIONAL) {
-        // Orthographic projection for directional light (smaller bounds for tighter shadows)
-        float nearPlane = 1.0f, farPlane = 50.0f;
-        lightProjection = glm::ortho(-5.0f, 5.0f, -5.0f, 5.0f, nearPlane, farPlane);
-        lightView = glm::lookAt(lightPos, targetPos, glm::vec3(0.0f, 1.0f, 0.0f));  // View from light's perspective
+        glm::mat4 sliceProjection = glm::perspective(fovy, aspect, sliceNear, sliceFar);
+        setCascadeMatrix(i, fitDirectionalProjection(lightDirection, casterMin, casterMax, sliceProjection * cameraView, shadowWidth));
+        cascadeSplits[i] = sliceFar;
+        sliceNear = sliceFar;
     }
-    else if (lightType == LightType::SPOT || lightType == LightType::POINT) {
-        lightProjection = glm::perspective(glm::radians(90.0f), 1.0f, 1.0f, 100.0f);
-        lightView = glm::lookAt(lightPos, targetPos, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+// Fit the light's orthographic frustum to the casters' footprint within one slice of the view
+glm::mat4 ShadowMap::fitDirectionalProjection(const glm::vec3& lightDirection, const glm::vec3& casterMin,
+    const glm::vec3& casterMax, const glm::mat4& sliceViewProjection, GLsizei resolution) {
+    // Light view anchored at the world origin, so the texel grid only moves when the light turns
+    glm::vec3 direction = glm::normalize(lightDirection);
+    glm::vec3 up = glm::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), direction, up);
+
+    // Casters in light space; a caster's shadow lands inside its own light-space footprint
+    glm::vec3 casterLightMin(std::numeric_limits<float>::max());
+    glm::vec3 casterLightMax(-std::numeric_limits<float>::max());
+    for (int corner = 0; corner < 8; ++corner) {
+        glm::vec3 point((corner & 1) ? casterMax.x : casterMin.x, (corner & 2) ? casterMax.y : casterMin.y,
+            (corner & 4) ? casterMax.z : casterMin.z);
+        glm::vec3 lightPoint = glm::vec3(lightView * glm::vec4(point, 1.0f));
+        casterLightMin = glm::min(casterLightMin, lightPoint);
+        casterLightMax = glm::max(casterLightMax, lightPoint);
     }
 
-    // Store the light space matrix without bias (bias will be applied in the fragment shader)
-    lightSpaceMatrix = lightProjection * lightView;
+    // Visible receivers in light space
+    glm::mat4 cameraToWorld = glm::inverse(sliceViewProjection);
+    glm::vec3 frustumLightMin(std::numeric_limits<float>::max());
+    glm::vec3 frustumLightMax(-std::numeric_limits<float>::max());
+    for (int corner = 0; corner < 8; ++corner) {
+        glm::vec4 point = cameraToWorld * glm::vec4((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f,
+            (corner & 4) ? 1.0f : -1.0f, 1.0f);
+        glm::vec3 lightPoint = glm::vec3(lightView * (point / point.w));
+        frustumLightMin = glm::min(frustumLightMin, lightPoint);
+        frustumLightMax = glm::max(frustumLightMax, lightPoint);
+    }
+
+    // Only the casters' footprint inside the visible area needs texels (all of it if none is visible)
+    glm::vec2 areaMin = glm::max(glm::vec2(casterLightMin), glm::vec2(frustumLightMin));
+    glm::vec2 areaMax = glm::min(glm::vec2(casterLightMax), glm::vec2(frustumLightMax));
+    if (areaMin.x >= areaMax.x || areaMin.y >= areaMax.y) {
+        areaMin = glm::vec2(casterLightMin);
+        areaMax = glm::vec2(casterLightMax);
+    }
+
+    // Square extent, quantized to 1/8 of its power of two so it only changes in steps
+    float extent = glm::max(glm::max(areaMax.x - areaMin.x, areaMax.y - areaMin.y) * 1.02f, 0.01f);
+    float step = glm::exp2(glm::floor(glm::log2(extent)) - 3.0f);
+    extent = glm::ceil(extent / step) * step;
+
+    // Snap the origin to whole texels, centered on the area
+    float texelSize = extent / static_cast<float>(resolution);
+    glm::vec2 center = (areaMin + areaMax) * 0.5f;
+    glm::vec2 origin = glm::floor((center - extent * 0.5f) / texelSize) * texelSize;
+
+    // The view looks down -z: the casters nearest the light bound the near plane, the farthest receivers the far plane
+    float nearPlane = glm::floor(-casterLightMax.z / step) * step - step;
+    float farPlane = glm::ceil(-glm::min(casterLightMin.z, frustumLightMin.z) / step) * step + step;
+
+    glm::mat4 lightProjection = glm::ortho(origin.x, origin.x + extent, origin.y, origin.y + extent, nearPlane, farPlane);
+    return lightProjection * lightView;
 }
 
+GLsizei ShadowMap::getSize() const {
+    return shadowWidth;
+}
 
-// Resize the shadow map (reallocate texture and framebuffer)
+// Resize the shadow map (reallocate texture and framebuffers)
 void ShadowMap::resize(GLsizei width, GLsizei height) {
     shadowWidth = width;
     shadowHeight = height;
 
-    // Delete the previous framebuffer and texture
-    if (FBO) {
-        glDeleteFramebuffers(1, &FBO);
-    }
-    if (depthMap) {
-        glDeleteTextures(1, &depthMap);
+    // Delete the previous framebuffers and texture, then reinitialize with the new dimensions
+    releaseTargets();
+    init();
+}
+
+void ShadowMap::setCascadeCount(int count) {
+    count = glm::clamp(count, 1, MAX_SHADOW_CASCADES);
+    if (count != cascadeCount) {
+        cascadeCount = count;
+        resize(shadowWidth, shadowHeight);
     }
+}
 
-    // Reinitialize with the new dimensions
-    init();
+int ShadowMap::getCascadeCount() const {
+    return cascadeCount;
+}
+
+void ShadowMap::setSplitLambda(float lambda) {
+    splitLambda = glm::clamp(lambda, 0.0f, 1.0f);
+}
+
+float ShadowMap::getSplitLambda() const {
+    return splitLambda;
+}
+
+void ShadowMap::setFilter(ShadowFilter shadowFilter) {
+    filter = shadowFilter;
+}
+
+ShadowFilter ShadowMap::getFilter() const {
+    return filter;
+}
+
+int ShadowMap::getActiveCascadeCount() const {
+    return activeCascadeCount;
+}
+
+float ShadowMap::getCascadeSplit(int cascade) const {
+    return cascadeSplits[cascade];
 }
 
 // Getters
@@ -116,11 +264,63 @@ GLuint ShadowMap::getFBO() const {
     return FBO;
 }
 
-glm::mat4 ShadowMap::getLightSpaceMatrix() const {
-    return lightSpaceMatrix;
+const glm::mat4& ShadowMap::getCascadeMatrix(int cascade) const {
+    return cascadeMatrices[cascade];
 }
 
 // Setters
-void ShadowMap::setLightSpaceMatrix(const glm::mat4& matrix) const{
-    const_cast<ShadowMap*>(this)->lightSpaceMatrix = matrix;
+void ShadowMap::setCascadeMatrix(int cascade, const glm::mat4& matrix) {
+    if (matrix != cascadeMatrices[cascade]) {
+        cascadeMatrices[cascade] = matrix;
+        cascadeVersions[cascade]++;
+    }
+}
+
+bool ShadowMap::isUpToDate(uint64_t casterVersion) const {
+    for (int i = 0; i < activeCascadeCount; ++i) {
+        if (!isCascadeUpToDate(i, casterVersion)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ShadowMap::isCascadeUpToDate(int cascade, uint64_t casterVersion) const {
+    return rendered[cascade] && cascadeVersions[cascade] == renderedCascadeVersions[cascade]
+        && casterVersion == renderedCasterVersions[cascade];
+}
+
+bool ShadowMap::isLightUpToDate() const {
+    for (int i = 0; i < activeCascadeCount; ++i) {
+        if (!rendered[i] || cascadeVersions[i] != renderedCascadeVersions[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ShadowMap::markRendered(uint64_t casterVersion) {
+    for (int i = 0; i < activeCascadeCount; ++i) {
+        rendered[i] = true;
+        renderedCascadeVersions[i] = cascadeVersions[i];
+        renderedCasterVersions[i] = casterVersion;
+    }
+    renderCount++;
+}
+
+void ShadowMap::markCascadeRendered(int cascade, uint64_t casterVersion) {
+    rendered[cascade] = true;
+    renderedCascadeVersions[cascade] = cascadeVersions[cascade];
+    renderedCasterVersions[cascade] = casterVersion;
+    renderCount++;
+}
+
+void ShadowMap::invalidate() {
+    for (int i = 0; i < MAX_SHADOW_CASCADES; ++i) {
+        rendered[i] = false;
+    }
+}
+
+unsigned int ShadowMap::getRenderCount() const {
+    return renderCount;
 }
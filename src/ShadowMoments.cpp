@@ -0,0 +1,184 @@
+#include "headers/ShadowMoments.h"
+#include "headers/GLStateCache.h"
+#include "headers/GLDebug.h"
+#include <algorithm>
+
+// Passes of the separable blur (MOMENTS_PASS_* in shadowMomentsFrag.glsl)
+static const int MOMENTS_PASS_HORIZONTAL = 0;
+static const int MOMENTS_PASS_VERTICAL = 1;
+
+// Unit the shadow map is bound to for the lighting passes, the conversion reads it there
+static const GLuint SHADOW_DEPTH_TEXTURE_UNIT = 1;
+
+ShadowMoments::ShadowMoments()
+    : momentsShader(nullptr), momentsArray(0), blurTexture(0), momentsFBO(0), blurFBO(0), depthSampler(0), vao(0),
+    momentsSize(0), layerCount(0), blurRadius(4), builtRenderCount(0) {}
+
+ShadowMoments::~ShadowMoments() {
+    cleanup();
+}
+
+void ShadowMoments::init(const ShaderProgram& program) {
+    momentsShader = &program;
+    momentsShader->use();
+    momentsShader->setInt(Uniforms::ShadowDepth, SHADOW_DEPTH_TEXTURE_UNIT);
+    momentsShader->setInt(Uniforms::MomentsSource, SHADOW_MOMENTS_TEXTURE_UNIT);
+
+    // The shadow map compares depths in hardware, the conversion needs the depths themselves
+    glGenSamplers(1, &depthSampler);
+    glSamplerParameteri(depthSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glSamplerParameteri(depthSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glSamplerParameteri(depthSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(depthSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(depthSampler, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+    glGenVertexArrays(1, &vao);
+}
+
+void ShadowMoments::allocate(GLsizei shadowSize, int layers) {
+    releaseTargets();
+    momentsSize = std::max<GLsizei>(shadowSize / 2, 1);
+    layerCount = layers;
+
+    // 32-bit floats, the positive warp's square needs the range; the mip levels come from glGenerateMipmap in update()
+    glGenTextures(1, &momentsArray);
+    GLStateCache::get().bindTextureForUpdate(GL_TEXTURE_2D_ARRAY, momentsArray);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32F, momentsSize, momentsSize, layerCount, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    GLDebug::setObjectLabel(GL_TEXTURE, momentsArray, "Shadow Moments");
+
+    glGenTextures(1, &blurTexture);
+    GLStateCache::get().bindTextureForUpdate(GL_TEXTURE_2D, blurTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, momentsSize, momentsSize, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    GLDebug::setObjectLabel(GL_TEXTURE, blurTexture, "Shadow Moments Blur");
+
+    glGenFramebuffers(1, &blurFBO);
+    GLStateCache::get().bindFramebuffer(blurFBO);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, blurTexture, 0);
+    GLDebug::setObjectLabel(GL_FRAMEBUFFER, blurFBO, "Shadow Moments Blur FBO");
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Error: Shadow moments blur framebuffer is not complete!" << std::endl;
+    }
+
+    glGenFramebuffers(1, &momentsFBO);
+    GLStateCache::get().bindFramebuffer(momentsFBO);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, momentsArray, 0, 0);
+    GLDebug::setObjectLabel(GL_FRAMEBUFFER, momentsFBO, "Shadow Moments FBO");
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Error: Shadow moments framebuffer is not complete!" << std::endl;
+    }
+    GLStateCache::get().bindFramebuffer(0);
+}
+
+void ShadowMoments::update(const ShadowMap& shadowMap) {
+    if (momentsShader == nullptr) {
+        return;
+    }
+    if (momentsSize != std::max<GLsizei>(shadowMap.getSize() / 2, 1) || layerCount != shadowMap.getCascadeCount()) {
+        allocate(shadowMap.getSize(), shadowMap.getCascadeCount());
+    }
+
+    GLStateCache& state = GLStateCache::get();
+    state.bindVertexArray(vao);
+    state.setViewport(0, 0, momentsSize, momentsSize);
+    shadowMap.bindForLightingPass(SHADOW_DEPTH_TEXTURE_UNIT);
+    glBindSampler(SHADOW_DEPTH_TEXTURE_UNIT, depthSampler);
+    state.bindTexture(SHADOW_MOMENTS_TEXTURE_UNIT, GL_TEXTURE_2D, blurTexture);
+
+    momentsShader->use();
+    momentsShader->setInt(Uniforms::BlurRadius, blurRadius);
+    for (int layer = 0; layer < shadowMap.getActiveCascadeCount(); ++layer) {
+        // Warp, downsample and blur the rows into the blur texture
+        state.bindFramebuffer(blurFBO);
+        momentsShader->setInt(Uniforms::CascadeLayer, layer);
+        momentsShader->setInt(Uniforms::MomentsPass, MOMENTS_PASS_HORIZONTAL);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        // Blur the columns into the cascade's layer
+        state.bindFramebuffer(momentsFBO);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, momentsArray, 0, layer);
+        momentsShader->setInt(Uniforms::MomentsPass, MOMENTS_PASS_VERTICAL);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glBindSampler(SHADOW_DEPTH_TEXTURE_UNIT, 0);
+
+    // The mip chain lets distant receivers fetch the moments of a whole footprint at once
+    state.bindTextureForUpdate(GL_TEXTURE_2D_ARRAY, momentsArray);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+    builtRenderCount = shadowMap.getRenderCount();
+}
+
+bool ShadowMoments::isUpToDate(const ShadowMap& shadowMap) const {
+    return builtRenderCount != 0 && builtRenderCount == shadowMap.getRenderCount()
+        && momentsSize == std::max<GLsizei>(shadowMap.getSize() / 2, 1) && layerCount == shadowMap.getCascadeCount();
+}
+
+void ShadowMoments::invalidate() {
+    builtRenderCount = 0;
+}
+
+void ShadowMoments::bindForLightingPass() const {
+    GLStateCache::get().bindTexture(SHADOW_MOMENTS_TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, momentsArray);
+}
+
+void ShadowMoments::setBlurRadius(int radius) {
+    radius = glm::clamp(radius, 0, static_cast<int>(MAX_MOMENT_BLUR_RADIUS));
+    if (radius != blurRadius) {
+        blurRadius = radius;
+        invalidate();
+    }
+}
+
+int ShadowMoments::getBlurRadius() const {
+    return blurRadius;
+}
+
+GLsizei ShadowMoments::getSize() const {
+    return momentsSize;
+}
+
+void ShadowMoments::releaseTargets() {
+    if (momentsFBO) {
+        GLStateCache::get().forgetFramebuffer(momentsFBO);
+        glDeleteFramebuffers(1, &momentsFBO);
+        momentsFBO = 0;
+    }
+    if (blurFBO) {
+        GLStateCache::get().forgetFramebuffer(blurFBO);
+        glDeleteFramebuffers(1, &blurFBO);
+        blurFBO = 0;
+    }
+    if (momentsArray) {
+        GLStateCache::get().forgetTexture(momentsArray);
+        glDeleteTextures(1, &momentsArray);
+        momentsArray = 0;
+    }
+    if (blurTexture) {
+        GLStateCache::get().forgetTexture(blurTexture);
+        glDeleteTextures(1, &blurTexture);
+        blurTexture = 0;
+    }
+    momentsSize = 0;
+    layerCount = 0;
+    invalidate();
+}
+
+void ShadowMoments::cleanup() {
+    releaseTargets();
+    if (depthSampler) {
+        glDeleteSamplers(1, &depthSampler);
+        depthSampler = 0;
+    }
+    if (vao) {
+        GLStateCache::get().forgetVertexArray(vao);
+        glDeleteVertexArrays(1, &vao);
+        vao = 0;
+    }
+    momentsShader = nullptr;
+}
@@ -0,0 +1,454 @@
+#include "headers/TextureCache.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#undef byte  // Prevent conflicts with std::byte
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+// Bumped whenever the entry layout or the mip chain layout changes
+static const uint32_t CACHE_VERSION = 1;
+
+// Entry flags
+static const uint32_t CACHE_FLAG_LZ4 = 1;
+
+// Payloads start on a page boundary so a mapped entry can be handed to the driver as is
+static const size_t PAYLOAD_ALIGNMENT = 4096;
+
+// Compressed payloads are only kept if they save at least this fraction of the raw size
+static const float MIN_COMPRESSION_SAVING = 0.25f;
+
+// Fixed header at the start of every cache entry, followed by the source path and the payload
+struct CacheHeader {
+    char magic[4];               // "VTC1"
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t sourceModifiedTime;
+    uint32_t pathLength;         // The source path is stored to rule out file name collisions
+    int32_t width;
+    int32_t height;
+    int32_t components;
+    uint32_t flags;
+    uint64_t pixelSize;          // Size of the decoded mip chain
+    uint64_t storedSize;         // Size of the payload in the file
+    uint64_t payloadOffset;
+};
+
+static const char CACHE_MAGIC[4] = { 'V', 'T', 'C', '1' };
+
+// LZ4 block format constants
+static const size_t LZ4_MIN_MATCH = 4;
+static const size_t LZ4_LAST_LITERALS = 5;   // The block always ends with at least this many literals
+static const size_t LZ4_MATCH_LIMIT = 12;    // The last match starts at least this far from the end
+static const size_t LZ4_MAX_OFFSET = 65535;
+static const int LZ4_HASH_BITS = 16;
+
+static uint32_t read32(const unsigned char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Writes an LZ4 length extension (the part of a length that didn't fit in the token)
+static void writeLength(std::vector<unsigned char>& dst, size_t length) {
+    while (length >= 255) {
+        dst.push_back(255);
+        length -= 255;
+    }
+    dst.push_back(static_cast<unsigned char>(length));
+}
+
+// Appends one LZ4 sequence: literals followed by a match (matchLength 0 for the final literals-only sequence)
+static void writeSequence(std::vector<unsigned char>& dst, const unsigned char* literals, size_t literalLength,
+    size_t offset, size_t matchLength) {
+    size_t matchCode = matchLength > 0 ? matchLength - LZ4_MIN_MATCH : 0;
+    unsigned char token = static_cast<unsigned char>((std::min<size_t>(literalLength, 15) << 4) | std::min<size_t>(matchCode, 15));
+    dst.push_back(token);
+    if (literalLength >= 15) {
+        writeLength(dst, literalLength - 15);
+    }
+    dst.insert(dst.end(), literals, literals + literalLength);
+
+    if (matchLength > 0) {
+        dst.push_back(static_cast<unsigned char>(offset & 0xFF));
+        dst.push_back(static_cast<unsigned char>(offset >> 8));
+        if (matchCode >= 15) {
+            writeLength(dst, matchCode - 15);
+        }
+    }
+}
+
+// Greedy single-pass LZ4 block compressor
+static void lz4Compress(const unsigned char* src, size_t srcSize, std::vector<unsigned char>& dst) {
+    dst.clear();
+    dst.reserve(srcSize + srcSize / 255 + 16);
+
+    std::vector<uint32_t> table(static_cast<size_t>(1) << LZ4_HASH_BITS, 0);
+    size_t anchor = 0;
+    size_t ip = 0;
+
+    while (ip + LZ4_MATCH_LIMIT <= srcSize) {
+        uint32_t sequence = read32(src + ip);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+        size_t ref = table[hash];
+        table[hash] = static_cast<uint32_t>(ip);
+
+        if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || read32(src + ref) != sequence) {
+            ip++;
+            continue;
+        }
+
+        size_t matchLength = LZ4_MIN_MATCH;
+        while (ip + matchLength < srcSize - LZ4_LAST_LITERALS && src[ref + matchLength] == src[ip + matchLength]) {
+            matchLength++;
+        }
+
+        writeSequence(dst, src + anchor, ip - anchor, ip - ref, matchLength);
+        ip += matchLength;
+        anchor = ip;
+    }
+
+    writeSequence(dst, src + anchor, srcSize - anchor, 0, 0);
+}
+
+// Reads an LZ4 length extension; returns false if the input ends first
+static bool readLength(const unsigned char* src, size_t srcSize, size_t& ip, size_t& length) {
+    unsigned char byte;
+    do {
+        if (ip >= srcSize) {
+            return false;
+        }
+        byte = src[ip++];
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// LZ4 block decompressor; returns false on corrupt input or if the output size doesn't match
+static bool lz4Decompress(const unsigned char* src, size_t srcSize, unsigned char* dst, size_t dstSize) {
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < srcSize) {
+        unsigned char token = src[ip++];
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !readLength(src, srcSize, ip, literalLength)) {
+            return false;
+        }
+        if (literalLength > srcSize - ip || literalLength > dstSize - op) {
+            return false;
+        }
+        std::memcpy(dst + op, src + ip, literalLength);
+        ip += literalLength;
+        op += literalLength;
+
+        // The last sequence has no match
+        if (ip == srcSize) {
+            break;
+        }
+
+        if (srcSize - ip < 2) {
+            return false;
+        }
+        size_t offset = src[ip] | (static_cast<size_t>(src[ip + 1]) << 8);
+        ip += 2;
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !readLength(src, srcSize, ip, matchLength)) {
+            return false;
+        }
+        matchLength += LZ4_MIN_MATCH;
+        if (offset == 0 || offset > op || matchLength > dstSize - op) {
+            return false;
+        }
+
+        // Matches may overlap their own output, so copy byte by byte
+        const unsigned char* match = dst + op - offset;
+        for (size_t i = 0; i < matchLength; ++i) {
+            dst[op + i] = match[i];
+        }
+        op += matchLength;
+    }
+    return op == dstSize;
+}
+
+MappedFile::MappedFile()
+    : mappedData(nullptr), mappedSize(0),
+#ifdef _WIN32
+    fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr) {}
+#else
+    fileDescriptor(-1) {}
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+
+#ifdef _WIN32
+    fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+        close();
+        return false;
+    }
+
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mappingHandle) {
+        close();
+        return false;
+    }
+
+    mappedData = static_cast<const unsigned char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (!mappedData) {
+        close();
+        return false;
+    }
+    mappedSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+    fileDescriptor = ::open(path.c_str(), O_RDONLY);
+    if (fileDescriptor < 0) {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0) {
+        close();
+        return false;
+    }
+
+    void* data = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    if (data == MAP_FAILED) {
+        close();
+        return false;
+    }
+    mappedData = static_cast<const unsigned char*>(data);
+    mappedSize = static_cast<size_t>(fileStat.st_size);
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (mappedData) {
+        UnmapViewOfFile(mappedData);
+    }
+    if (mappingHandle) {
+        CloseHandle(mappingHandle);
+    }
+    if (fileHandle != INVALID_HANDLE_VALUE) {
+        CloseHandle(fileHandle);
+    }
+    mappingHandle = nullptr;
+    fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if (mappedData) {
+        munmap(const_cast<unsigned char*>(mappedData), mappedSize);
+    }
+    if (fileDescriptor >= 0) {
+        ::close(fileDescriptor);
+    }
+    fileDescriptor = -1;
+#endif
+    mappedData = nullptr;
+    mappedSize = 0;
+}
+
+const unsigned char* MappedFile::data() const {
+    return mappedData;
+}
+
+size_t MappedFile::size() const {
+    return mappedSize;
+}
+
+TextureCache::TextureCache(const std::string& directory)
+    : directory(directory), compressionEnabled(false), hitCount(0), missCount(0) {}
+
+bool TextureCache::load(const std::string& sourcePath, CachedImage& image) {
+    uint64_t sourceSize;
+    int64_t modifiedTime;
+    if (!statSource(sourcePath, sourceSize, modifiedTime)) {
+        return false;
+    }
+
+    auto mapping = std::make_shared<MappedFile>();
+    if (!mapping->open(entryPath(sourcePath))) {
+        missCount++;
+        return false;
+    }
+
+    // Reject entries from another version, for another file or for an older copy of this one
+    CacheHeader header;
+    if (mapping->size() < sizeof(header)) {
+        missCount++;
+        return false;
+    }
+    std::memcpy(&header, mapping->data(), sizeof(header));
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION ||
+        header.sourceSize != sourceSize || header.sourceModifiedTime != modifiedTime ||
+        header.pathLength != sourcePath.size() || sizeof(header) + header.pathLength > mapping->size() ||
+        sourcePath.compare(0, std::string::npos, reinterpret_cast<const char*>(mapping->data()) + sizeof(header), header.pathLength) != 0 ||
+        header.payloadOffset > mapping->size() || header.storedSize > mapping->size() - header.payloadOffset) {
+        missCount++;
+        return false;
+    }
+
+    image.width = header.width;
+    image.height = header.height;
+    image.components = header.components;
+    image.size = static_cast<size_t>(header.pixelSize);
+
+    const unsigned char* payload = mapping->data() + header.payloadOffset;
+    if (header.flags & CACHE_FLAG_LZ4) {
+        image.decompressed.resize(image.size);
+        if (!lz4Decompress(payload, static_cast<size_t>(header.storedSize), image.decompressed.data(), image.size)) {
+            std::cerr << "Corrupt texture cache entry for: " << sourcePath << std::endl;
+            image.decompressed.clear();
+            missCount++;
+            return false;
+        }
+        image.pixels = image.decompressed.data();
+        image.mapping.reset();
+    }
+    else {
+        if (header.storedSize != header.pixelSize) {
+            missCount++;
+            return false;
+        }
+        // Raw entries are used straight from the mapping; pages are read as the upload touches them
+        image.pixels = payload;
+        image.mapping = mapping;
+    }
+
+    hitCount++;
+    return true;
+}
+
+void TextureCache::store(const std::string& sourcePath, int width, int height, int components,
+    const unsigned char* pixels, size_t size) {
+    uint64_t sourceSize;
+    int64_t modifiedTime;
+    if (!statSource(sourcePath, sourceSize, modifiedTime)) {
+        return;
+    }
+
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+
+    CacheHeader header = {};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.sourceSize = sourceSize;
+    header.sourceModifiedTime = modifiedTime;
+    header.pathLength = static_cast<uint32_t>(sourcePath.size());
+    header.width = width;
+    header.height = height;
+    header.components = components;
+    header.pixelSize = size;
+    header.payloadOffset = (sizeof(header) + sourcePath.size() + PAYLOAD_ALIGNMENT - 1) / PAYLOAD_ALIGNMENT * PAYLOAD_ALIGNMENT;
+
+    // Keep the compressed payload only if it is worth the decompression on load
+    std::vector<unsigned char> compressed;
+    const unsigned char* payload = pixels;
+    header.storedSize = size;
+    if (compressionEnabled && size <= UINT32_MAX) {
+        lz4Compress(pixels, size, compressed);
+        if (compressed.size() < size * (1.0f - MIN_COMPRESSION_SAVING)) {
+            header.flags |= CACHE_FLAG_LZ4;
+            header.storedSize = compressed.size();
+            payload = compressed.data();
+        }
+    }
+
+    // Write to a temporary file and rename it so a crash never leaves a truncated entry behind
+    std::string path = entryPath(sourcePath);
+    std::string tempPath = path + ".tmp";
+    FILE* file = std::fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Failed to write texture cache entry: " << tempPath << std::endl;
+        return;
+    }
+
+    std::vector<unsigned char> padding(static_cast<size_t>(header.payloadOffset) - sizeof(header) - sourcePath.size(), 0);
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+        std::fwrite(sourcePath.data(), 1, sourcePath.size(), file) == sourcePath.size() &&
+        std::fwrite(padding.data(), 1, padding.size(), file) == padding.size() &&
+        std::fwrite(payload, 1, static_cast<size_t>(header.storedSize), file) == header.storedSize;
+    written = std::fclose(file) == 0 && written;
+
+    // rename doesn't replace an existing file on Windows
+    std::remove(path.c_str());
+    if (!written || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::cerr << "Failed to write texture cache entry: " << path << std::endl;
+        std::remove(tempPath.c_str());
+    }
+}
+
+void TextureCache::setCompressionEnabled(bool enabled) {
+    compressionEnabled = enabled;
+}
+
+bool TextureCache::isCompressionEnabled() const {
+    return compressionEnabled;
+}
+
+size_t TextureCache::getHitCount() const {
+    return hitCount;
+}
+
+size_t TextureCache::getMissCount() const {
+    return missCount;
+}
+
+bool TextureCache::statSource(const std::string& sourcePath, uint64_t& size, int64_t& modifiedTime) {
+#ifdef _WIN32
+    struct _stat64 fileStat;
+    if (_stat64(sourcePath.c_str(), &fileStat) != 0) {
+        return false;
+    }
+#else
+    struct stat fileStat;
+    if (stat(sourcePath.c_str(), &fileStat) != 0) {
+        return false;
+    }
+#endif
+    size = static_cast<uint64_t>(fileStat.st_size);
+    modifiedTime = static_cast<int64_t>(fileStat.st_mtime);
+    return true;
+}
+
+std::string TextureCache::entryPath(const std::string& sourcePath) const {
+    // FNV-1a hash of the source path; size and modification time are checked against the header
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : sourcePath) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.vtc", static_cast<unsigned long long>(hash));
+    return directory + "/" + name;
+}
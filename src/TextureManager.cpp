@@ -0,0 +1,526 @@
+#include "headers/TextureManager.h"
+#include "headers/stb_image.h"
+#include "headers/GLStateCache.h"
+#include "headers/GLDebug.h"
+#include <algorithm>
+
+// Largest mip size uploaded when a texture is first loaded
+static const int INITIAL_RESIDENT_SIZE = 128;
+
+// Upper bound of texel data streamed to the GPU per frame
+static const size_t MAX_UPLOAD_BYTES_PER_FRAME = 8 * 1024 * 1024;
+
+// Default texture memory budget
+static const size_t DEFAULT_BUDGET_BYTES = 256 * 1024 * 1024;
+
+TextureManager::TextureManager()
+    : residentBytes(0), committedBytes(0), budgetBytes(DEFAULT_BUDGET_BYTES), frameIndex(0), residencyVersion(0), stopLoader(false) {}
+
+TextureManager::~TextureManager() {
+    if (loaderThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(loadMutex);
+            stopLoader = true;
+        }
+        loadCondition.notify_all();
+        loaderThread.join();
+    }
+
+    for (auto& entry : textures) {
+        GLuint textureID = entry.first;
+        GLStateCache::get().forgetTexture(textureID);
+        glDeleteTextures(1, &textureID);
+    }
+    textures.clear();
+}
+
+TextureLayer TextureManager::requestTexture(const std::string& path, float priority) {
+    if (path.empty()) {
+        return TextureLayer{ 0, 0 };
+    }
+
+    auto it = requests.find(path);
+    if (it != requests.end() && (it->second.location.textureID != 0 || it->second.failed)) {
+        return it->second.location;
+    }
+    if (it == requests.end()) {
+        requests.emplace(path, TextureRequest{ TextureLayer{ 0, 0 }, false });
+    }
+
+    // Queue the image, or refresh its priority if it is still waiting for the loader thread
+    {
+        std::lock_guard<std::mutex> lock(loadMutex);
+        if (it == requests.end() || pendingLoads.count(path)) {
+            pendingLoads[path] = priority;
+        }
+    }
+    loadCondition.notify_one();
+
+    if (!loaderThread.joinable()) {
+        loaderThread = std::thread(&TextureManager::loaderLoop, this);
+    }
+    return TextureLayer{ 0, 0 };
+}
+
+void TextureManager::releaseTexture(const std::string& path) {
+    auto it = requests.find(path);
+    if (it == requests.end()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(loadMutex);
+        pendingLoads.erase(path);
+    }
+
+    // Free the layer; the array goes away once none of its layers is in use
+    GLuint textureID = it->second.location.textureID;
+    auto textureIt = textures.find(textureID);
+    if (textureIt != textures.end()) {
+        ManagedTexture& texture = textureIt->second;
+        texture.paths[it->second.location.layer].clear();
+        if (std::all_of(texture.paths.begin(), texture.paths.end(), [](const std::string& p) { return p.empty(); })) {
+            deleteTexture(textureID);
+        }
+    }
+    requests.erase(it);
+}
+
+void TextureManager::loaderLoop() {
+    // Flip the image vertically on load (only this thread decodes images)
+    stbi_set_flip_vertically_on_load(true);
+
+    while (true) {
+        std::string path;
+        {
+            std::unique_lock<std::mutex> lock(loadMutex);
+            loadCondition.wait(lock, [this]() { return stopLoader || !pendingLoads.empty(); });
+            if (stopLoader) {
+                return;
+            }
+
+            // Largest on-screen area first
+            auto next = pendingLoads.begin();
+            for (auto it = pendingLoads.begin(); it != pendingLoads.end(); ++it) {
+                if (it->second > next->second) {
+                    next = it;
+                }
+            }
+            path = next->first;
+            pendingLoads.erase(next);
+        }
+
+        DecodedImage image;
+        decodeImage(path, image);
+
+        std::lock_guard<std::mutex> lock(loadMutex);
+        finishedLoads.push_back(std::move(image));
+    }
+}
+
+void TextureManager::decodeImage(const std::string& path, DecodedImage& image) {
+    image.path = path;
+    image.data = nullptr;
+
+    // Images decoded on an earlier run come straight from the cache with their mips
+    if (textureCache.load(path, image.cached) &&
+        (image.cached.components == 1 || image.cached.components == 3 || image.cached.components == 4) &&
+        layoutMipChain(image.cached.width, image.cached.height, image.cached.components, image.mips) == image.cached.size) {
+        image.width = image.cached.width;
+        image.height = image.cached.height;
+        image.components = image.cached.components;
+        image.data = image.cached.pixels;
+        return;
+    }
+    image.mips.clear();
+    image.cached = CachedImage();
+
+    int width, height, nrComponents;
+    unsigned char* data = stbi_load(path.c_str(), &width, &height, &nrComponents, 0);
+    if (!data) {
+        std::cerr << "Failed to load texture at path: " << path << std::endl;
+        return;
+    }
+    if (nrComponents != 1 && nrComponents != 3 && nrComponents != 4) {
+        std::cerr << "Unknown number of components in texture: " << nrComponents << std::endl;
+        stbi_image_free(data);
+        return;
+    }
+
+    image.width = width;
+    image.height = height;
+    image.components = nrComponents;
+    buildMipChain(data, width, height, nrComponents, image.mips, image.pixels);
+    stbi_image_free(data);
+    image.data = image.pixels.data();
+
+    textureCache.store(path, width, height, nrComponents, image.pixels.data(), image.pixels.size());
+}
+
+void TextureManager::packImage(DecodedImage& image) {
+    // Images released or already packed while they were being decoded are dropped
+    auto requestIt = requests.find(image.path);
+    if (requestIt == requests.end() || requestIt->second.location.textureID != 0) {
+        return;
+    }
+    if (image.mips.empty()) {
+        requestIt->second.failed = true;
+        return;
+    }
+
+    // Add a layer to the array with the same source size and format, or start a new array
+    GLuint textureID = 0;
+    for (auto& entry : textures) {
+        const ManagedTexture& texture = entry.second;
+        if (texture.sourceWidth == image.width && texture.sourceHeight == image.height && texture.components == image.components) {
+            textureID = entry.first;
+            break;
+        }
+    }
+
+    if (textureID == 0) {
+        ManagedTexture texture;
+        texture.sourceWidth = image.width;
+        texture.sourceHeight = image.height;
+        texture.components = image.components;
+        texture.format = texture.components == 1 ? GL_RED : (texture.components == 3 ? GL_RGB : GL_RGBA);
+        texture.layers = 0;
+        texture.mips = image.mips;
+        for (TextureMip& mip : texture.mips) {
+            mip.offset = 0;
+            mip.size = 0;
+        }
+        texture.residentBase = static_cast<int>(texture.mips.size());
+        texture.requestedLevel = static_cast<int>(texture.mips.size()) - 1;
+
+        glGenTextures(1, &textureID);
+        GLStateCache::get().bindTextureForUpdate(GL_TEXTURE_2D_ARRAY, textureID);
+        GLDebug::setObjectLabel(GL_TEXTURE, textureID, image.path.c_str());  // Named after its first layer
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        textures.emplace(textureID, std::move(texture));
+    }
+    ManagedTexture& texture = textures[textureID];
+
+    // The layer count of every level changes, so the array starts over from its coarse levels
+    setResidentBase(textureID, texture, static_cast<int>(texture.mips.size()));
+    committedBytes -= texture.pixels.size();
+
+    // The array may have been downscaled; its chain lines up with the end of the image's chain
+    size_t levelShift = image.mips.size() - texture.mips.size();
+    std::vector<unsigned char> pixels;
+    size_t offset = 0;
+    for (size_t level = 0; level < texture.mips.size(); ++level) {
+        const TextureMip& imageMip = image.mips[level + levelShift];
+        TextureMip& mip = texture.mips[level];
+        size_t oldSize = mip.size;
+
+        pixels.resize(offset + oldSize + imageMip.size);
+        std::copy(texture.pixels.begin() + mip.offset, texture.pixels.begin() + mip.offset + oldSize, pixels.begin() + offset);
+        std::copy(image.data + imageMip.offset, image.data + imageMip.offset + imageMip.size, pixels.begin() + offset + oldSize);
+
+        mip.offset = offset;
+        mip.size = oldSize + imageMip.size;
+        offset += mip.size;
+    }
+    texture.pixels.swap(pixels);
+    texture.paths.push_back(image.path);
+    texture.layers++;
+
+    // Downscale arrays whose full chain would push the committed size past the budget
+    size_t available = budgetBytes > committedBytes ? budgetBytes - committedBytes : 0;
+    int droppedLevels = downscaleToFit(texture, available);
+    if (droppedLevels > 0) {
+        std::cout << "Texture array " << texture.sourceWidth << "x" << texture.sourceHeight << " downscaled to "
+            << texture.mips[0].width << "x" << texture.mips[0].height << " to fit the texture memory budget" << std::endl;
+    }
+    committedBytes += texture.pixels.size();
+
+    // Upload only the coarse end of the chain, finer levels are streamed on demand
+    int lastLevel = static_cast<int>(texture.mips.size()) - 1;
+    texture.residentBase = lastLevel + 1;
+    texture.lastUsedFrame = frameIndex;
+
+    // The coarse levels are uploaded even if no room can be made, they are the floor of every texture
+    makeRoom(texture.pixels.size() - texture.mips[coarseLevel(texture)].offset, textureID);
+    setResidentBase(textureID, texture, coarseLevel(texture));
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, lastLevel);
+
+    requestIt->second.location = TextureLayer{ textureID, texture.layers - 1 };
+    std::cout << "Texture " << image.path << " loaded into layer " << texture.layers - 1 << " of array " << textureID << " ("
+        << texture.mips[0].width << "x" << texture.mips[0].height << ", resident from mip " << texture.residentBase << " of " << lastLevel << ")" << std::endl;
+}
+
+void TextureManager::deleteTexture(GLuint textureID) {
+    auto it = textures.find(textureID);
+    if (it == textures.end()) {
+        return;
+    }
+
+    const ManagedTexture& texture = it->second;
+    for (int level = texture.residentBase; level < static_cast<int>(texture.mips.size()); ++level) {
+        residentBytes -= texture.mips[level].size;
+    }
+    committedBytes -= texture.pixels.size();
+
+    GLStateCache::get().forgetTexture(textureID);
+    glDeleteTextures(1, &textureID);
+    textures.erase(it);
+}
+
+void TextureManager::requestMipLevel(GLuint textureID, int level) {
+    auto it = textures.find(textureID);
+    if (it == textures.end()) {
+        return;
+    }
+
+    ManagedTexture& texture = it->second;
+    int lastLevel = static_cast<int>(texture.mips.size()) - 1;
+    level = std::max(0, std::min(level, lastLevel));
+    texture.requestedLevel = std::min(texture.requestedLevel, level);
+    texture.lastUsedFrame = frameIndex;
+}
+
+void TextureManager::update() {
+    // Pack the images the loader thread finished since the last frame
+    std::vector<DecodedImage> finished;
+    {
+        std::lock_guard<std::mutex> lock(loadMutex);
+        finished.swap(finishedLoads);
+    }
+    for (DecodedImage& image : finished) {
+        packImage(image);
+    }
+    if (!finished.empty()) {
+        residencyVersion++;
+    }
+
+    // Release levels nobody asked for (nothing drawn with a texture means its coarse levels are enough)
+    for (auto& entry : textures) {
+        ManagedTexture& texture = entry.second;
+        int target = std::min(texture.requestedLevel, coarseLevel(texture));
+
+        // Keep one level of hysteresis so zooming back and forth doesn't thrash uploads
+        if (target > texture.residentBase + 1) {
+            setResidentBase(entry.first, texture, texture.residentBase + 1);
+        }
+    }
+
+    // The budget may have been lowered since the last frame
+    makeRoom(0, 0);
+
+    // Stream in finer levels for the textures drawn this frame
+    size_t uploadedBytes = 0;
+    for (auto& entry : textures) {
+        ManagedTexture& texture = entry.second;
+        if (texture.lastUsedFrame != frameIndex) {
+            continue;
+        }
+        int target = std::min(texture.requestedLevel, coarseLevel(texture));
+        if (target >= texture.residentBase || uploadedBytes >= MAX_UPLOAD_BYTES_PER_FRAME) {
+            continue;
+        }
+
+        // An evicted texture gets its coarse levels back at once, otherwise one finer level per frame
+        int newBase = std::min(texture.residentBase - 1, coarseLevel(texture));
+        size_t bytes = texture.mips[texture.residentBase - 1].offset + texture.mips[texture.residentBase - 1].size
+            - texture.mips[newBase].offset;
+
+        if (makeRoom(bytes, entry.first)) {
+            setResidentBase(entry.first, texture, newBase);
+            uploadedBytes += bytes;
+        }
+    }
+
+    // Requests are collected again during the next frame
+    for (auto& entry : textures) {
+        entry.second.requestedLevel = static_cast<int>(entry.second.mips.size()) - 1;
+    }
+    frameIndex++;
+}
+
+bool TextureManager::isResident(GLuint textureID) const {
+    auto it = textures.find(textureID);
+    return it != textures.end() && it->second.residentBase < static_cast<int>(it->second.mips.size());
+}
+
+void TextureManager::setBudgetBytes(size_t bytes) {
+    budgetBytes = bytes;
+}
+
+size_t TextureManager::getBudgetBytes() const {
+    return budgetBytes;
+}
+
+int TextureManager::getTextureSize(GLuint textureID) const {
+    auto it = textures.find(textureID);
+    if (it == textures.end() || it->second.mips.empty()) {
+        return 0;
+    }
+    return std::max(it->second.mips[0].width, it->second.mips[0].height);
+}
+
+int TextureManager::getResidentLevel(GLuint textureID) const {
+    auto it = textures.find(textureID);
+    if (it == textures.end()) {
+        return -1;
+    }
+    return it->second.residentBase;
+}
+
+size_t TextureManager::getResidentBytes() const {
+    return residentBytes;
+}
+
+unsigned int TextureManager::getResidencyVersion() const {
+    return residencyVersion;
+}
+
+size_t TextureManager::getPendingLoadCount() const {
+    size_t count = 0;
+    for (const auto& entry : requests) {
+        if (entry.second.location.textureID == 0 && !entry.second.failed) {
+            count++;
+        }
+    }
+    return count;
+}
+
+TextureCache& TextureManager::getTextureCache() {
+    return textureCache;
+}
+
+void TextureManager::setResidentBase(GLuint textureID, ManagedTexture& texture, int newBase) {
+    if (newBase == texture.residentBase) {
+        return;
+    }
+    residencyVersion++;
+
+    GLStateCache::get().bindTextureForUpdate(GL_TEXTURE_2D_ARRAY, textureID);
+    for (int level = texture.residentBase - 1; level >= newBase; --level) {
+        uploadLevel(texture, level);
+    }
+    for (int level = texture.residentBase; level < newBase; ++level) {
+        dropLevel(texture, level);
+    }
+
+    texture.residentBase = newBase;
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, newBase);
+}
+
+void TextureManager::uploadLevel(const ManagedTexture& texture, int level) {
+    const TextureMip& mip = texture.mips[level];
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // Rows of RGB and single channel images are not 4-byte aligned
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, level, texture.format, mip.width, mip.height, texture.layers, 0,
+        texture.format, GL_UNSIGNED_BYTE, texture.pixels.data() + mip.offset);
+    residentBytes += mip.size;
+}
+
+void TextureManager::dropLevel(const ManagedTexture& texture, int level) {
+    // Re-specifying a level as 0x0 releases its storage; it lies outside BASE_LEVEL so the texture stays complete
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, level, texture.format, 0, 0, 0, 0, texture.format, GL_UNSIGNED_BYTE, nullptr);
+    residentBytes -= texture.mips[level].size;
+}
+
+bool TextureManager::makeRoom(size_t bytes, GLuint requester) {
+    while (residentBytes + bytes > budgetBytes) {
+        // Least recently drawn texture that still has something to give up
+        GLuint victimID = 0;
+        ManagedTexture* victim = nullptr;
+        for (auto& entry : textures) {
+            ManagedTexture& texture = entry.second;
+            bool drawnThisFrame = texture.lastUsedFrame == frameIndex;
+            int floorLevel = drawnThisFrame ? coarseLevel(texture) : static_cast<int>(texture.mips.size());
+            if (entry.first == requester || texture.residentBase >= floorLevel) {
+                continue;
+            }
+
+            // Ties go to the texture with the largest resident level
+            if (!victim || texture.lastUsedFrame < victim->lastUsedFrame ||
+                (texture.lastUsedFrame == victim->lastUsedFrame &&
+                    texture.mips[texture.residentBase].size > victim->mips[victim->residentBase].size)) {
+                victimID = entry.first;
+                victim = &texture;
+            }
+        }
+
+        if (!victim) {
+            return false;
+        }
+
+        // Drop the finest level; once only the coarse levels are left the texture is evicted entirely
+        int newBase = victim->residentBase < coarseLevel(*victim) ? victim->residentBase + 1 : static_cast<int>(victim->mips.size());
+        setResidentBase(victimID, *victim, newBase);
+    }
+    return true;
+}
+
+int TextureManager::downscaleToFit(ManagedTexture& texture, size_t maxBytes) {
+    int droppedLevels = 0;
+    while (texture.pixels.size() > maxBytes && coarseLevel(texture) > 0) {
+        // Remove the top level and shift the remaining ones to the start of the blob
+        size_t topSize = texture.mips[0].size;
+        texture.pixels.erase(texture.pixels.begin(), texture.pixels.begin() + topSize);
+        texture.mips.erase(texture.mips.begin());
+        for (TextureMip& mip : texture.mips) {
+            mip.offset -= topSize;
+        }
+        droppedLevels++;
+    }
+    return droppedLevels;
+}
+
+void TextureManager::buildMipChain(const unsigned char* data, int width, int height, int components,
+    std::vector<TextureMip>& mips, std::vector<unsigned char>& pixels) {
+    pixels.resize(layoutMipChain(width, height, components, mips));
+    std::copy(data, data + mips[0].size, pixels.begin());
+
+    // Each level averages a 2x2 block of the previous one (edge texels are reused for odd sizes)
+    for (size_t level = 1; level < mips.size(); ++level) {
+        const TextureMip& src = mips[level - 1];
+        const TextureMip& dst = mips[level];
+        const unsigned char* srcPixels = pixels.data() + src.offset;
+        unsigned char* dstPixels = pixels.data() + dst.offset;
+
+        for (int y = 0; y < dst.height; ++y) {
+            int y0 = std::min(y * 2, src.height - 1);
+            int y1 = std::min(y * 2 + 1, src.height - 1);
+            for (int x = 0; x < dst.width; ++x) {
+                int x0 = std::min(x * 2, src.width - 1);
+                int x1 = std::min(x * 2 + 1, src.width - 1);
+                for (int c = 0; c < components; ++c) {
+                    int sum = srcPixels[(y0 * src.width + x0) * components + c]
+                        + srcPixels[(y0 * src.width + x1) * components + c]
+                        + srcPixels[(y1 * src.width + x0) * components + c]
+                        + srcPixels[(y1 * src.width + x1) * components + c];
+                    dstPixels[(y * dst.width + x) * components + c] = static_cast<unsigned char>((sum + 2) / 4);
+                }
+            }
+        }
+    }
+}
+
+size_t TextureManager::layoutMipChain(int width, int height, int components, std::vector<TextureMip>& mips) {
+    // Lay out every level in one blob, finest first
+    size_t totalSize = 0;
+    for (int w = width, h = height; ; w = std::max(1, w / 2), h = std::max(1, h / 2)) {
+        TextureMip mip = { w, h, totalSize, static_cast<size_t>(w) * h * components };
+        mips.push_back(mip);
+        totalSize += mip.size;
+        if (w == 1 && h == 1) {
+            break;
+        }
+    }
+    return totalSize;
+}
+
+int TextureManager::coarseLevel(const ManagedTexture& texture) {
+    for (size_t level = 0; level < texture.mips.size(); ++level) {
+        if (std::max(texture.mips[level].width, texture.mips[level].height) <= INITIAL_RESIDENT_SIZE) {
+            return static_cast<int>(level);
+        }
+    }
+    return static_cast<int>(texture.mips.size()) - 1;
+}
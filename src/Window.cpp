@@ -1,5 +1,6 @@
 #include "headers/Window.h"
 #include <GL/glew.h>
+#include "headers/GLDebug.h"
 #include <iostream>
 
 Window::Window(int width, int height)
@@ -24,6 +25,9 @@ bool Window::init() {
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);            // Enable double buffering
     SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);             // Depth buffer size
+#if GL_DEBUG_LAYER
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);  // Let the driver report errors through KHR_debug
+#endif
 
     // Create the SDL window with OpenGL context
     window = SDL_CreateWindow("ViewMe", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
@@ -17,6 +17,9 @@ public:
     glm::vec3 getPosition() const;
     bool isMouseHeld() const;  // Add this function to check if the mouse is held
 
+    // Changes whenever the camera moves
+    unsigned int getVersion() const;
+
 private:
     void updateCameraVectors();
 
@@ -32,6 +35,7 @@ private:
 
     float distanceFromTarget;
     bool mouseHeld;  // This boolean tracks whether the mouse button is pressed
+    unsigned int version;
 };
 
 #endif
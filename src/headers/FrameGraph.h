@@ -0,0 +1,87 @@
+#pragma once
+#ifndef FRAMEGRAPH_H
+#define FRAMEGRAPH_H
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+// Runs a pass: binds its targets and issues its draws
+typedef void (*PassFunction)(void* context);
+
+// Timings of one pass, averaged over the last frames it ran in
+struct PassStats {
+    std::string name;
+    bool culled;   // Did not run last frame, nothing used its outputs
+    double cpuMs;
+    double gpuMs;  // Measured with timer queries, read back a few frames late
+};
+
+// Passes of one frame with the resources they read and write. Passes are declared in execution
+// order each frame; compiling culls every pass whose outputs no live pass reads and that doesn't
+// write a graph output, and execute() runs what is left, once per frame
+class FrameGraph {
+public:
+    FrameGraph();
+    ~FrameGraph();
+
+    // Forgets the passes of the last frame; resources stay declared
+    void beginFrame();
+
+    // Declares a resource (render target, texture); returns its handle. Declaring a name again returns the same handle
+    int addResource(const std::string& name);
+
+    // Marks a resource as leaving the graph (presented), the passes writing it are kept
+    void markOutput(int resource);
+
+    // Declares the next pass
+    void addPass(const std::string& name, const std::vector<int>& inputs, const std::vector<int>& outputs,
+        PassFunction execute, void* context);
+
+    // Culls the unused passes and runs the others in declaration order, timing each one.
+    // A second call in the same frame is refused, the frame has already been submitted
+    void execute();
+
+    // Passes of the last frame, culled ones included
+    const std::vector<PassStats>& getPassStats() const;
+
+    void cleanup();
+
+private:
+    // Timer queries of a pass, used round robin so results are read once the GPU is done with them
+    static const int TIMER_QUERY_COUNT = 4;
+
+    struct Pass {
+        std::string name;
+        std::vector<int> inputs;
+        std::vector<int> outputs;
+        PassFunction execute;
+        void* context;
+        bool live;
+    };
+
+    // Timing state kept across frames, found by pass name
+    struct PassTimer {
+        std::string name;
+        GLuint queries[TIMER_QUERY_COUNT];
+        bool pending[TIMER_QUERY_COUNT];
+        int next;
+        double cpuMs;
+        double gpuMs;
+    };
+
+    // Marks the passes that contribute to a graph output
+    void cullPasses();
+
+    PassTimer& getTimer(const std::string& name);
+
+    std::vector<std::string> resources;
+    std::vector<bool> graphOutputs;
+    std::vector<Pass> passes;
+    std::vector<PassTimer> timers;
+    std::vector<PassStats> stats;
+    bool executed;
+};
+
+#endif // FRAMEGRAPH_H
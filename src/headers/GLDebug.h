@@ -0,0 +1,66 @@
+#pragma once
+#ifndef GLDEBUG_H
+#define GLDEBUG_H
+
+#include <GL/glew.h>
+#include <cstddef>
+
+// Build option: GL diagnostics are compiled into debug builds only. Define GL_DEBUG_LAYER
+// to 1 or 0 (e.g. in the project's preprocessor definitions) to force them on or off
+#ifndef GL_DEBUG_LAYER
+#ifdef NDEBUG
+#define GL_DEBUG_LAYER 0
+#else
+#define GL_DEBUG_LAYER 1
+#endif
+#endif
+
+#if GL_DEBUG_LAYER
+
+// GL error and diagnostics reporting. Uses the KHR_debug message callback when the context
+// offers it, so errors are reported by the driver without any glGetError round trip; without
+// it, checkErrors falls back to draining glGetError
+class GLDebug {
+public:
+    // Installs the message callback if KHR_debug is available; call once after GLEW is initialized
+    static void init();
+
+    // Whether the driver reports messages through the callback
+    static bool isCallbackActive();
+
+    // Messages below this severity are dropped by the driver (GL_DEBUG_SEVERITY_HIGH/MEDIUM/LOW/NOTIFICATION)
+    static void setMinimumSeverity(GLenum severity);
+    static GLenum getMinimumSeverity();
+
+    // Names an object in the driver's messages (identifier is GL_BUFFER, GL_TEXTURE, GL_PROGRAM, ...).
+    // The object must have been bound or created before it can be labeled
+    static void setObjectLabel(GLenum identifier, GLuint name, const char* label);
+
+    // Reports pending GL errors; a no-op when the callback is active
+    static void checkErrors(const char* where);
+
+    // Messages reported since init
+    static size_t getMessageCount();
+
+private:
+    static void GLAPIENTRY onMessage(GLenum source, GLenum type, GLuint id, GLenum severity,
+        GLsizei length, const GLchar* message, GLvoid* userParam);
+};
+
+#else
+
+// Release builds: every check compiles to nothing
+class GLDebug {
+public:
+    static void init() {}
+    static bool isCallbackActive() { return false; }
+    static void setMinimumSeverity(GLenum) {}
+    static GLenum getMinimumSeverity() { return GL_DEBUG_SEVERITY_HIGH; }
+    static void setObjectLabel(GLenum, GLuint, const char*) {}
+    static void checkErrors(const char*) {}
+    static size_t getMessageCount() { return 0; }
+};
+
+#endif // GL_DEBUG_LAYER
+
+#endif // GLDEBUG_H
@@ -0,0 +1,102 @@
+#pragma once
+#ifndef GLSTATECACHE_H
+#define GLSTATECACHE_H
+
+#include <GL/glew.h>
+#include <vector>
+#include <cstddef>
+
+// Texture unit used to upload and configure textures; the draws sample from units 1 and up
+const GLuint UPDATE_TEXTURE_UNIT = 0;
+
+// Shadow copy of the GL state the renderer changes. Every bind, enable and viewport change goes
+// through here so calls that would set what is already set are dropped; the issued and filtered
+// calls are counted per frame for the stats overlay.
+// There is a single GL context, so there is a single cache
+class GLStateCache {
+public:
+    static GLStateCache& get();
+
+    // Starts a new frame: publishes the counters of the last one and forgets the tracked state,
+    // since code outside the renderer (ImGui) may have changed it in between
+    void beginFrame();
+
+    // Forgets the tracked state; the next call of each kind is always issued
+    void invalidate();
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    void bindFramebuffer(GLuint framebuffer);
+    void setViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+    // Sets count viewports (x, y, width, height each) for geometry shaders that pick one with gl_ViewportIndex.
+    // Always issued; the next setViewport is too, so it resets every viewport again
+    void setViewportArray(GLsizei count, const GLfloat* viewports);
+    void setEnabled(GLenum capability, bool enabled);
+
+    // Binds a texture to a texture unit for drawing, switching the active unit only if the binding changes
+    void bindTexture(GLuint unit, GLenum target, GLuint texture);
+
+    // Binds a texture to be uploaded to or changed: uses UPDATE_TEXTURE_UNIT, which no draw samples from,
+    // and leaves it active so glTex* calls reach the texture
+    void bindTextureForUpdate(GLenum target, GLuint texture);
+
+    // Binds a buffer to an indexed binding point (GL_UNIFORM_BUFFER)
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+
+    // Must be called before an object is deleted, its name may be handed out again
+    void forgetProgram(GLuint program);
+    void forgetVertexArray(GLuint vao);
+    void forgetFramebuffer(GLuint framebuffer);
+    void forgetTexture(GLuint texture);
+    void forgetBuffer(GLuint buffer);
+
+    // Calls sent to GL and calls dropped as redundant during the last complete frame
+    size_t getIssuedCalls() const;
+    size_t getFilteredCalls() const;
+
+private:
+    GLStateCache();
+
+    // Texture bound to one target of one unit
+    struct TextureBinding {
+        GLuint unit;
+        GLenum target;
+        GLuint texture;
+    };
+
+    // Buffer bound to one indexed binding point
+    struct BufferBinding {
+        GLenum target;
+        GLuint index;
+        GLuint buffer;
+    };
+
+    // Capability switched through setEnabled
+    struct Capability {
+        GLenum capability;
+        bool enabled;
+    };
+
+    // Counts the call and returns true if it has to be sent to GL
+    bool track(bool changed);
+
+    // Makes a texture unit the active one
+    void setActiveUnit(GLuint unit);
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint framebuffer;
+    GLint viewport[4];
+    bool programKnown, vertexArrayKnown, framebufferKnown, viewportKnown;
+    GLuint activeUnit;
+    bool activeUnitKnown;
+    std::vector<TextureBinding> textureBindings;
+    std::vector<BufferBinding> bufferBindings;
+    std::vector<Capability> capabilities;
+
+    size_t issuedCalls, filteredCalls;          // Current frame
+    size_t lastIssuedCalls, lastFilteredCalls;  // Last complete frame
+};
+
+#endif // GLSTATECACHE_H
@@ -18,7 +18,11 @@ public:
     ImGuiApp();
     ~ImGuiApp();
     bool Init(Window* window);
+    // Builds this frame's UI; no GL calls are made until the renderer's UI pass runs RenderDrawData
     void Run(Renderer* renderer, Model* model);
+
+    // UI pass of the frame graph: draws the UI built by Run
+    static void RenderDrawData(void* context);
     void Cleanup();
 
 private:
@@ -7,8 +7,8 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <iostream>
-#include "Lights.h"
 #include "ShadowMap.h"
+#include "shader.hpp"
 #include <vector>
 
 
@@ -21,15 +21,12 @@ public:
     void setHeight(float height);
 
     // Render the ground
-    void renderGround(GLuint shaderProgram, const glm::mat4& view, const glm::mat4& projection,
-        std::vector<Lights>& directionalLights,
-        std::vector<Lights>& pointLights,
-        std::vector<Lights>& spotLights,
-        glm::vec3 backgroundcolor, ShadowMap& shadowMap, bool shadowsEnabled = true);
+    // Camera, lights and shadow settings come from the shared uniform buffers (see SceneUniforms)
+    void renderGround(const ShaderProgram& shaderProgram, glm::vec3 backgroundcolor, ShadowMap& shadowMap);
 
-    void initGround(GLuint shaderProgram);
+    void initGround(const ShaderProgram& shaderProgram);
 
-    void setShader(GLuint shaderProgram);
+    void setShader(const ShaderProgram& shaderProgram);
 
     void DrawGround();
 
@@ -41,13 +38,10 @@ private:
     GLuint VAO, VBO, EBO;  // OpenGL buffers for the ground
     float groundHeight;    // Ground's vertical position (Y-coordinate)
 
-    GLuint GroundShaderID;
+    const ShaderProgram* groundShader;
 
-    void renderGroundLights(std::vector<Lights>& directionalLights, std::vector<Lights>& pointLights, std::vector<Lights>& spotLights);
     void setupBuffers();
     glm::mat4 calculateGroundMatrix() const;
-    glm::mat4 calculateMVP(const glm::mat4& modelMatrix, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix);
-    void sendMatrixToShader(GLuint shaderProgram, glm::mat4 MVP, const glm::mat4& view);
 
     glm::mat4 modelMatrix; // Model matrix for the ground
 };
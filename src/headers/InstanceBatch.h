@@ -0,0 +1,66 @@
+#pragma once
+#ifndef INSTANCEBATCH_H
+#define INSTANCEBATCH_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "Model.h"
+
+// Copies of one model, each with its own transform and tint, drawn with one instanced call per pass.
+// The instance data lives in a vertex buffer that is only re-uploaded when the instances change
+class InstanceBatch {
+public:
+    InstanceBatch(Model& model);
+    ~InstanceBatch();
+    InstanceBatch(const InstanceBatch&) = delete;
+    InstanceBatch& operator=(const InstanceBatch&) = delete;
+
+    // Replaces the instances; tints are optional (white when missing)
+    void setInstances(const std::vector<glm::mat4>& transforms, const std::vector<glm::vec4>& tints = std::vector<glm::vec4>());
+    void clear();
+
+    // Transform of the model itself (the draw's model matrix), applied before each instance's placement
+    void setTransform(const glm::mat4& transform);
+    const glm::mat4& getTransform() const;
+
+    size_t getInstanceCount() const;
+    Model& getModel() const;
+
+    // World-space bounding sphere of the instance nearest to the given point (for texture streaming);
+    // returns false if the batch is empty
+    bool getNearestInstanceSphere(const glm::vec3& point, glm::vec3& center, float& radius) const;
+
+    // World-space box around every instance; returns false if the batch is empty
+    bool getWorldBounds(glm::vec3& worldMin, glm::vec3& worldMax) const;
+
+    // Incremented whenever the instances or the batch transform change
+    unsigned int getVersion() const;
+
+    // Draws every instance for the main pass or the depth-only shadow pass; the program's model
+    // matrix must hold the batch transform
+    void draw() const;
+    void drawDepthOnly() const;
+
+    void cleanup();
+
+private:
+    // Uploads the instances if they changed since the last draw
+    void upload() const;
+
+    Model& model;
+    std::vector<InstanceData> instances;
+    glm::mat4 transform;
+    unsigned int version;
+
+    mutable GLuint instanceBuffer;
+    mutable size_t bufferCapacity;  // Instances the buffer has room for
+    mutable bool dirty;
+
+    // World bounds, recomputed when the version changes
+    mutable glm::vec3 boundsMin;
+    mutable glm::vec3 boundsMax;
+    mutable unsigned int boundsVersion;
+};
+
+#endif // INSTANCEBATCH_H
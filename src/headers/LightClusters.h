@@ -0,0 +1,134 @@
+#pragma once
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "Lights.h"
+#include "SceneUniforms.h"
+
+// Spot and point lights the clusters can hold
+const int MAX_LOCAL_LIGHTS = 1024;
+
+// Froxel grid: screen tiles along x and y, depth slices (exponentially spaced) along z
+const int CLUSTER_GRID_X = 16;
+const int CLUSTER_GRID_Y = 9;
+const int CLUSTER_GRID_Z = 24;
+const int CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+
+// Lights kept per cluster, any beyond this are dropped from it
+const int MAX_LIGHTS_PER_CLUSTER = 128;
+
+// Lights a draw's own list holds; draws reached by more shade the lights of their fragments' clusters
+const int MAX_DRAW_LIGHTS = 16;
+
+// Texture units of the buffer textures, after the shadow moments (8)
+const GLuint LOCAL_LIGHT_TEXTURE_UNIT = 9;
+const GLuint CLUSTER_RANGE_TEXTURE_UNIT = 10;
+const GLuint CLUSTER_INDEX_TEXTURE_UNIT = 11;
+
+// Type of a local light, this must match LOCAL_LIGHT_* in the shaders
+enum class LocalLightType {
+    POINT = 0,
+    SPOT = 1
+};
+
+// One light of the localLights buffer texture, LOCAL_LIGHT_TEXELS texels in the shaders
+struct LocalLightData {
+    glm::vec4 positionRange;         // World position (xyz) and range (w)
+    glm::vec4 directionCutOff;       // Spot direction (xyz) and inner cone cosine (w)
+    glm::vec4 intensityOuterCutOff;  // Intensity (rgb) and outer cone cosine (w)
+    glm::vec4 ambientConstant;       // Ambient color (rgb) and constant attenuation (w)
+    glm::vec4 specularLinear;        // Specular color (rgb) and linear attenuation (w)
+    glm::vec4 quadraticTypeShadow;   // Quadratic attenuation (x), LocalLightType (y) and shadow slot (z, -1 if unshadowed)
+};
+
+// Spot and point lights whose range and cone reach one draw, as indices into the packed lights;
+// set per draw as drawLightCount and drawLights[] in the shaders
+struct DrawLightList {
+    int count;  // -1 when more than MAX_DRAW_LIGHTS lights reach the draw
+    GLint indices[MAX_DRAW_LIGHTS];
+};
+
+// ClusterBlock in the shaders (std140 layout)
+struct ClusterBlockData {
+    glm::vec4 clusterScale;  // Clusters per pixel (xy), slices per log view depth (z) and slice offset (w)
+    glm::ivec4 clusterGrid;  // Clusters along x, y and z (xyz) and local lights (w)
+    glm::vec4 localAmbient;  // Sum of the local lights' ambient colors (rgb)
+};
+
+// Clustered forward lighting for the spot and point lights. Every frame the lights' spheres of influence are
+// binned on the CPU into a grid of view frustum cells (froxels); the lights, the first index and count of
+// each cluster and the packed index lists go to buffer textures, and each fragment only evaluates the lights
+// of its own cluster. The first MAX_LIGHTS lights of each type keep their shadows (shadow atlas and cube maps)
+class LightClusters {
+public:
+    LightClusters();
+    ~LightClusters();
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    // Creates the buffers, their buffer textures and the uniform buffer
+    void init();
+
+    // Packs the spot lights, then the point lights, and bins them into the clusters of the view;
+    // each buffer is only re-uploaded when its contents changed
+    void update(const std::vector<Lights>& spotLights, const std::vector<Lights>& pointLights, const glm::mat4& view,
+        const glm::mat4& projection, int viewportWidth, int viewportHeight);
+
+    // Lists the lights of the last update that can reach a world-space box: its distance to the light
+    // within the range the attenuation cuts off at and, for spot lights, its bounding sphere inside the cone
+    void cullLights(const glm::vec3& worldMin, const glm::vec3& worldMax, DrawLightList& list) const;
+
+    // Binds the buffer textures to their units for the lighting passes
+    void bindForLightingPass() const;
+
+    // Statistics of the last update
+    int getLightCount() const;
+    size_t getIndexCount() const;
+    int getMaxClusterLightCount() const;
+    int getOccupiedClusterCount() const;
+
+    void cleanup();
+
+private:
+    // Builds the cluster ranges and the index lists from the lights' view-space spheres
+    void assignClusters(const glm::mat4& view, const glm::mat4& projection);
+
+    // Uploads data to a texture buffer, growing it if needed
+    static void uploadBuffer(GLuint buffer, size_t& capacity, const void* data, size_t size);
+
+    GLuint lightBuffer, lightTexture;
+    GLuint rangeBuffer, rangeTexture;
+    GLuint indexBuffer, indexTexture;
+    GLuint ubo;
+    size_t lightCapacity, rangeCapacity, indexCapacity;  // Bytes allocated
+    size_t maxIndexCount;                                // Limited by GL_MAX_TEXTURE_BUFFER_SIZE
+
+    // Contents of the current frame and of the last upload
+    std::vector<LocalLightData> lights;
+    std::vector<glm::uvec2> clusterRanges;  // First index and count of each cluster
+    std::vector<GLushort> clusterIndices;
+    std::vector<LocalLightData> uploadedLights;
+    std::vector<glm::uvec2> uploadedRanges;
+    std::vector<GLushort> uploadedIndices;
+    ClusterBlockData blockData;
+    bool uploaded;
+
+    // Binning scratch: view-space spheres (structure of arrays, each slice streams through them)
+    // and the tiles each light covers in each slice
+    struct ClusterSpan {
+        int light;
+        int slice;
+        int x0, x1, y0, y1;
+    };
+    std::vector<float> sphereX, sphereY, sphereDepth, sphereRadius;
+    std::vector<ClusterSpan> spans;
+    std::vector<unsigned int> clusterCounts;
+
+    int maxClusterLightCount;
+    int occupiedClusterCount;
+};
+
+#endif // LIGHTCLUSTERS_H
@@ -7,6 +7,9 @@
 #include <string>
 #include <vector>
 
+// Farthest a point or spot light's range (and its shadow) reaches
+const float MAX_LIGHT_RANGE = 100.0f;
+
 // Types of lights
 enum class LightType {
     DIRECTIONAL,
@@ -39,21 +42,26 @@ public:
     float getCutOff() const;
     float getOuterCutOff() const;
 
+    // Distance where the attenuation brings the light below 1/256 of its intensity, at most MAX_LIGHT_RANGE
+    // (for point and spot lights; lights without attenuation reach MAX_LIGHT_RANGE). 0 if the light
+    // never gets above that, such lights are skipped
+    float getRange() const;
+
     // For spotlights
     void setCutOff(float cutOff);
     void setOuterCutOff(float outerCutOff);
 
-    // Send the light properties to the shader
-    void sendToShader(GLuint programID, const std::string& lightName);
-
-    void enableDirectionalLights(GLuint programID, int i);
-    void enablePointLights(GLuint programID, int i);
-    void enableSpotLights(GLuint programID, int i);
+    // Changes whenever a setter is called; unique across all lights so copies can be compared
+    unsigned int getVersion() const;
 
     LightType getLightType()const;
 
 private:
+    // Marks the light as changed
+    void touch();
+
     LightType type;
+    unsigned int version;
 
     // Common light properties
     glm::vec3 position;
@@ -10,20 +10,77 @@
 #include "stb_image.h"
 #include "tiny_obj_loader.h"
 #include "shader.hpp"
+#include "TextureManager.h"
+
+// Material buffer limits, these must match frag.glsl
+const int MAX_MATERIALS = 256;
+const int MAX_TEXTURE_ARRAYS = 4;
+
+// Uniform buffer binding point of the material buffer
+const GLuint MATERIAL_BLOCK_BINDING = 0;
+
+// Texture units used by the material texture arrays (unit 1 holds the shadow map)
+const GLuint FIRST_MATERIAL_TEXTURE_UNIT = 2;
 
 struct MaterialData {
     glm::vec3 diffuseColor;
     glm::vec3 specularColor;
     float shininess;
-    GLuint diffuseTextureID;
+    GLuint diffuseTextureID;   // Array texture holding the diffuse map
+    int diffuseTextureLayer;   // Layer of the diffuse map inside the array
+    int diffuseTextureSlot;    // Texture unit slot of the array, -1 if there is no texture
     GLuint specularTextureID;
 };
 
+// One material in the shader's material buffer (std140 layout)
+struct MaterialBlockEntry {
+    glm::vec4 diffuseColor;   // rgb, w unused
+    glm::vec4 specularColor;  // rgb + shininess in w
+    glm::ivec4 texture;       // x = texture array slot (-1 = use the diffuse color), y = layer
+};
+
+// Vertex attribute carrying the material index of a draw (per instance with multi-draw indirect, per vertex otherwise)
+const GLuint MATERIAL_INDEX_ATTRIBUTE = 3;
+
+// Per-instance vertex attributes of instanced draws, these must match vert.glsl and shadowVert.glsl.
+// Non-instanced draws leave them disabled and read the defaults (identity, white) set by setDefaultInstanceAttributes
+const GLuint INSTANCE_TRANSFORM_ATTRIBUTE = 4;  // mat4, takes four locations
+const GLuint INSTANCE_TINT_ATTRIBUTE = 8;
+
+// One instance in an instance buffer
+struct InstanceData {
+    glm::mat4 transform;  // Placement of the copy, applied after the draw's model matrix
+    glm::vec4 tint;       // Multiplies the diffuse color
+};
+
+// Run of consecutive faces sharing one material, drawn as one command
+struct DrawRange {
+    GLsizei count;      // Number of indices
+    GLuint firstIndex;  // First index in the element buffer
+    int materialID;
+};
+
+// Layout of one glMultiDrawElementsIndirect command
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLuint baseVertex;
+    GLuint baseInstance;  // Index of the range, selects its material index
+};
+
+// Commands submitted with one multi-draw call; only arrays sharing the last texture slot need their own group
+struct DrawGroup {
+    GLuint textureArray;  // Array to bind to the last slot first, 0 if nothing needs rebinding
+    size_t firstCommand;
+    GLsizei commandCount;
+};
+
 
 class Model {
 public:
-    // Constructor: Loads a model from the given OBJ file
-    Model(const std::string& filepath);
+    // Constructor: Loads a model from the given OBJ file, textures are owned by the texture manager
+    Model(const std::string& filepath, TextureManager& textureManager);
 
     // Destructor: Cleans up allocated resources
     ~Model();
@@ -31,8 +88,26 @@ public:
     // Reload a new model at runtime
     bool reloadModel(const std::string& filepath);
 
-    // Renders the model
-    void draw(GLuint programID) const;
+    // Renders the model: every material range is submitted with one multi-draw call (one per extra
+    // texture array sharing the last slot), each range reading its material index from a vertex attribute
+    void draw() const;
+
+    // Renders the geometry alone for depth-only passes: positions only, the whole mesh in one draw call,
+    // no materials or textures
+    void drawDepthOnly() const;
+
+    // Instanced versions of draw and drawDepthOnly: every instance in the buffer (InstanceData entries)
+    // is drawn with glDrawElementsInstanced, one call per run of consecutive ranges whose materials sample
+    // the same texture array slot
+    void drawInstanced(GLuint instanceBuffer, GLsizei instanceCount) const;
+    void drawDepthOnlyInstanced(GLuint instanceBuffer, GLsizei instanceCount) const;
+
+    // Drops the instanced vertex arrays' reference to an instance buffer about to be deleted
+    void forgetInstanceBuffer(GLuint instanceBuffer) const;
+
+    // Sets the values the instance attributes read when their arrays are disabled; call once after GL is
+    // initialized, the instanced draws restore them after sourcing the attributes from arrays
+    static void setDefaultInstanceAttributes();
 
     // Returns the model's transformation matrix
     glm::mat4 getModelMatrix() const;
@@ -46,6 +121,9 @@ public:
     // Sets the model's scale
     void setScale(const glm::vec3& scale);
 
+    // Incremented whenever the transform or the loaded geometry changes
+    unsigned int getVersion() const;
+
     // Gets the texture ID for the given material index
     GLuint getTextureID(size_t materialIndex) const;
 
@@ -55,13 +133,41 @@ public:
     // Returns the current position of the model
     glm::vec3 getPosition() const;
 
+    // Returns the current scale of the model
+    glm::vec3 getScale() const;
+
     // Gets the diffuse color from the material if no texture is available
     glm::vec3 getMaterialDiffuseColor(size_t materialIndex) const;
 
     std::vector<MaterialData> getModelMaterials() const;
 
+    size_t getMaterialCount() const;
+
+    // UV units per model-space unit for the given material (for mip selection)
+    float getMaterialUVDensity(size_t materialIndex) const;
+
+    // Model-space surface area covered by the given material
+    float getMaterialSurfaceArea(size_t materialIndex) const;
+
+    // Requests the material's texture, loaded largest priority first; the material is drawn
+    // with its diffuse color until the texture is available
+    void requestTexture(size_t materialIndex, float priority);
+
+    // World-space bounding sphere of the transformed model
+    void getBoundingSphere(glm::vec3& center, float& radius) const;
+
+    // Model-space bounding sphere, before the model's own transform
+    void getLocalBoundingSphere(glm::vec3& center, float& radius) const;
+
+    // World-space box around the model's bounds under the given transform
+    void getWorldBounds(const glm::mat4& transform, glm::vec3& worldMin, glm::vec3& worldMax) const;
+
     GLuint getVAO() const;
 
+    // Material buffer and first texture array, used to sort draws that share them together
+    GLuint getMaterialBuffer() const;
+    GLuint getPrimaryTextureArray() const;
+
     const std::vector<unsigned int>& getIndices() const;
 
     const std::vector<int>& getFaceMaterialIDs() const;
@@ -87,18 +193,48 @@ private:
     // Loads the model from an OBJ file
     void loadModel(const std::string& filepath);
 
-    // Loads textures associated with the model
+    // Resolves the texture paths of the materials (textures are loaded on demand)
     void loadTextures();
 
-    // Sets up OpenGL buffers (VAO, VBO, NBO, TBO, EBO)
+    // Sets up OpenGL buffers (VAO, VBO, NBO, TBO, EBO and the material buffer)
     void setupBuffers();
 
+    // Uploads the material buffer if any material changed since the last upload
+    void updateMaterialBuffer(const std::vector<MaterialData>& materialsData) const;
+
+    // Brings the material buffer and draw commands up to date if the materials changed, and binds them
+    // and the texture arrays for a draw
+    void bindMaterials() const;
+
+    // Points the instance attributes of an instanced vertex array at an instance buffer, creating the
+    // array on first use (positions only for depth-only draws)
+    void bindInstancedVertexArray(GLuint& instancedVao, GLuint& boundBuffer, GLuint instanceBuffer, bool depthOnly) const;
+
+    // Splits the faces into runs of one material
+    void buildDrawRanges();
+
+    // Material index of every vertex (the per-vertex material attribute)
+    void buildVertexMaterialIndices(std::vector<GLint>& materialIndices) const;
+
+    // Orders the draw commands by the texture array they need in the last slot; only rebuilt
+    // (and the indirect buffer re-uploaded) when that assignment changed
+    void updateDrawCommands(const std::vector<MaterialData>& materialsData) const;
+
+    // Texture array slot the material of a draw command samples, as uploaded to the material buffer
+    int getDrawTextureSlot(size_t command) const;
+
+    // glMultiDrawElementsIndirect with baseInstance is available (GL 4.3 or the ARB extensions)
+    static bool supportsMultiDrawIndirect();
+
     // Calculates the model transformation matrix based on the position, rotation, and scale
     glm::mat4 calculateModelMatrix() const;
 
     // Calculates the bounding box of the model
     void calculateBoundingBox(glm::vec3& min, glm::vec3& max) const;
 
+    // Calculates the UV density of each material from its triangles
+    void calculateMaterialUVDensities();
+
     // The model's vertices, normals, texture coordinates, and indices
     std::vector<float> vertices;
     std::vector<float> normals;
@@ -111,18 +247,70 @@ private:
 
     // OpenGL handles for the model's buffers
     GLuint vao;
+    GLuint depthVao;  // Positions and indices only, for depth-only passes
     GLuint vbo;
     GLuint nbo;
     GLuint tbo;
     GLuint ebo;
-
-    // OpenGL handles for textures
+    GLuint materialUBO;
+    GLuint materialIndexBuffer;  // Material index of each range, or of each vertex without multi-draw indirect
+    GLuint indirectBuffer;
+
+    // Instanced draws: the instance buffer each array points at, and the per-vertex material indices
+    // they need with multi-draw indirect (without it materialIndexBuffer is per vertex already)
+    mutable GLuint instancedVao;
+    mutable GLuint instancedDepthVao;
+    mutable GLuint instancedVaoBuffer;
+    mutable GLuint instancedDepthVaoBuffer;
+    mutable GLuint vertexMaterialBuffer;
+
+    // Runs of one material in the element buffer
+    std::vector<DrawRange> drawRanges;
+    bool useMultiDrawIndirect;
+
+    // Draw commands in submission order and their groups
+    mutable std::vector<DrawGroup> drawGroups;
+    mutable std::vector<GLuint> drawGroupKeys;  // Texture array each range needs in the last slot (0 = none)
+    mutable std::vector<GLsizei> drawCounts;    // glMultiDrawElements arguments, also used by instanced draws
+    mutable std::vector<const void*> drawOffsets;
+    mutable std::vector<size_t> drawCommandRanges;  // Range each command draws
+
+    // Diffuse texture path of each material, empty if it has none
+    std::vector<std::string> texturePaths;
+
+    // OpenGL handles for textures (array texture and layer of each material, 0 until loaded)
     std::vector<GLuint> textures;
+    std::vector<int> textureLayers;
     std::vector<GLuint> specularTextures;
 
+    // Distinct texture arrays in slot order
+    std::vector<GLuint> textureArrays;
+
+    // Last material table sent to the material buffer
+    mutable std::vector<MaterialBlockEntry> uploadedMaterials;
+
+    // Incremented when a material picks up its texture or the model is reloaded; the material buffer and
+    // draw commands were last built for builtMaterialVersion and the texture manager's builtResidencyVersion
+    unsigned int materialVersion;
+    mutable unsigned int builtMaterialVersion;
+    mutable unsigned int builtResidencyVersion;
+
     // Material diffuse colors for each material
     std::vector<glm::vec3> diffuseColors;  // Store diffuse color for each material
 
+    // UV units per model unit for each material
+    std::vector<float> materialUVDensities;
+
+    // Model-space surface area of each material
+    std::vector<float> materialSurfaceAreas;
+
+    // Texture manager that owns the texture objects
+    TextureManager* textureManager;
+
+    // Model-space bounding box
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+
     // Cache the lowest point to avoid recalculating each frame
     mutable float lowestPoint;
 
@@ -134,6 +322,7 @@ private:
     glm::vec3 rotationAxis;
     float rotationAngle;
     glm::vec3 scale;
+    unsigned int version;
 
     // Current model file path
     std::string currentFilePath;
@@ -0,0 +1,86 @@
+#pragma once
+#ifndef POINTSHADOWMAP_H
+#define POINTSHADOWMAP_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include "Lights.h"
+#include "SceneUniforms.h"
+
+// Texture unit of the cube map array, after the shadow atlas (6)
+const GLuint POINT_SHADOW_TEXTURE_UNIT = 7;
+
+// PointShadowBlock in the shaders (std140 layout)
+struct PointShadowBlockData {
+    glm::mat4 faceMatrices[MAX_LIGHTS * 6];  // View-projection of each cube face, six per light
+    glm::vec4 lightPositions[MAX_LIGHTS];    // World position (xyz) and shadow range (w, 0 if unshadowed)
+    glm::ivec4 faceMasks;                    // Faces of light i that see a caster, bit per face
+    int shadowCount;                         // Point lights with a cube map
+    int padding[3];
+};
+
+// Omnidirectional shadows of the point lights: one depth cube map per light in a cube map array.
+// Each light is rendered in a single pass, a geometry shader copies every triangle into the cube faces
+// it touches through gl_Layer. The depth is the distance to the light divided by its range, so the
+// comparison is linear; faces whose frustum misses the casters are skipped entirely
+class PointShadowMap {
+public:
+    PointShadowMap(GLsizei size = 512);
+    ~PointShadowMap();
+    PointShadowMap(const PointShadowMap&) = delete;
+    PointShadowMap& operator=(const PointShadowMap&) = delete;
+
+    // Creates the cube map array, the framebuffer and the uniform buffer
+    void init();
+
+    // Places the cube faces of the first MAX_LIGHTS point lights and culls the faces against the casters'
+    // world bounds; the block is only re-uploaded if something changed
+    void update(const std::vector<Lights>& pointLights, const glm::vec3& casterMin, const glm::vec3& casterMax);
+
+    // Binds the framebuffer with every cube face attached and clears them
+    void bindForShadowPass() const;
+
+    // Binds the cube map array to POINT_SHADOW_TEXTURE_UNIT for the lighting passes
+    void bindForLightingPass() const;
+
+    // Point lights with a cube map, and the faces of one of them that are rendered (bit per face)
+    int getShadowCount() const;
+    int getFaceMask(int light) const;
+
+    GLsizei getSize() const;
+    void resize(GLsizei size);
+
+    // Shadow caching, as for the shadow map: re-rendered when a light or the casters changed
+    bool isUpToDate(uint64_t casterVersion) const;
+    void markRendered(uint64_t casterVersion);
+    void invalidate();
+
+    // Shadow passes rendered so far
+    unsigned int getRenderCount() const;
+
+    void cleanup();
+
+private:
+    // Whether a box is inside or crosses the frustum of a view-projection matrix
+    static bool intersectsFrustum(const glm::mat4& viewProjection, const glm::vec3& boxMin, const glm::vec3& boxMax);
+
+    void releaseTargets();
+
+    GLsizei cubeSize;
+    GLuint FBO;
+    GLuint depthCubeArray;
+    GLuint ubo;
+
+    PointShadowBlockData blockData;
+
+    // Versions the cube maps were last rendered with
+    unsigned int version;  // Changes with the uploaded block
+    unsigned int renderedVersion;
+    uint64_t renderedCasterVersion;
+    bool rendered;
+    unsigned int renderCount;
+};
+
+#endif // POINTSHADOWMAP_H
@@ -0,0 +1,88 @@
+#pragma once
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include "shader.hpp"
+#include "LightClusters.h"
+
+// Passes in execution order; the pass is the top field of the sort key
+enum class RenderPass : uint8_t {
+    SHADOW = 0,
+    SHADOW_ATLAS = 1,
+    SHADOW_POINT = 2,
+    MAIN = 3,
+    GROUND = 4
+};
+
+// Issues the GL calls of one packet; the program is already in use and the packet's model matrix set
+typedef void (*DrawFunction)(void* object, const ShaderProgram& program);
+
+// One recorded draw: where it sorts and what to call
+struct DrawPacket {
+    uint64_t key;
+    DrawFunction draw;
+    void* object;
+    uint32_t transformIndex;  // Model matrix in the frame's transform list, NO_TRANSFORM if the draw sets its own
+    uint32_t lightListIndex;  // Lights in the frame's light lists, NO_LIGHT_LIST if the draw uses no lights
+};
+
+// Per-frame command buffer. Passes record draw packets with a 64-bit sort key; sort() radix sorts them
+// and execute() runs the packets of one pass in one loop, switching programs only where the key changes.
+// Recording only fills CPU arrays, no GL call is made before execute()
+class RenderQueue {
+public:
+    // Sort key layout, most significant first
+    static const int PASS_BITS = 4;
+    static const int PROGRAM_BITS = 8;
+    static const int MATERIAL_BITS = 16;
+    static const int TEXTURE_BITS = 16;
+    static const int DEPTH_BITS = 20;
+
+    static const uint32_t NO_TRANSFORM = 0xFFFFFFFFu;
+    static const uint32_t NO_LIGHT_LIST = 0xFFFFFFFFu;
+
+    RenderQueue();
+
+    // Programs are referenced by their registration index in the keys; -1 if all 2^PROGRAM_BITS indices are taken
+    int registerProgram(const ShaderProgram& program);
+
+    // Frees the index of a program about to be deleted; packets still recorded with it are skipped
+    void unregisterProgram(const ShaderProgram& program);
+
+    // Builds a sort key. Material and texture are any IDs that should end up next to each other
+    // (only their low bits are kept); depth is a view distance in [0, 1], drawn front to back
+    static uint64_t makeKey(RenderPass pass, int program, uint32_t material, uint32_t texture, float depth);
+
+    // Drops the packets of the last frame
+    void begin();
+
+    // Records a draw with its own model matrix, or without one (the draw sets its transform itself),
+    // and optionally the lights that reach it (set before the draw, skipped if the last packet had the same list)
+    void submit(uint64_t key, DrawFunction draw, void* object, const glm::mat4& modelMatrix,
+        const DrawLightList* lightList = nullptr);
+    void submit(uint64_t key, DrawFunction draw, void* object, const DrawLightList* lightList = nullptr);
+
+    // Sorts the recorded packets, call once after recording
+    void sort();
+
+    // Runs the packets of one pass; the caller binds the pass's targets
+    void execute(RenderPass pass);
+
+    size_t getPacketCount() const;
+
+private:
+    std::vector<const ShaderProgram*> programs;
+
+    std::vector<DrawPacket> packets;
+    std::vector<DrawPacket> sortBuffer;
+    std::vector<glm::mat4> transforms;
+    std::vector<DrawLightList> lightLists;
+
+    uint32_t addLightList(const DrawLightList* lightList);
+};
+
+#endif // RENDERQUEUE_H
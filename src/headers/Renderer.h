@@ -2,13 +2,24 @@
 #define RENDERER_H
 
 #include <memory>
+#include <cstdint>
 #include "Window.h"
 #include "Model.h"
 #include "Camera.h"
 #include "shader.hpp"
 #include "Lights.h"
 #include "ShadowMap.h"
+#include "ShadowAtlas.h"
+#include "PointShadowMap.h"
+#include "ShadowMoments.h"
+#include "LightClusters.h"
 #include "InfiniteGround.h"
+#include "TextureManager.h"
+#include "SceneUniforms.h"
+#include "RenderQueue.h"
+#include "FrameGraph.h"
+#include "InstanceBatch.h"
+#include "ShaderVariants.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
@@ -17,15 +28,26 @@
 class Renderer {
 public:
     // Constructor and Destructor
-    Renderer(Window& window, Camera& camera, Model& model);
+    Renderer(Window& window, Camera& camera, Model& model, TextureManager& textureManager);
     ~Renderer();
 
     // Initialize OpenGL settings and load shaders
     bool init();
 
-    // Render a model
+    // Renders the frame: every pass of the frame graph runs at most once, the caller swaps buffers
     void renderScene();
 
+    // Pass drawn over the scene at the end of the frame (the UI)
+    void setOverlay(PassFunction draw, void* context);
+
+    // Instanced copies drawn in the main and shadow passes; the batches must outlive the renderer or be removed
+    void addInstanceBatch(InstanceBatch* batch);
+    void removeInstanceBatch(InstanceBatch* batch);
+
+    // Number of copies of the model laid out on a grid around it (0 to turn the grid off)
+    void setInstanceGridSize(int count);
+    int getInstanceGridSize() const;
+
     // Set methods for light and ambient intensity
     void setAmbientLightIntensity(const glm::vec3& intensity);
 
@@ -38,13 +60,71 @@ public:
     void setShadowsEnabled(bool enabled);
     bool getShadowsEnabled() const;
 
-    // Render function to apply all lights
+    // While auto rotating, the shadow map is re-rendered every this many frames (1 = every frame);
+    // otherwise it is only re-rendered when the light or a caster changed
+    void setShadowUpdateInterval(int frames);
+    int getShadowUpdateInterval() const;
+    const ShadowMap& getShadowMap() const;
+    const ShadowAtlas& getShadowAtlas() const;
+    const PointShadowMap& getPointShadowMap() const;
+    const LightClusters& getLightClusters() const;
+
+    // Spot and point lights that reached the model and the ground in the last frame
+    const DrawLightList& getModelLights() const;
+    const DrawLightList& getGroundLights() const;
+    bool isPointShadowsAvailable() const;
+
+    // Square shadow map resolution in texels
+    void setShadowMapSize(int size);
+    int getShadowMapSize() const;
+
+    // Cascades of the directional light's shadow (1 to MAX_SHADOW_CASCADES) and their split blend
+    // between uniform (0) and logarithmic (1) distances
+    void setShadowCascadeCount(int count);
+    int getShadowCascadeCount() const;
+    void setCascadeSplitLambda(float lambda);
+    float getCascadeSplitLambda() const;
+
+    // Kernel the shadows are filtered with; every tap is a hardware-filtered depth comparison
+    void setShadowFilter(ShadowFilter filter);
+    ShadowFilter getShadowFilter() const;
+
+    // Blur of the EVSM moments in moment texels (half the shadow map's resolution), used by ShadowFilter::EVSM
+    void setShadowBlurRadius(int radius);
+    int getShadowBlurRadius() const;
+
+    // Layered shadow pass: every cascade (and every atlas tile) rendered in one pass through a geometry shader,
+    // where available. Otherwise each cascade is its own pass and is only re-rendered when it changed
+    void setLayeredShadows(bool enabled);
+    bool getLayeredShadows() const;
+    bool isLayeredShadowsAvailable() const;
+
+    // Shader variants: lit draws use a variant of the model program compiled for their features (on by default);
+    // otherwise the one model program branches on them at run time
+    void setShaderVariants(bool enabled);
+    bool getShaderVariants() const;
+    size_t getShaderVariantCount() const;
+
+    // On-demand rendering: frames are only drawn when something on screen changed (on by default)
+    void setOnDemandRendering(bool enabled);
+    bool getOnDemandRendering() const;
+
+    // Marks the next frames as needed, for changes the renderer can't see (input, UI interaction)
+    void requestRedraw();
+
+    // Whether the next frame would differ from the last one drawn; the main loop sleeps while it doesn't
+    bool needsRedraw() const;
+
+    // Picks the shadow casting light and uploads the lights that changed
     void renderLightsForObject();
 
     // Get methods
     glm::vec3 getAmbientLightIntensity() const;
     Camera& getCamera();
     Window& getWindow();
+    TextureManager& getTextureManager();
+    SceneUniforms& getSceneUniforms();
+    const FrameGraph& getFrameGraph() const;
 
     // Getter and setter for lights
     std::vector<Lights>& getPointLights();
@@ -65,19 +145,53 @@ private:
     Window& window;
     Camera& camera;
     ShadowMap shadowMap;
+    ShadowAtlas shadowAtlas;  // Every shadowed light besides the first directional one and the point lights
+    PointShadowMap pointShadowMap;
+    ShadowMoments shadowMoments;  // Filterable moments of the shadow map's cascades, for ShadowFilter::EVSM
     Model& model;
+    TextureManager& textureManager;
+
+    // Shader programs
+    ShaderProgram programShader;// Initialize OpenGL, shaders, and GLEW for obj(model) 
+    ShaderVariants programVariants;       // Variants of programShader with their features compiled in
+    bool shaderVariants;                  // Whether lit draws use programVariants
+    ShaderProgram infiniteGroundShader;
+    ShaderProgram shadowMapShader;        // One cascade per pass
+    ShaderProgram shadowLayeredShader;    // Every cascade in one pass, 0 if geometry shaders are unavailable
+    ShaderProgram shadowAtlasShader;         // One atlas tile per pass
+    ShaderProgram shadowAtlasLayeredShader;  // Every atlas tile in one pass, 0 if viewport arrays are unavailable
+    ShaderProgram pointShadowShader;         // Every cube face of a point light in one pass, 0 if unavailable
+    ShaderProgram shadowMomentsShader;       // Converts and blurs the shadow map into EVSM moments
+
+    // Uniform buffers with the camera and light data of all programs
+    SceneUniforms sceneUniforms;
+
+    // Spot and point lights binned into the clusters of the view, and those reaching each lit draw
+    LightClusters lightClusters;
+    DrawLightList modelLights;
+    DrawLightList groundLights;
 
-    // Shader program IDs
-    GLuint programShaderID;// Initialize OpenGL, shaders, and GLEW for obj(model) 
-    GLuint infiniteGroundShaderID;
-    GLuint shadowMapShaderID;
+    // Draws of the frame, sorted before they run
+    RenderQueue renderQueue;
+    int modelProgramIndex;
+    int groundProgramIndex;
+    int shadowProgramIndex;
+    int shadowLayeredProgramIndex;
+    int shadowAtlasProgramIndex;
+    int shadowAtlasLayeredProgramIndex;
+    int pointShadowProgramIndex;
+    int viewportWidth;
+    int viewportHeight;
 
-    // Uniform locations for object shader
-    GLuint MatrixID;
-    GLuint ViewMatrixID;
-    GLuint ModelMatrixID;
-    GLuint LightID;
-    GLuint AmbientLightID;
+    // Passes of the frame
+    FrameGraph frameGraph;
+    PassFunction overlayPass;
+    void* overlayContext;
+
+    // Instanced copies, the grid of copies of the model included
+    std::vector<InstanceBatch*> instanceBatches;
+    InstanceBatch instanceGrid;
+    int instanceGridSize;
 
     // Projection matrix for the camera
     glm::mat4 Projection;
@@ -105,17 +219,55 @@ private:
     bool groundHeightSet;      // Track whether the ground height is set
     bool autoRotateModel;      // Flag to enable/disable auto rotation
     float rotationSpeed;       // Speed of rotation in degrees per second
+    float currentRotation;     // Current auto rotation angle in degrees
+    Uint32 lastRotationTicks;  // Time of the last auto rotation step
     bool shadowsEnabled;       // Flag to enable/disable shadows
 
-    void MatrixUniformLocations(GLuint programShaderID);
-    void MatrixPassToShader(const glm::mat4& MVP, const glm::mat4& View, const glm::mat4& Model);
-    void renderToTheDepthTexture();
-    glm::mat4 calculateMVP(const glm::mat4& modelMatrix, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix);
+    // On-demand rendering state
+    bool onDemandRendering;
+    int redrawFrames;               // Frames still to draw after the last redraw request
+    uint64_t renderedSceneVersion;  // sceneVersion() when the last frame was drawn
+    uint64_t sceneVersion() const;
+
+    // Shadow caching state
+    uint64_t shadowCasterVersion;  // casterVersion() of the current frame
+    int shadowUpdateInterval;
+    int framesSinceShadowUpdate;
+    uint64_t casterVersion() const;
+
+    // Shadow passes: one layered pass, or one pass per cascade
+    struct CascadePass {
+        Renderer* renderer;
+        int cascade;
+    };
+    bool layeredShadows;
+    CascadePass cascadePasses[MAX_SHADOW_CASCADES];
+
+    // World-space box around every shadow caster
+    void getCasterBounds(glm::vec3& casterMin, glm::vec3& casterMax) const;
+
+    void recordDraws(const glm::mat4& View);
+    void buildFrameGraph();
 
-    void setShadowMatrixUniform(GLuint shaderID, const glm::mat4& shadowMatrix);
-    void renderGroundWithShadows(const glm::mat4& View, const glm::mat4& Projection);
-    void renderModelWithShadows(const glm::mat4& View, const glm::mat4& Projection);
-    void bindShadowMap(GLuint shaderID, GLuint textureUnit);
+    // Frame graph passes and render queue callbacks
+    static void runShadowPass(void* context);
+    static void runShadowCascadePass(void* context);
+    static void runShadowAtlasPass(void* context);
+    static void runPointShadowPass(void* context);
+    static void runShadowMomentsPass(void* context);
+    static void runMainPass(void* context);
+    static void runGroundPass(void* context);
+    static int setupModelProgram(const ShaderProgram& program, void* context);
+    static void releaseModelProgram(const ShaderProgram& program, void* context);
+    int selectModelProgram(const ShaderFeatures& features);
+    static void drawModelPacket(void* object, const ShaderProgram& program);
+    static void drawShadowPacket(void* object, const ShaderProgram& program);
+    static void drawInstancedPacket(void* object, const ShaderProgram& program);
+    static void drawInstancedShadowPacket(void* object, const ShaderProgram& program);
+    static void drawGroundPacket(void* object, const ShaderProgram& program);
+    void updateTextureStreaming(const glm::mat4& View, int viewportHeight);
+    void requestModelTextures(Model& model, const glm::vec3& center, float radius, float modelScale,
+        const glm::mat4& View, int viewportHeight);
 
     //Default Scene Lights Setup
     void setupPointLight();
@@ -0,0 +1,101 @@
+#pragma once
+#ifndef SCENEUNIFORMS_H
+#define SCENEUNIFORMS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <iostream>
+#include "Lights.h"
+#include "Camera.h"
+#include "shader.hpp"
+#include "ShadowMap.h"
+
+// Directional lights and shadowed lights of each type, this must match MAX_LIGHTS in the shaders
+// (the spot and point lights themselves are clustered, see LightClusters)
+const int MAX_LIGHTS = 4;
+
+// Uniform buffer binding points of the shared blocks (MATERIAL_BLOCK_BINDING is 0)
+const GLuint FRAME_BLOCK_BINDING = 1;
+const GLuint LIGHT_BLOCK_BINDING = 2;
+const GLuint SHADOW_ATLAS_BLOCK_BINDING = 3;
+const GLuint POINT_SHADOW_BLOCK_BINDING = 4;
+const GLuint CLUSTER_BLOCK_BINDING = 5;
+
+// FrameBlock in the shaders (std140 layout)
+struct FrameBlockData {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 lightSpaceMatrices[MAX_SHADOW_CASCADES];
+    glm::vec4 cascadeSplits;
+    glm::vec3 cameraPosition;
+    float shadowBias;
+    int shadowsEnabled;
+    int cascadeCount;
+    int shadowFilter;
+    int padding;
+};
+
+// DirectionalLight in the shaders (std140 layout)
+struct DirectionalLightData {
+    glm::vec3 direction;
+    float padding0;
+    glm::vec3 intensity;
+    float padding1;
+    glm::vec3 ambient;
+    float padding2;
+    glm::vec3 specular;
+    float padding3;
+};
+
+// LightBlock in the shaders (std140 layout)
+struct LightBlockData {
+    DirectionalLightData dirLights[MAX_LIGHTS];
+    glm::vec3 ambientLightIntensity;
+    int numDirLights;
+};
+
+// Uniform buffers for the per-frame camera data and the lights, shared by every program.
+// Each buffer is only re-uploaded when its contents changed since the last upload
+class SceneUniforms {
+public:
+    SceneUniforms();
+    ~SceneUniforms();
+
+    // Creates the buffers and attaches them to their binding points
+    void init();
+
+    // Connects the program's FrameBlock, LightBlock, shadow blocks and ClusterBlock (whichever it uses) to the shared buffers
+    static void bindProgram(const ShaderProgram& program);
+
+    // Uploads the frame block if the camera moved or anything else in it changed (cascades included)
+    void updateFrame(const Camera& camera, const glm::mat4& projection, const ShadowMap& shadowMap,
+        float shadowBias, bool shadowsEnabled);
+
+    // Uploads the light block if a directional light was changed, added or removed
+    void updateLights(const std::vector<Lights>& directionalLights, const glm::vec3& ambientLightIntensity);
+
+    // Number of buffer uploads since startup
+    unsigned int getUploadCount() const;
+
+    void cleanup();
+
+private:
+    // Appends the versions of the lights to the list, used to detect changes
+    static void collectVersions(const std::vector<Lights>& lights, std::vector<unsigned int>& versions);
+
+    GLuint frameUBO;
+    GLuint lightUBO;
+
+    FrameBlockData frameData;
+    unsigned int cameraVersion;             // Camera version the uploaded view matrix belongs to
+    bool frameUploaded;
+
+    std::vector<unsigned int> lightVersions;  // Versions of the uploaded lights (list sizes included)
+    glm::vec3 uploadedAmbient;
+    bool lightsUploaded;
+
+    unsigned int uploadCount;
+};
+
+#endif // SCENEUNIFORMS_H
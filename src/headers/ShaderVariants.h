@@ -0,0 +1,96 @@
+#pragma once
+#ifndef SHADERVARIANTS_H
+#define SHADERVARIANTS_H
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "shader.hpp"
+#include "ShadowMap.h"
+#include "LightClusters.h"
+
+// Where the spot and point lights of a draw come from, this must match LOCAL_LIGHTS_* in frag.glsl
+enum class LocalLightMode {
+    NONE = 0,      // No spot or point light reaches the draw
+    LIST = 1,      // The draw's own DrawLightList
+    CLUSTERED = 2  // The fragment's cluster
+};
+
+// Features of a lit draw that a program variant fixes at compile time, so the fragment shader's
+// branches on them fold away. Each is injected as a #define (named in the comments)
+struct ShaderFeatures {
+    bool textured;               // TEXTURED: some material samples a texture array
+    bool instanced;              // INSTANCED: the draw reads the per-instance transform and tint
+    bool shadows;                // SHADOWS_ENABLED
+    ShadowFilter shadowFilter;   // SHADOW_FILTER, ignored without shadows
+    int directionalLights;       // DIR_LIGHT_COUNT, 0 to MAX_LIGHTS
+    LocalLightMode localLights;  // LOCAL_LIGHTS
+
+    ShaderFeatures();
+
+    // The mode of a draw with this light list
+    static LocalLightMode getLocalLightMode(const DrawLightList& lights);
+
+    // Packs the features into the cache key; features that make no difference share a key
+    uint32_t getKey() const;
+
+    // The #define lines of the features
+    ShaderDefines getDefines() const;
+};
+
+// Called once for each variant after it linked, to set its constant uniforms and uniform blocks.
+// Returns the variant's handle (the renderer's render queue index)
+typedef int (*VariantSetupFunction)(const ShaderProgram& program, void* context);
+
+// Called for each variant set up with a handle before it is deleted, to drop that handle
+typedef void (*VariantReleaseFunction)(const ShaderProgram& program, void* context);
+
+// Program variants of one vertex and fragment shader pair, compiled with the #defines of their features
+// and cached by the features' key. Lookups make no GL call: a variant asked for before it exists is
+// queued and compiled by the next compileRequested
+class ShaderVariants {
+public:
+    ShaderVariants();
+    ~ShaderVariants();
+    ShaderVariants(const ShaderVariants&) = delete;
+    ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+    void init(const char* vertexPath, const char* fragmentPath, VariantSetupFunction setup, VariantReleaseFunction release,
+        void* context);
+
+    // Handle of the variant with these features; -1 if it is not compiled yet (it is queued), failed to
+    // compile or the setup gave it no handle (not retried), the caller falls back to a program without defines
+    int findVariant(const ShaderFeatures& features);
+
+    // Compiles and sets up the variants queued since the last call
+    void compileRequested();
+
+    // Compiled variants, failed ones included
+    size_t getVariantCount() const;
+
+    // Releases and deletes every variant
+    void cleanup();
+
+private:
+    struct Variant {
+        std::unique_ptr<ShaderProgram> program;  // Stays at the same address, the render queue keeps pointers
+        int handle;
+    };
+
+    std::string vertexPath;
+    std::string fragmentPath;
+    VariantSetupFunction setup;
+    VariantReleaseFunction release;
+    void* setupContext;
+    std::unordered_map<uint32_t, Variant> variants;
+    std::vector<ShaderFeatures> requested;  // Queued by findVariant, one entry per key
+
+    // The last variant looked up, most draws of a frame share it
+    uint32_t lastKey;
+    int lastHandle;
+};
+
+#endif // SHADERVARIANTS_H
@@ -0,0 +1,114 @@
+#pragma once
+#ifndef SHADOWATLAS_H
+#define SHADOWATLAS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include "Lights.h"
+#include "Camera.h"
+#include "SceneUniforms.h"
+
+// Tile limit, this must match MAX_SHADOW_TILES in the shaders
+const int MAX_SHADOW_TILES = 8;
+
+// Texture unit of the atlas, after the shadow map (1) and the material texture arrays (2 to 5)
+const GLuint SHADOW_ATLAS_TEXTURE_UNIT = 6;
+
+// ShadowAtlasBlock in the shaders (std140 layout)
+struct ShadowAtlasBlockData {
+    glm::mat4 tileMatrices[MAX_SHADOW_TILES];  // Light-space matrix of each tile
+    glm::vec4 tileRects[MAX_SHADOW_TILES];     // Offset (xy) and size (zw) of each tile in atlas texture coordinates
+    glm::ivec4 lightTiles[MAX_LIGHTS];         // Tile of directional light i (x) and spot light i (y), -1 if unshadowed
+    int tileCount;
+    int padding[3];
+};
+
+// One tile of the atlas and the light it belongs to
+struct ShadowTile {
+    LightType lightType;
+    int lightIndex;
+    float importance;  // Brightness times screen coverage, decides the tile size
+    GLint x, y;        // Texels
+    GLsizei size;
+};
+
+// Shadow maps of the spot lights and the directional lights besides the cascaded sun, packed as square tiles into one
+// depth texture. Tiles are sized by the light's importance and packed every frame; the light-space
+// matrices and tile rectangles live in a uniform buffer, so one pass renders every tile (a geometry
+// shader routes each triangle to the tiles' viewports) and the shaders find each light's tile there
+class ShadowAtlas {
+public:
+    ShadowAtlas(GLsizei size = 4096);
+    ~ShadowAtlas();
+    ShadowAtlas(const ShadowAtlas&) = delete;
+    ShadowAtlas& operator=(const ShadowAtlas&) = delete;
+
+    // Creates the depth texture, the framebuffer and the uniform buffer
+    void init();
+
+    // Gives a tile to the directional lights after the first (which has the cascaded shadow map) and to the
+    // spot lights, sized by importance and packed; the block is only re-uploaded if a tile changed.
+    // Directional tiles are fitted to the casters within the view from the camera's near plane up to shadowDistance
+    void update(const std::vector<Lights>& directionalLights, const std::vector<Lights>& spotLights, const Camera& camera,
+        float fovy, float aspect, const glm::vec3& casterMin, const glm::vec3& casterMax, float nearPlane, float shadowDistance);
+
+    // Binds and clears the atlas; layered sets one viewport per tile, for the single pass over the geometry
+    void bindForShadowPass(bool layered) const;
+
+    // Restricts the viewport to one tile, for rendering the tiles one at a time
+    void bindForTile(int tile) const;
+
+    // Binds the atlas to SHADOW_ATLAS_TEXTURE_UNIT for the lighting passes
+    void bindForLightingPass() const;
+
+    const std::vector<ShadowTile>& getTiles() const;
+    int getTileCount() const;
+
+    GLsizei getSize() const;
+    void resize(GLsizei size);
+
+    // Shadow caching, as for the shadow map: the atlas is re-rendered when a tile or the casters changed
+    bool isUpToDate(uint64_t casterVersion) const;
+    void markRendered(uint64_t casterVersion);
+    void invalidate();
+
+    // Shadow passes rendered so far
+    unsigned int getRenderCount() const;
+
+    void cleanup();
+
+private:
+    // Brightness of the light times the fraction of the screen it can reach, 0 if it can't be seen
+    static float spotLightImportance(const Lights& light, const Camera& camera, float fovy, float& range);
+
+    // Takes a free square of the given size from the atlas; returns false if none is left
+    bool allocate(GLsizei size, GLint& x, GLint& y);
+
+    void releaseTargets();
+
+    // Free square of the atlas
+    struct FreeRegion {
+        GLint x, y;
+        GLsizei size;
+    };
+
+    GLsizei atlasSize;
+    GLuint FBO;
+    GLuint depthMap;
+    GLuint ubo;
+
+    std::vector<ShadowTile> tiles;
+    std::vector<FreeRegion> freeRegions;
+    ShadowAtlasBlockData blockData;
+
+    // Versions the atlas was last rendered with
+    unsigned int version;  // Changes with the uploaded block
+    unsigned int renderedVersion;
+    uint64_t renderedCasterVersion;
+    bool rendered;
+    unsigned int renderCount;
+};
+
+#endif // SHADOWATLAS_H
@@ -6,46 +6,126 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <iostream>
 #include <vector>
+#include <cstdint>
 #include "Lights.h"
 
+// Cascade limit, this must match MAX_SHADOW_CASCADES in the shaders
+const int MAX_SHADOW_CASCADES = 4;
+
+// Filter kernels for sampling the shadow map, these must match SHADOW_FILTER_* in the shaders.
+// Every tap is a hardware depth comparison of the four nearest texels, filtered bilinearly
+enum class ShadowFilter {
+    SINGLE_TAP = 0,  // One bilinear tap
+    FOUR_TAPS = 1,   // 2x2 taps one texel apart
+    NINE_TAPS = 2,   // 3x3 taps one texel apart
+    POISSON = 3,     // 8 taps on a Poisson disk, rotated per pixel
+    EVSM = 4         // One fetch of the blurred moments (see ShadowMoments); four taps for the atlas and the cube maps
+};
+
+// Cascaded shadow map: one depth layer per cascade in a texture array. Directional lights split the
+// view into consecutive depth ranges, each covered by its own light projection, so the texel density
+// follows the distance to the camera. Only the first directional light uses it, see ShadowAtlas for the others
 class ShadowMap {
 public:
     // Constructor and Destructor
     ShadowMap(GLsizei width = 1024, GLsizei height = 1024);  // Constructor with default width and height
     ~ShadowMap();
 
-    // Initialize the shadow map (creates FBO and depth texture)
+    // Initialize the shadow map (creates the FBOs and the depth texture array)
     void init();
 
-    // Bind the framebuffer for the shadow pass (during light rendering)
+    // Bind the framebuffer with every cascade attached, for a layered shadow pass, and clear them
     void bindForShadowPass() const;
 
-    void bindForCameraView() const;
+    // Bind the framebuffer of one cascade, for a shadow pass per cascade, and clear it
+    void bindForCascadePass(int cascade) const;
+
+    // Bind the window framebuffer again for the camera passes (nothing is cleared)
+    void bindForCameraView(GLsizei width, GLsizei height) const;
 
     // Bind the shadow map for use during the lighting pass
     void bindForLightingPass(GLuint textureUnit) const;
 
-    // Calculate the light-space matrix for the shadow map
-    void calculateLightSpaceMatrix(const glm::vec3& lightPos, const glm::vec3& targetPos, LightType lightType);
+    // Uses no cascades, for scenes without a directional light (the other lights are in the shadow atlas)
+    void disableCascades();
+
+    // Splits the camera frustum between nearPlane and farPlane into the cascades and fits the orthographic
+    // projection of each one to the casters' world bounds, clipped to its slice of the frustum.
+    // The bounds are snapped to whole texels and their size quantized, so the shadows don't shimmer as the camera moves
+    void fitDirectionalLight(const glm::vec3& lightDirection, const glm::vec3& casterMin, const glm::vec3& casterMax,
+        const glm::mat4& cameraView, float fovy, float aspect, float nearPlane, float farPlane);
+
+    // Orthographic light-space matrix for a square map of the given resolution, fitted and snapped as above
+    // to the casters' footprint within the view slice
+    static glm::mat4 fitDirectionalProjection(const glm::vec3& lightDirection, const glm::vec3& casterMin,
+        const glm::vec3& casterMax, const glm::mat4& sliceViewProjection, GLsizei resolution);
+
+    GLsizei getSize() const;
 
     // Resize the shadow map (re-allocate the depth texture)
     void resize(GLsizei width, GLsizei height);
 
+    // Number of cascades directional lights are split into (1 to MAX_SHADOW_CASCADES); re-allocates the depth texture
+    void setCascadeCount(int count);
+    int getCascadeCount() const;
+
+    // Blend between uniform (0) and logarithmic (1) split distances
+    void setSplitLambda(float lambda);
+    float getSplitLambda() const;
+
+    // Kernel the shaders filter the shadow with
+    void setFilter(ShadowFilter filter);
+    ShadowFilter getFilter() const;
+
+    // Cascades in use by the current light and their view-depth far bounds
+    int getActiveCascadeCount() const;
+    float getCascadeSplit(int cascade) const;
+
     // Getters
-    GLuint getDepthMapTexture() const;      // Retrieve the depth texture
-    GLuint getFBO() const;                  // Retrieve the framebuffer object
-    glm::mat4 getLightSpaceMatrix() const;  // Retrieve the light-space matrix
+    GLuint getDepthMapTexture() const;                 // Retrieve the depth texture array
+    GLuint getFBO() const;                             // Retrieve the layered framebuffer object
+    const glm::mat4& getCascadeMatrix(int cascade) const;  // Retrieve the light-space matrix of a cascade
 
     // Setters
-    void setLightSpaceMatrix(const glm::mat4& matrix)const;
+    void setCascadeMatrix(int cascade, const glm::mat4& matrix);
+
+    // Shadow caching: a cascade holds the casters as of its last shadow pass and only needs re-rendering
+    // when its light-space matrix or the casters' version (transforms and geometry) changed since then
+    bool isUpToDate(uint64_t casterVersion) const;
+    bool isCascadeUpToDate(int cascade, uint64_t casterVersion) const;
+    bool isLightUpToDate() const;
+    void markRendered(uint64_t casterVersion);
+    void markCascadeRendered(int cascade, uint64_t casterVersion);
+
+    // Forces the next shadow pass (the depth map contents were lost)
+    void invalidate();
+
+    // Shadow passes rendered so far
+    unsigned int getRenderCount() const;
 
 private:
+    void releaseTargets();
+
     GLsizei shadowWidth;  // Width of the shadow map
     GLsizei shadowHeight; // Height of the shadow map
 
-    GLuint FBO;           // Framebuffer object
-    GLuint depthMap;       // Depth texture for storing shadow map
-    glm::mat4 lightSpaceMatrix; // Light-space transformation matrix
+    GLuint FBO;                             // Framebuffer with every layer attached
+    GLuint layerFBOs[MAX_SHADOW_CASCADES];  // Framebuffer per layer
+    GLuint depthMap;                        // Depth texture array, one layer per cascade
+
+    int cascadeCount;        // Layers allocated, used by directional lights
+    int activeCascadeCount;  // Cascades used by the current light
+    float splitLambda;
+    ShadowFilter filter;
+    glm::mat4 cascadeMatrices[MAX_SHADOW_CASCADES];  // Light-space transformation matrices
+    float cascadeSplits[MAX_SHADOW_CASCADES];        // View depth where each cascade ends
+
+    // Versions each cascade was last rendered with
+    unsigned int cascadeVersions[MAX_SHADOW_CASCADES];  // Changes with the light-space matrix
+    unsigned int renderedCascadeVersions[MAX_SHADOW_CASCADES];
+    uint64_t renderedCasterVersions[MAX_SHADOW_CASCADES];
+    bool rendered[MAX_SHADOW_CASCADES];  // The layer holds a valid shadow pass
+    unsigned int renderCount;
 };
 
 #endif
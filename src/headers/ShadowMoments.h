@@ -0,0 +1,72 @@
+#pragma once
+#ifndef SHADOWMOMENTS_H
+#define SHADOWMOMENTS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "shader.hpp"
+#include "ShadowMap.h"
+
+// Texture unit of the moments, after the point light cube maps (7)
+const GLuint SHADOW_MOMENTS_TEXTURE_UNIT = 8;
+
+// Exponential variance shadow maps (EVSM) for the cascades: the depth of each cascade warped by a positive
+// and a negative exponential, stored with their squares as four filterable moments at half the shadow
+// map's resolution. They are blurred with a separable Gaussian and mipmapped once per shadow update, so
+// the shaders get a wide soft shadow from one trilinear fetch (see ShadowFilter::EVSM)
+class ShadowMoments {
+public:
+    ShadowMoments();
+    ~ShadowMoments();
+    ShadowMoments(const ShadowMoments&) = delete;
+    ShadowMoments& operator=(const ShadowMoments&) = delete;
+
+    // Takes the program that converts and blurs the moments; the textures follow the shadow map in update()
+    void init(const ShaderProgram& program);
+
+    // Converts every active cascade of the shadow map to moments, blurs them and rebuilds the mipmaps;
+    // the shadow map's framebuffer and sampling state are left as they were
+    void update(const ShadowMap& shadowMap);
+
+    // Whether the moments still match the shadow map's last shadow pass and the blur radius
+    bool isUpToDate(const ShadowMap& shadowMap) const;
+
+    // Forces the next update (the moments contents were lost)
+    void invalidate();
+
+    // Binds the moments to SHADOW_MOMENTS_TEXTURE_UNIT for the lighting passes
+    void bindForLightingPass() const;
+
+    // Half width of the blur kernel in moment texels (0 to MAX_MOMENT_BLUR_RADIUS)
+    void setBlurRadius(int radius);
+    int getBlurRadius() const;
+
+    GLsizei getSize() const;
+
+    void cleanup();
+
+    // Widest blur the moments pass supports
+    static const int MAX_MOMENT_BLUR_RADIUS = 8;
+
+private:
+    // (Re)creates the textures for the shadow map's resolution and cascade count
+    void allocate(GLsizei shadowSize, int layers);
+    void releaseTargets();
+
+    const ShaderProgram* momentsShader;
+    GLuint momentsArray;   // Blurred moments, one mipmapped layer per cascade
+    GLuint blurTexture;    // Horizontal blur of the cascade being converted
+    GLuint momentsFBO;     // Re-attached to each layer of the moments array
+    GLuint blurFBO;
+    GLuint depthSampler;   // Reads the shadow map's depth without comparison
+    GLuint vao;            // Empty, the full-screen triangle comes from gl_VertexID
+
+    GLsizei momentsSize;
+    int layerCount;
+    int blurRadius;
+
+    // Shadow map render count the moments were built from, 0 if they need rebuilding
+    unsigned int builtRenderCount;
+};
+
+#endif // SHADOWMOMENTS_H
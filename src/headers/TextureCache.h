@@ -0,0 +1,85 @@
+#pragma once
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <atomic>
+#include <iostream>
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps the file into memory; returns false if it can't be opened
+    bool open(const std::string& path);
+    void close();
+
+    const unsigned char* data() const;
+    size_t size() const;
+
+private:
+    const unsigned char* mappedData;
+    size_t mappedSize;
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#else
+    int fileDescriptor;
+#endif
+};
+
+// Decoded mip chain read back from the cache. The pixels point either into the
+// mapped cache file or into the decompressed buffer, both owned by this object
+struct CachedImage {
+    int width;
+    int height;
+    int components;
+    const unsigned char* pixels;  // Every mip level, finest first, tightly packed
+    size_t size;
+    std::shared_ptr<MappedFile> mapping;
+    std::vector<unsigned char> decompressed;
+};
+
+// Disk cache of decoded, mip-complete images so reopening a model skips image decoding.
+// Entries are keyed by source path, size and modification time; each one is a small header
+// followed by the mip chain, either raw (mapped straight into upload buffers) or LZ4 compressed
+class TextureCache {
+public:
+    TextureCache(const std::string& directory = "texture_cache");
+
+    // Looks up the decoded mip chain of an image; returns false on a miss or a stale entry
+    bool load(const std::string& sourcePath, CachedImage& image);
+
+    // Stores the decoded mip chain of an image (layout as produced by TextureManager)
+    void store(const std::string& sourcePath, int width, int height, int components,
+        const unsigned char* pixels, size_t size);
+
+    // LZ4 compression of new entries; off by default so entries can be used straight from the mapping
+    void setCompressionEnabled(bool enabled);
+    bool isCompressionEnabled() const;
+
+    size_t getHitCount() const;
+    size_t getMissCount() const;
+
+private:
+    // Size and modification time of the source file; returns false if it doesn't exist
+    static bool statSource(const std::string& sourcePath, uint64_t& size, int64_t& modifiedTime);
+
+    // Cache file of a source image; one entry per path, rewritten when the source changes
+    std::string entryPath(const std::string& sourcePath) const;
+
+    // Used from the texture loader thread, read by the UI
+    std::string directory;
+    std::atomic<bool> compressionEnabled;
+    std::atomic<size_t> hitCount;
+    std::atomic<size_t> missCount;
+};
+
+#endif // TEXTURECACHE_H
@@ -0,0 +1,167 @@
+#pragma once
+#ifndef TEXTUREMANAGER_H
+#define TEXTUREMANAGER_H
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "TextureCache.h"
+
+// One level of a texture's mip chain, stored inside the texture's pixel blob
+struct TextureMip {
+    int width;
+    int height;
+    size_t offset;  // Byte offset into the pixel blob
+    size_t size;    // Size of the level in bytes, all layers included
+};
+
+// Array texture loaded by the manager. Images with the same size and format share one
+// GL_TEXTURE_2D_ARRAY; only the levels from residentBase down to the smallest mip are present
+// on the GPU, the decoded pixels of every level stay on the CPU
+struct ManagedTexture {
+    std::vector<std::string> paths;     // Source image of each layer (empty once the layer was released)
+    int sourceWidth;                    // Size of the source images before any downscaling
+    int sourceHeight;
+    GLenum format;                      // GL_RED, GL_RGB or GL_RGBA
+    int components;                     // Bytes per pixel
+    int layers;
+    std::vector<unsigned char> pixels;  // Every mip level, finest first; each level holds all layers back to back
+    std::vector<TextureMip> mips;
+    int residentBase;                   // Finest level currently uploaded (past the last level when evicted)
+    int requestedLevel;                 // Finest level asked for since the last update
+    unsigned int lastUsedFrame;         // Last frame a draw asked for this texture
+};
+
+// Where an image ended up: the array texture and its layer inside it
+struct TextureLayer {
+    GLuint textureID;  // 0 if the image could not be loaded
+    int layer;
+};
+
+// Image decoded by the loader thread, waiting to be packed into an array
+struct DecodedImage {
+    std::string path;
+    int width, height, components;
+    std::vector<TextureMip> mips;       // Empty if the image could not be loaded
+    std::vector<unsigned char> pixels;  // Mip chain built here, empty when it came from the cache
+    CachedImage cached;                 // Mip chain read back from the cache
+    const unsigned char* data;          // Whichever of the two holds the chain
+};
+
+class TextureManager {
+public:
+    TextureManager();
+    ~TextureManager();
+
+    // Returns the array texture and layer holding the image, or a texture ID of 0 while it is not loaded yet.
+    // The first request queues the image for the loader thread, which decodes it (or reads it back from the
+    // disk cache) and builds its mip chain; queued images are loaded largest priority (on-screen area) first.
+    // Images with matching size and format end up as layers of one array texture
+    TextureLayer requestTexture(const std::string& path, float priority);
+
+    // Forgets an image requested through requestTexture; the array texture is deleted with its last layer
+    void releaseTexture(const std::string& path);
+
+    // Asks for the given mip level to be resident and marks the texture as drawn this frame;
+    // the finest request per frame wins
+    void requestMipLevel(GLuint textureID, int level);
+
+    // Packs the images the loader thread finished, streams missing finer levels in, drops levels nobody asked for and keeps
+    // the resident size within the budget. Call once per frame after all requests have been made
+    void update();
+
+    // Whether any level of the texture is on the GPU (evicted textures must not be sampled)
+    bool isResident(GLuint textureID) const;
+
+    // Texture memory budget; textures are downscaled on load and least recently drawn
+    // textures lose mips (or are evicted) to stay within it
+    void setBudgetBytes(size_t bytes);
+    size_t getBudgetBytes() const;
+
+    // Size (largest dimension) of the top mip, 0 if unknown
+    int getTextureSize(GLuint textureID) const;
+
+    // Finest level currently resident on the GPU, -1 if unknown
+    int getResidentLevel(GLuint textureID) const;
+
+    // Bytes currently uploaded to the GPU for all textures
+    size_t getResidentBytes() const;
+
+    // Changes whenever update() packs new images or uploads or drops levels
+    unsigned int getResidencyVersion() const;
+
+    // Images requested but not loaded yet
+    size_t getPendingLoadCount() const;
+
+    // Disk cache of decoded images
+    TextureCache& getTextureCache();
+
+private:
+    // Load state of one requested image
+    struct TextureRequest {
+        TextureLayer location;  // Texture ID 0 until the image is packed
+        bool failed;            // The image could not be loaded, it is not retried
+    };
+
+    // Loader thread: decodes queued images, highest priority first
+    void loaderLoop();
+
+    // Decodes one image into its mip chain, through the disk cache
+    void decodeImage(const std::string& path, DecodedImage& image);
+
+    // Adds a decoded image as a new layer of the array texture matching its size and format
+    void packImage(DecodedImage& image);
+
+    // Deletes an array texture and its accounting
+    void deleteTexture(GLuint textureID);
+
+    // Uploads or frees levels so that the texture is resident from newBase down
+    void setResidentBase(GLuint textureID, ManagedTexture& texture, int newBase);
+
+    // Uploads one mip level of a texture (the texture must be bound)
+    void uploadLevel(const ManagedTexture& texture, int level);
+
+    // Frees one mip level of a texture on the GPU (the texture must be bound)
+    void dropLevel(const ManagedTexture& texture, int level);
+
+    // Takes mips away from the least recently drawn textures until the given amount fits in the budget.
+    // Textures drawn this frame keep their coarse levels; returns false if no room could be made
+    bool makeRoom(size_t bytes, GLuint requester);
+
+    // Drops the finest CPU levels until the whole chain fits within maxBytes (never below the coarse level)
+    static int downscaleToFit(ManagedTexture& texture, size_t maxBytes);
+
+    // Builds the full mip chain of one image on the CPU with a 2x2 box filter
+    static void buildMipChain(const unsigned char* data, int width, int height, int components,
+        std::vector<TextureMip>& mips, std::vector<unsigned char>& pixels);
+
+    // Lays out the levels of a mip chain in one blob, finest first; returns the size of the blob
+    static size_t layoutMipChain(int width, int height, int components, std::vector<TextureMip>& mips);
+
+    // First level whose largest dimension fits within the initial resident size
+    static int coarseLevel(const ManagedTexture& texture);
+
+    std::unordered_map<GLuint, ManagedTexture> textures;
+    std::unordered_map<std::string, TextureRequest> requests;
+    TextureCache textureCache;
+    size_t residentBytes;   // Bytes currently on the GPU
+    size_t committedBytes;  // Bytes all textures would take with every level resident
+    size_t budgetBytes;
+    unsigned int frameIndex;
+    unsigned int residencyVersion;
+
+    // Shared with the loader thread
+    std::thread loaderThread;
+    std::mutex loadMutex;
+    std::condition_variable loadCondition;
+    std::unordered_map<std::string, float> pendingLoads;  // Queued paths and their priority
+    std::vector<DecodedImage> finishedLoads;
+    bool stopLoader;
+};
+
+#endif // TEXTUREMANAGER_H
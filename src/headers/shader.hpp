@@ -2,9 +2,11 @@
 #define SHADER_HPP
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string>
 #include <sstream>
 #include <vector>
+#include <unordered_map>
 #include <iostream>
 #include <fstream>
 #include <algorithm>
@@ -16,6 +18,116 @@
 using namespace glm;
 using namespace std;
 
-GLuint LoadShaders(const char* vertex_file_path, const char* fragment_file_path);
+// FNV-1a hash of a uniform name, evaluated at compile time for the constants below
+constexpr uint32_t hashUniformName(const char* name, uint32_t hash = 2166136261u) {
+    return *name ? hashUniformName(name + 1, (hash ^ static_cast<uint8_t>(*name)) * 16777619u) : hash;
+}
 
-#endif
\ No newline at end of file
+// Handle of a uniform. Array elements are addressed through the name with empty brackets
+// plus an index: "dirLights[].Direction" index 2 is dirLights[2].Direction
+struct UniformName {
+    uint32_t hash;
+    constexpr UniformName(const char* name) : hash(hashUniformName(name)) {}
+};
+
+// Linked shader program with the locations of its active uniforms looked up once at link time,
+// so setting a uniform never builds a string or asks the driver for a location
+class ShaderProgram {
+public:
+    ShaderProgram();
+
+    // Takes ownership of a linked program and reflects its active uniforms
+    explicit ShaderProgram(GLuint programID);
+    ~ShaderProgram();
+
+    ShaderProgram(const ShaderProgram&) = delete;
+    ShaderProgram& operator=(const ShaderProgram&) = delete;
+    ShaderProgram(ShaderProgram&& other) noexcept;
+    ShaderProgram& operator=(ShaderProgram&& other) noexcept;
+
+    // Program object, 0 if loading failed
+    GLuint getID() const;
+
+    void use() const;
+
+    // Deletes the program object
+    void destroy();
+
+    // Connects a uniform block of the program to a binding point (ignored if the program has no such block)
+    void bindUniformBlock(const char* blockName, GLuint binding) const;
+
+    // Location of a uniform (or of one element of an array), -1 if the program doesn't use it
+    GLint getLocation(UniformName name, int index = 0) const;
+
+    // Setters for the program currently in use; uniforms the program doesn't use are ignored
+    void setInt(UniformName name, int value, int index = 0) const;
+    void setFloat(UniformName name, float value, int index = 0) const;
+    void setVec3(UniformName name, const glm::vec3& value, int index = 0) const;
+    void setVec4(UniformName name, const glm::vec4& value, int index = 0) const;
+    void setMat4(UniformName name, const glm::mat4& value, int index = 0) const;
+    void setIntArray(UniformName name, const GLint* values, int count) const;
+
+private:
+    // Enumerates the active uniforms and records the location of every array element
+    void reflectUniforms();
+
+    GLuint programID;
+    std::unordered_map<uint32_t, std::vector<GLint>> uniformLocations;  // Name hash -> location per array element
+};
+
+// #define lines compiled into every stage of a program, right after its #version line
+class ShaderDefines {
+public:
+    void add(const char* name, int value = 1);
+
+    // The #define lines, empty if nothing was added
+    const std::string& getSource() const;
+
+private:
+    std::string source;
+};
+
+ShaderProgram LoadShaders(const char* vertex_file_path, const char* fragment_file_path);
+
+// Same with a geometry shader stage between the vertex and fragment stages
+ShaderProgram LoadShaders(const char* vertex_file_path, const char* geometry_file_path, const char* fragment_file_path);
+
+// Same with #defines injected into the sources, to compile a variant of the shaders
+ShaderProgram LoadShaders(const char* vertex_file_path, const char* fragment_file_path, const ShaderDefines& defines);
+ShaderProgram LoadShaders(const char* vertex_file_path, const char* geometry_file_path, const char* fragment_file_path,
+    const ShaderDefines& defines);
+
+// Uniforms of the viewer's shaders
+namespace Uniforms {
+    // Transforms (view, projection and light space come from the FrameBlock)
+    constexpr UniformName ModelMatrix("M");
+
+    // Shadows
+    constexpr UniformName ShadowMap("shadowMap");
+    constexpr UniformName CascadeIndex("cascadeIndex");
+    constexpr UniformName ShadowAtlas("shadowAtlas");
+    constexpr UniformName TileIndex("tileIndex");
+    constexpr UniformName PointShadowMaps("pointShadowMaps");
+    constexpr UniformName PointLightIndex("pointLightIndex");
+    constexpr UniformName ShadowMoments("shadowMoments");
+    constexpr UniformName ShadowDepth("shadowDepth");
+    constexpr UniformName MomentsSource("momentsSource");
+    constexpr UniformName CascadeLayer("cascadeLayer");
+    constexpr UniformName BlurRadius("blurRadius");
+    constexpr UniformName MomentsPass("momentsPass");
+
+    // Clustered lights
+    constexpr UniformName LocalLights("localLights");
+    constexpr UniformName ClusterRanges("clusterRanges");
+    constexpr UniformName ClusterIndices("clusterIndices");
+    constexpr UniformName DrawLightCount("drawLightCount");
+    constexpr UniformName DrawLights("drawLights[]");
+
+    // Materials
+    constexpr UniformName DiffuseTextures("diffuseTextures[]");
+    constexpr UniformName MaterialDiffuseColor("materialDiffuseColor");
+    constexpr UniformName MaterialSpecularColor("materialSpecularColor");
+    constexpr UniformName MaterialShininess("materialShininess");
+}
+
+#endif
@@ -33,6 +33,9 @@ std::string getExecutableDirectory() {
 const int SCREEN_WIDTH = 1024;
 const int SCREEN_HEIGHT = 768;
 
+// Longest the main loop sleeps waiting for input while the scene is static
+const int IDLE_WAIT_MS = 250;
+
 // Function to show file dialog and get OBJ file path
 std::string showFileDialog() {
 #ifdef _WIN32
@@ -99,10 +102,13 @@ int main(int argc, char* args[]) {
     // Enable drag and drop
     SDL_EventState(SDL_DROPFILE, SDL_ENABLE);
 
+    // Texture manager shared by the model and renderer (streams mips on demand)
+    TextureManager textureManager;
+
     // Create model - either with initial file or empty
-    Model model(hasInitialModel ? modelPath : "");
+    Model model(hasInitialModel ? modelPath : "", textureManager);
 
-    Renderer renderer(window, camera, model);
+    Renderer renderer(window, camera, model, textureManager);
     if (!renderer.init()) {
         return -1;
     }
@@ -118,17 +124,22 @@ int main(int argc, char* args[]) {
         return -1;
     }
 
-    Uint32 lastTime = SDL_GetTicks();
+    // The UI is drawn as the last pass of the renderer's frame
+    renderer.setOverlay(ImGuiApp::RenderDrawData, &imguiApp);
+
     while (running) {
-        Uint32 currentTime = SDL_GetTicks();
-        float deltaTime = (currentTime - lastTime) / 1000.0f;
-        lastTime = currentTime;
+        // Nothing on screen would change: block until an event arrives (the timeout picks up finished texture loads)
+        if (!renderer.needsRedraw()) {
+            SDL_WaitEventTimeout(NULL, IDLE_WAIT_MS);
+        }
 
         // Initialize io before the switch statement to avoid skipping it
         ImGuiIO& io = ImGui::GetIO();
         mouseCapturedByImGui = io.WantCaptureMouse;
 
         while (SDL_PollEvent(&event)) {
+            // Any input may change the UI or the camera
+            renderer.requestRedraw();
 
             switch (event.type) {
             case SDL_QUIT:
@@ -191,13 +202,16 @@ int main(int argc, char* args[]) {
             ImGui_ImplSDL2_ProcessEvent(&event);
         }
 
-        const Uint8* state = SDL_GetKeyboardState(NULL);
-
-        // Render the model with the renderer
-        renderer.renderScene();
+        if (!renderer.needsRedraw()) {
+            continue;
+        }
 
         // Run ImGui interface
         imguiApp.Run(&renderer, &model);
+
+        // Render the frame (scene and UI) once, then present it
+        renderer.renderScene();
+        window.swapBuffers();
     }
 
     imguiApp.Cleanup();
@@ -1,8 +1,11 @@
 #include "headers/shader.hpp"
+#include "headers/GLDebug.h"
+#include "headers/GLStateCache.h"
 #include <vector>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 
 // Function to check shader compilation errors
 void checkShaderCompilation(GLuint shaderID) {
@@ -34,88 +37,123 @@ void checkProgramLinking(GLuint programID) {
     }
 }
 
-GLuint LoadShaders(const char* vertex_file_path, const char* fragment_file_path) {
-    // Create shaders
-    GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-    GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+// Reads a shader source file, returns false if it can't be opened
+static bool readShaderFile(const char* file_path, std::string& code) {
+    std::ifstream stream(file_path, std::ios::in);
+    if (!stream.is_open()) {
+        std::cerr << "Impossible to open " << file_path << ". Are you in the right directory?" << std::endl;
+        return false;
+    }
+    std::stringstream sstr;
+    sstr << stream.rdbuf();
+    code = sstr.str();
+    return true;
+}
 
-    // Read Vertex Shader code from file
-    std::string VertexShaderCode;
-    std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-    if (VertexShaderStream.is_open()) {
-        std::stringstream sstr;
-        sstr << VertexShaderStream.rdbuf();
-        VertexShaderCode = sstr.str();
-        VertexShaderStream.close();
+// Inserts the defines after the #version line; #line keeps the compiler's line numbers those of the file
+static void injectDefines(std::string& code, const std::string& defines) {
+    if (defines.empty()) {
+        return;
     }
-    else {
-        std::cerr << "Impossible to open " << vertex_file_path << ". Are you in the right directory?" << std::endl;
-        return 0;
+    size_t version = code.find("#version");
+    size_t lineEnd = version == std::string::npos ? std::string::npos : code.find('\n', version);
+    if (lineEnd == std::string::npos) {
+        code.insert(0, defines + "#line 1\n");
+        return;
     }
+    int nextLine = static_cast<int>(std::count(code.begin(), code.begin() + lineEnd, '\n')) + 2;
+    code.insert(lineEnd + 1, defines + "#line " + std::to_string(nextLine) + "\n");
+}
 
-    // Read Fragment Shader code from file
-    std::string FragmentShaderCode;
-    std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-    if (FragmentShaderStream.is_open()) {
-        std::stringstream sstr;
-        sstr << FragmentShaderStream.rdbuf();
-        FragmentShaderCode = sstr.str();
-        FragmentShaderStream.close();
-    }
-    else {
-        std::cerr << "Impossible to open " << fragment_file_path << ". Are you in the right directory?" << std::endl;
+// Compiles one stage from a file, returns 0 on failure
+static GLuint compileShaderFile(GLenum type, const char* file_path, const char* stageName, const std::string& defines) {
+    std::string code;
+    if (!readShaderFile(file_path, code)) {
         return 0;
     }
+    injectDefines(code, defines);
 
-    GLint Result = GL_FALSE;
-    int InfoLogLength;
-
-    // Compile Vertex Shader
-    std::cout << "Compiling vertex shader: " << vertex_file_path << std::endl;
-    char const* VertexSourcePointer = VertexShaderCode.c_str();
-    glShaderSource(VertexShaderID, 1, &VertexSourcePointer, NULL);
-    glCompileShader(VertexShaderID);
+    std::cout << "Compiling " << stageName << " shader: " << file_path << std::endl;
+    GLuint shaderID = glCreateShader(type);
+    char const* sourcePointer = code.c_str();
+    glShaderSource(shaderID, 1, &sourcePointer, NULL);
+    glCompileShader(shaderID);
 
-    // Check Vertex Shader
-    glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-    glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    if (InfoLogLength > 0) {
-        std::vector<char> VertexShaderErrorMessage(InfoLogLength + 1);
-        glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-        std::cerr << "Vertex Shader Error: " << &VertexShaderErrorMessage[0] << std::endl;
+    GLint result = GL_FALSE;
+    int infoLogLength;
+    glGetShaderiv(shaderID, GL_COMPILE_STATUS, &result);
+    glGetShaderiv(shaderID, GL_INFO_LOG_LENGTH, &infoLogLength);
+    if (infoLogLength > 0) {
+        std::vector<char> errorMessage(infoLogLength + 1);
+        glGetShaderInfoLog(shaderID, infoLogLength, NULL, &errorMessage[0]);
+        std::cerr << stageName << " Shader Error: " << &errorMessage[0] << std::endl;
     }
-    if (Result == GL_FALSE) {
-        std::cerr << "Failed to compile vertex shader!" << std::endl;
+    if (result == GL_FALSE) {
+        std::cerr << "Failed to compile " << stageName << " shader!" << std::endl;
+        glDeleteShader(shaderID);
         return 0;
     }
+    return shaderID;
+}
+
+void ShaderDefines::add(const char* name, int value) {
+    source += "#define ";
+    source += name;
+    source += " " + std::to_string(value) + "\n";
+}
 
-    // Compile Fragment Shader
-    std::cout << "Compiling fragment shader: " << fragment_file_path << std::endl;
-    char const* FragmentSourcePointer = FragmentShaderCode.c_str();
-    glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer, NULL);
-    glCompileShader(FragmentShaderID);
+const std::string& ShaderDefines::getSource() const {
+    return source;
+}
 
-    // Check Fragment Shader
-    glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-    glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    if (InfoLogLength > 0) {
-        std::vector<char> FragmentShaderErrorMessage(InfoLogLength + 1);
-        glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-        std::cerr << "Fragment Shader Error: " << &FragmentShaderErrorMessage[0] << std::endl;
+ShaderProgram LoadShaders(const char* vertex_file_path, const char* fragment_file_path) {
+    return LoadShaders(vertex_file_path, nullptr, fragment_file_path, ShaderDefines());
+}
+
+ShaderProgram LoadShaders(const char* vertex_file_path, const char* geometry_file_path, const char* fragment_file_path) {
+    return LoadShaders(vertex_file_path, geometry_file_path, fragment_file_path, ShaderDefines());
+}
+
+ShaderProgram LoadShaders(const char* vertex_file_path, const char* fragment_file_path, const ShaderDefines& defines) {
+    return LoadShaders(vertex_file_path, nullptr, fragment_file_path, defines);
+}
+
+ShaderProgram LoadShaders(const char* vertex_file_path, const char* geometry_file_path, const char* fragment_file_path,
+    const ShaderDefines& defines) {
+    // Compile the stages
+    GLuint shaderIDs[3] = { 0, 0, 0 };
+    int shaderCount = 0;
+    bool compiled = true;
+
+    shaderIDs[shaderCount] = compileShaderFile(GL_VERTEX_SHADER, vertex_file_path, "Vertex", defines.getSource());
+    compiled = compiled && shaderIDs[shaderCount++] != 0;
+    if (compiled && geometry_file_path) {
+        shaderIDs[shaderCount] = compileShaderFile(GL_GEOMETRY_SHADER, geometry_file_path, "Geometry", defines.getSource());
+        compiled = shaderIDs[shaderCount++] != 0;
     }
-    if (Result == GL_FALSE) {
-        std::cerr << "Failed to compile fragment shader!" << std::endl;
-        return 0;
+    if (compiled) {
+        shaderIDs[shaderCount] = compileShaderFile(GL_FRAGMENT_SHADER, fragment_file_path, "Fragment", defines.getSource());
+        compiled = shaderIDs[shaderCount++] != 0;
+    }
+    if (!compiled) {
+        for (int i = 0; i < shaderCount; ++i) {
+            glDeleteShader(shaderIDs[i]);
+        }
+        return ShaderProgram();
     }
 
     // Link the program
     std::cout << "Linking program\n" << std::endl;
     GLuint ProgramID = glCreateProgram();
-    glAttachShader(ProgramID, VertexShaderID);
-    glAttachShader(ProgramID, FragmentShaderID);
+    for (int i = 0; i < shaderCount; ++i) {
+        glAttachShader(ProgramID, shaderIDs[i]);
+    }
     glLinkProgram(ProgramID);
+    GLDebug::setObjectLabel(GL_PROGRAM, ProgramID, geometry_file_path ? geometry_file_path : vertex_file_path);
 
     // Check the program
+    GLint Result = GL_FALSE;
+    int InfoLogLength;
     glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
     glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
     if (InfoLogLength > 0) {
@@ -123,17 +161,159 @@ GLuint LoadShaders(const char* vertex_file_path, const char* fragment_file_path)
         glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
         std::cerr << "Shader Program Linking Error: " << &ProgramErrorMessage[0] << std::endl;
     }
+
+    // Cleanup shaders
+    for (int i = 0; i < shaderCount; ++i) {
+        glDetachShader(ProgramID, shaderIDs[i]);
+        glDeleteShader(shaderIDs[i]);
+    }
+
     if (Result == GL_FALSE) {
         std::cerr << "Failed to link shader program!" << std::endl;
-        return 0;
+        glDeleteProgram(ProgramID);
+        return ShaderProgram();
     }
 
-    // Cleanup shaders
-    glDetachShader(ProgramID, VertexShaderID);
-    glDetachShader(ProgramID, FragmentShaderID);
+    return ShaderProgram(ProgramID);
+}
+
+ShaderProgram::ShaderProgram() : programID(0) {}
 
-    glDeleteShader(VertexShaderID);
-    glDeleteShader(FragmentShaderID);
+ShaderProgram::ShaderProgram(GLuint programID) : programID(programID) {
+    reflectUniforms();
+}
+
+ShaderProgram::~ShaderProgram() {
+    destroy();
+}
+
+ShaderProgram::ShaderProgram(ShaderProgram&& other) noexcept
+    : programID(other.programID), uniformLocations(std::move(other.uniformLocations)) {
+    other.programID = 0;
+}
+
+ShaderProgram& ShaderProgram::operator=(ShaderProgram&& other) noexcept {
+    if (this != &other) {
+        destroy();
+        programID = other.programID;
+        uniformLocations = std::move(other.uniformLocations);
+        other.programID = 0;
+    }
+    return *this;
+}
+
+GLuint ShaderProgram::getID() const {
+    return programID;
+}
 
-    return ProgramID;
+void ShaderProgram::use() const {
+    GLStateCache::get().useProgram(programID);
+}
+
+void ShaderProgram::destroy() {
+    if (programID) {
+        GLStateCache::get().forgetProgram(programID);
+        glDeleteProgram(programID);
+        programID = 0;
+    }
+    uniformLocations.clear();
+}
+
+void ShaderProgram::bindUniformBlock(const char* blockName, GLuint binding) const {
+    GLuint blockIndex = glGetUniformBlockIndex(programID, blockName);
+    if (blockIndex != GL_INVALID_INDEX) {
+        glUniformBlockBinding(programID, blockIndex, binding);
+    }
+}
+
+GLint ShaderProgram::getLocation(UniformName name, int index) const {
+    auto it = uniformLocations.find(name.hash);
+    if (it == uniformLocations.end() || index < 0 || index >= static_cast<int>(it->second.size())) {
+        return -1;
+    }
+    return it->second[index];
+}
+
+void ShaderProgram::setInt(UniformName name, int value, int index) const {
+    glUniform1i(getLocation(name, index), value);
+}
+
+void ShaderProgram::setFloat(UniformName name, float value, int index) const {
+    glUniform1f(getLocation(name, index), value);
+}
+
+void ShaderProgram::setVec3(UniformName name, const glm::vec3& value, int index) const {
+    glUniform3fv(getLocation(name, index), 1, &value[0]);
+}
+
+void ShaderProgram::setVec4(UniformName name, const glm::vec4& value, int index) const {
+    glUniform4fv(getLocation(name, index), 1, &value[0]);
+}
+
+void ShaderProgram::setMat4(UniformName name, const glm::mat4& value, int index) const {
+    glUniformMatrix4fv(getLocation(name, index), 1, GL_FALSE, &value[0][0]);
+}
+
+void ShaderProgram::setIntArray(UniformName name, const GLint* values, int count) const {
+    glUniform1iv(getLocation(name, 0), count, values);
+}
+
+void ShaderProgram::reflectUniforms() {
+    GLint uniformCount = 0;
+    GLint maxNameLength = 0;
+    glGetProgramiv(programID, GL_ACTIVE_UNIFORMS, &uniformCount);
+    glGetProgramiv(programID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+    std::vector<char> nameBuffer(maxNameLength + 1);
+
+    for (GLint i = 0; i < uniformCount; ++i) {
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(programID, i, static_cast<GLsizei>(nameBuffer.size()), nullptr, &size, &type, &nameBuffer[0]);
+        std::string name(&nameBuffer[0]);
+
+        // Members of uniform blocks have no location
+        GLint location = glGetUniformLocation(programID, name.c_str());
+        if (location < 0) {
+            continue;
+        }
+
+        // Arrays of basic types are reported once as "name[0]" with their size
+        std::string arrayName = name;
+        if (size > 1 && arrayName.size() > 3 && arrayName.compare(arrayName.size() - 3, 3, "[0]") == 0) {
+            arrayName.erase(arrayName.size() - 3);
+        }
+
+        // Drop the indices to get the key; the first one is the element index ("dirLights[2].Direction" -> "dirLights[].Direction", 2)
+        std::string key;
+        int elementIndex = -1;
+        for (size_t c = 0; c < arrayName.size(); ++c) {
+            key += arrayName[c];
+            if (arrayName[c] == '[') {
+                size_t end = arrayName.find(']', c);
+                if (elementIndex < 0) {
+                    elementIndex = std::atoi(arrayName.c_str() + c + 1);
+                }
+                c = end - 1;
+            }
+        }
+
+        if (size > 1) {
+            // The bare name addresses the whole array, "name[]" each of its elements
+            std::vector<GLint> elementLocations(size, -1);
+            for (GLint element = 0; element < size; ++element) {
+                std::string elementName = arrayName + "[" + std::to_string(element) + "]";
+                elementLocations[element] = glGetUniformLocation(programID, elementName.c_str());
+            }
+            uniformLocations[hashUniformName(key.c_str())].assign(1, location);
+            uniformLocations[hashUniformName((key + "[]").c_str())] = elementLocations;
+        }
+        else {
+            std::vector<GLint>& locations = uniformLocations[hashUniformName(key.c_str())];
+            int index = std::max(elementIndex, 0);
+            if (static_cast<int>(locations.size()) <= index) {
+                locations.resize(index + 1, -1);
+            }
+            locations[index] = location;
+        }
+    }
 }